@@ -0,0 +1,323 @@
+/*  hfile_auto.c -- Backend choice by filesystem type and file size.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+// A policy rule applies to files on filesystems of the given name or class
+// (or "*" for any) that are at least min_size bytes long.  Block size and
+// depth are left to the backend's own defaults when zero.
+typedef struct {
+    char fs[16];
+    uint64_t min_size;
+    char backend[16];
+    size_t block_size, depth;
+} auto_rule;
+
+// Rules are tried in order, so larger size thresholds come first.
+static const auto_rule default_rules[] = {
+    { "memory",   0,                    "mmap",     0, 0 },
+    { "parallel", (uint64_t) 64 << 20,  "prefetch", 0, 8 },
+    { "network",  (uint64_t) 16 << 20,  "prefetch", 1 << 20, 8 },
+    { "local",    (uint64_t) 16 << 30,  "direct",   4 << 20, 2 },
+    { "local",    (uint64_t) 64 << 10,  "mmap",     0, 0 },
+    { "*",        0,                    "plain",    0, 0 }
+};
+
+// The backends that may be chosen, and the URL options and environment
+// variables by which their block size and depth are set.
+static const struct {
+    const char *name;
+    const char *block_size_option, *block_size_var;
+    const char *depth_option, *depth_var;
+} backends[] = {
+    { "plain",    NULL, NULL, NULL, NULL },
+    { "mmap",     NULL, NULL, NULL, NULL },
+    { "direct",   "buffer_size", "HTS_DIRECT_BUFFER_SIZE",
+                  "buffers",     "HTS_DIRECT_BUFFERS" },
+    { "prefetch", "block_size",  "HTS_PREFETCH_BLOCK_SIZE",
+                  "depth",       "HTS_PREFETCH_DEPTH" },
+    { "uring",    "block_size",  "HTS_URING_BLOCK_SIZE",
+                  "depth",       "HTS_URING_DEPTH" }
+};
+
+// Filesystems recognised by statfs(2) type; others are taken to be local.
+static const struct {
+    unsigned long magic;
+    const char *name, *class;
+} filesystems[] = {
+    { 0x01021994, "tmpfs",  "memory" },
+    { 0x858458f6, "ramfs",  "memory" },
+    { 0x00006969, "nfs",    "network" },
+    { 0xff534d42, "cifs",   "network" },
+    { 0xfe534d42, "smb2",   "network" },
+    { 0x65735546, "fuse",   "network" },
+    { 0x0bd00bd0, "lustre", "parallel" },
+    { 0x47504653, "gpfs",   "parallel" },
+    { 0x00c36400, "ceph",   "parallel" },
+    { 0x19830326, "beegfs", "parallel" },
+    { 0x0000ef53, "ext4",   "local" },
+    { 0x58465342, "xfs",    "local" },
+    { 0x9123683e, "btrfs",  "local" },
+    { 0x2fc12fc1, "zfs",    "local" }
+};
+
+#define MAX_RULES 32
+
+// Upper limit on a rule's DEPTH, which is a number of buffers or blocks.
+#define MAX_DEPTH 4096
+
+static int find_backend(const char *name)
+{
+    unsigned i;
+    for (i = 0; i < sizeof backends / sizeof backends[0]; i++)
+        if (strcmp(name, backends[i].name) == 0) return i;
+    return -1;
+}
+
+// Parses a rule of the form FS[:MIN_SIZE]=BACKEND[:BLOCK_SIZE[:DEPTH]].
+static int parse_rule(char *text, auto_rule *rule)
+{
+    char *value = strchr(text, '='), *field;
+    size_t size;
+    long depth;
+
+    if (value == NULL) return -1;
+    *value++ = '\0';
+
+    memset(rule, 0, sizeof *rule);
+
+    if ((field = strchr(text, ':')) != NULL) {
+        *field++ = '\0';
+        if (hfile_parse_size(field, &size) < 0) return -1;
+        rule->min_size = size;
+    }
+    if (*text == '\0' || strlen(text) >= sizeof rule->fs) return -1;
+    strcpy(rule->fs, text);
+
+    if ((field = strchr(value, ':')) != NULL) {
+        *field++ = '\0';
+        char *depth_field = strchr(field, ':');
+        if (depth_field) {
+            *depth_field++ = '\0';
+            if (hfile_parse_int(depth_field, &depth) < 0 ||
+                depth < 1 || depth > MAX_DEPTH) return -1;
+            rule->depth = depth;
+        }
+        if (hfile_parse_size(field, &rule->block_size) < 0) return -1;
+    }
+    if (find_backend(value) < 0) return -1;
+    strcpy(rule->backend, value);
+
+    return 0;
+}
+
+// Reads $HTS_AUTO_POLICY, a list of rules separated by semicolons, which
+// take precedence over the built-in ones.  Returns the number of rules read.
+static unsigned read_policy(auto_rule *rules, unsigned max_rules)
+{
+    const char *policy = getenv("HTS_AUTO_POLICY");
+    char *copy, *text, *saveptr;
+    unsigned n = 0;
+
+    if (policy == NULL || *policy == '\0') return 0;
+    if ((copy = strdup(policy)) == NULL) return 0;
+
+    for (text = strtok_r(copy, "; ", &saveptr); text && n < max_rules;
+         text = strtok_r(NULL, "; ", &saveptr)) {
+        char *orig = strdup(text);
+        if (parse_rule(text, &rules[n]) == 0) n++;
+        else if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_auto] ignoring invalid HTS_AUTO_POLICY "
+                    "rule \"%s\"\n", orig? orig : text);
+        free(orig);
+    }
+
+    free(copy);
+    return n;
+}
+
+// Identifies the filesystem holding the file open on descriptor FD.
+static void filesystem_type(int fd, char *name, size_t size, const char **class)
+{
+    *class = "local";
+    snprintf(name, size, "unknown");
+
+#ifdef __linux__
+    struct statfs sfs;
+    unsigned i;
+
+    if (fstatfs(fd, &sfs) < 0) return;
+    snprintf(name, size, "0x%lx", (unsigned long) sfs.f_type);
+    for (i = 0; i < sizeof filesystems / sizeof filesystems[0]; i++)
+        if ((unsigned long) sfs.f_type == filesystems[i].magic) {
+            snprintf(name, size, "%s", filesystems[i].name);
+            *class = filesystems[i].class;
+            break;
+        }
+#endif
+}
+
+static const auto_rule *
+choose(const auto_rule *rules, unsigned nrules,
+       const char *fs, const char *class, uint64_t size)
+{
+    unsigned i;
+
+    for (i = 0; i < nrules; i++) {
+        const auto_rule *r = &rules[i];
+        if ((strcmp(r->fs, "*") == 0 || strcmp(r->fs, fs) == 0 ||
+             strcmp(r->fs, class) == 0) && size >= r->min_size)
+            return r;
+    }
+
+    return &default_rules[sizeof default_rules / sizeof default_rules[0] - 1];
+}
+
+// Appends option NAME=VALUE to URL, which has NOPTIONS options so far,
+// unless the user has set the equivalent environment variable ENVNAME,
+// which then takes precedence.
+static void add_option(char *url, int *noptions, const char *name,
+                       const char *envname, size_t value)
+{
+    const char *current;
+
+    if (name == NULL || value == 0) return;
+    if ((current = getenv(envname)) != NULL && *current) return;
+
+    sprintf(url + strlen(url), "%c%s=%zu", (*noptions)++? ',' : '#',
+            name, value);
+}
+
+// Opens FILENAME via the rule's backend, passing its parameters to the
+// backend as options appended to the URL.
+static hFILE *open_backend(const auto_rule *rule, const char *filename,
+                           const char *mode)
+{
+    int b = find_backend(rule->backend);
+    hFILE *fp;
+    char *url;
+    int noptions = 0, save;
+
+    if (strcmp(rule->backend, "plain") == 0) return hopen(filename, mode);
+
+    url = malloc(strlen(rule->backend) + strlen(filename) + 100);
+    if (url == NULL) return NULL;
+    sprintf(url, "%s:%s", rule->backend, filename);
+    add_option(url, &noptions, backends[b].block_size_option,
+               backends[b].block_size_var, rule->block_size);
+    add_option(url, &noptions, backends[b].depth_option,
+               backends[b].depth_var, rule->depth);
+
+    fp = hopen(url, mode);
+    save = errno;
+    free(url);
+    errno = save;
+    return fp;
+}
+
+static const char *strip_auto_scheme(const char *filename)
+{
+    if (strncmp(filename, "auto://localhost/", 17) == 0) filename += 16;
+    else if (strncmp(filename, "auto:///", 8) == 0) filename += 7;
+    else if (strncmp(filename, "auto:", 5) == 0) filename += 5;
+    return filename;
+}
+
+static hFILE *hopen_auto(const char *filename, const char *mode)
+{
+    auto_rule rules[MAX_RULES + sizeof default_rules / sizeof default_rules[0]];
+    unsigned nrules;
+    const auto_rule *rule;
+    const char *class;
+    char fs[24];
+    struct stat st;
+    hFILE *fp;
+    int fd;
+
+    filename = strip_auto_scheme(filename);
+
+    // Other URLs, files that cannot be examined, and files opened for
+    // writing are opened as usual.
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_RDONLY)
+        return hopen(filename, mode);
+    if ((fd = open(filename, O_RDONLY)) < 0) return hopen(filename, mode);
+    if (fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode)) {
+        close(fd);
+        return hopen(filename, mode);
+    }
+    filesystem_type(fd, fs, sizeof fs, &class);
+    close(fd);
+
+    nrules = read_policy(rules, MAX_RULES);
+    memcpy(&rules[nrules], default_rules, sizeof default_rules);
+    nrules += sizeof default_rules / sizeof default_rules[0];
+    rule = choose(rules, nrules, fs, class, st.st_size);
+
+    if (hts_verbose >= 5)
+        fprintf(stderr, "[M::hfile_auto] \"%s\" (%lld bytes on %s, %s): "
+                "using %s, block size %zu, depth %zu\n", filename,
+                (long long) st.st_size, fs, class, rule->backend,
+                rule->block_size, rule->depth);
+
+    fp = open_backend(rule, filename, mode);
+    if (fp == NULL && strcmp(rule->backend, "plain") != 0) {
+        // The backend's plugin may be unavailable or may not support this
+        // file, so fall back to ordinary access.
+        if (hts_verbose >= 4)
+            fprintf(stderr, "[W::hfile_auto] can't open \"%s\" via %s: %s; "
+                    "using plain access\n", filename, rule->backend,
+                    strerror(errno));
+        fp = hopen(filename, mode);
+    }
+
+    return fp;
+}
+
+static int auto_isremote(const char *filename)
+{
+    return hisremote(strip_auto_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_auto, auto_isremote, "auto", 50 };
+
+    self->name = "auto";
+    hfile_add_scheme_handler("auto", &handler);
+    return 0;
+}
@@ -0,0 +1,464 @@
+/*  hfile_bench.c -- Benchmark access patterns through hFILE backends.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "htslib/hfile.h"
+#include "hfile_env.h"
+
+// A benchmark pattern performs OPT.COUNT operations (or for sequential
+// scans, reads the whole file) and records each operation's latency.
+typedef int (*pattern_func)(hFILE *fp, char *buffer);
+
+static struct {
+    size_t size, blksize, stride, count;
+    unsigned long long seed;
+    int cold, warm;
+} opt;
+
+static struct {
+    uint64_t *latency;
+    size_t nops, maxops;
+    uint64_t bytes;
+} result;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// xorshift64*, so that runs are reproducible for a given seed.
+static uint64_t random_u64(void)
+{
+    opt.seed ^= opt.seed >> 12;
+    opt.seed ^= opt.seed << 25;
+    opt.seed ^= opt.seed >> 27;
+    return opt.seed * 2685821657736338717ULL;
+}
+
+static int record(uint64_t start)
+{
+    if (result.nops == result.maxops) {
+        size_t n = result.maxops? 2 * result.maxops : 4096;
+        uint64_t *latency = realloc(result.latency, n * sizeof (uint64_t));
+        if (latency == NULL) return -1;
+        result.latency = latency;
+        result.maxops = n;
+    }
+
+    result.latency[result.nops++] = now() - start;
+    return 0;
+}
+
+static int read_block(hFILE *fp, off_t offset, char *buffer, size_t length)
+{
+    ssize_t n;
+    if (hseek(fp, offset, SEEK_SET) < 0) return -1;
+    if ((n = hread(fp, buffer, length)) < 0) return -1;
+    result.bytes += n;
+    return 0;
+}
+
+static int sequential(hFILE *fp, char *buffer)
+{
+    for (;;) {
+        uint64_t start = now();
+        ssize_t n = hread(fp, buffer, opt.blksize);
+        if (n < 0) return -1;
+        else if (n == 0) break;
+        result.bytes += n;
+        if (record(start) < 0) return -1;
+    }
+
+    return 0;
+}
+
+static int strided(hFILE *fp, char *buffer)
+{
+    size_t i;
+    off_t offset = 0;
+
+    for (i = 0; i < opt.count; i++) {
+        uint64_t start = now();
+        if (read_block(fp, offset, buffer, opt.blksize) < 0) return -1;
+        if (record(start) < 0) return -1;
+        offset += opt.stride;
+        if (offset + opt.blksize > opt.size) offset = 0;
+    }
+
+    return 0;
+}
+
+static int random_reads(hFILE *fp, char *buffer)
+{
+    size_t i, nblocks = opt.size / opt.blksize;
+
+    for (i = 0; i < opt.count; i++) {
+        off_t offset = (random_u64() % nblocks) * opt.blksize;
+        uint64_t start = now();
+        if (read_block(fp, offset, buffer, opt.blksize) < 0) return -1;
+        if (record(start) < 0) return -1;
+    }
+
+    return 0;
+}
+
+// Each lookup bisects the file with small reads, as when searching a sorted
+// file or walking an index, then reads a block at the target.
+static int index_lookups(hFILE *fp, char *buffer)
+{
+    size_t i;
+
+    for (i = 0; i < opt.count; i++) {
+        off_t target = random_u64() % opt.size, lo = 0, hi = opt.size;
+        uint64_t start = now();
+
+        while (hi - lo > (off_t) opt.blksize) {
+            off_t mid = ((lo + hi) / 2) & ~(off_t) 4095;
+            if (mid <= lo) break;
+            if (read_block(fp, mid, buffer, 4096) < 0) return -1;
+            if (target < mid) hi = mid; else lo = mid;
+        }
+
+        if (read_block(fp, lo, buffer, opt.blksize) < 0) return -1;
+        if (record(start) < 0) return -1;
+    }
+
+    return 0;
+}
+
+static const struct { const char *name; pattern_func func; } patterns[] = {
+    { "sequential", sequential },
+    { "strided", strided },
+    { "random", random_reads },
+    { "index", index_lookups }
+};
+
+#define NPATTERNS (sizeof patterns / sizeof patterns[0])
+
+// Writes pseudo-random contents to FNAME unless it already has the right size.
+static int generate(const char *fname, size_t size)
+{
+    unsigned long long seed = opt.seed;
+    struct stat st;
+    char *buffer;
+    size_t done;
+    FILE *f;
+
+    if (stat(fname, &st) == 0 && (size_t) st.st_size == size) return 0;
+
+    f = fopen(fname, "wb");
+    if (f == NULL) return -1;
+    buffer = malloc(1048576);
+    if (buffer == NULL) { fclose(f); return -1; }
+
+    for (done = 0; done < size; ) {
+        size_t i, n = (size - done < 1048576)? size - done : 1048576;
+        for (i = 0; i + 8 <= n; i += 8) {
+            uint64_t r = random_u64();
+            memcpy(&buffer[i], &r, 8);
+        }
+        for (; i < n; i++) buffer[i] = random_u64();
+        if (fwrite(buffer, 1, n, f) != n) break;
+        done += n;
+    }
+
+    free(buffer);
+    opt.seed = seed;
+    if (fclose(f) != 0 || done < size) return -1;
+    return 0;
+}
+
+// Writes an encrypted copy of PLAIN to CIPHER via the cip: scheme.
+static int generate_cip(const char *plain, const char *cipher)
+{
+    struct stat st1, st2;
+    char url[8192], *buffer;
+    hFILE *in, *out;
+    ssize_t n = 0;
+    int ret = 0;
+
+    // The encrypted file also contains the 16-byte IV.
+    if (stat(plain, &st1) == 0 && stat(cipher, &st2) == 0 &&
+        st2.st_size == st1.st_size + 16 && st2.st_mtime >= st1.st_mtime)
+        return 0;
+
+    snprintf(url, sizeof url, "cip:%s", cipher);
+    if ((buffer = malloc(1048576)) == NULL) return -1;
+    if ((in = hopen(plain, "r")) == NULL) { free(buffer); return -1; }
+    if ((out = hopen(url, "w")) == NULL) {
+        hclose_abruptly(in);
+        free(buffer);
+        return -1;
+    }
+
+    while ((n = hread(in, buffer, 1048576)) > 0)
+        if (hwrite(out, buffer, n) != n) { ret = -1; break; }
+    if (n < 0) ret = -1;
+
+    if (hclose(out) < 0) ret = -1;
+    if (hclose(in) < 0) ret = -1;
+    free(buffer);
+    return ret;
+}
+
+// Evicts FNAME from the page cache, so that the next run reads from storage.
+static void drop_cache(const char *fname)
+{
+#ifdef POSIX_FADV_DONTNEED
+    int fd = open(fname, O_RDONLY);
+    if (fd >= 0) {
+        (void) fdatasync(fd);
+        (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+// Reads FNAME in full, so that it is resident in the page cache.
+static void warm_cache(const char *fname, char *buffer)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd >= 0) {
+        while (read(fd, buffer, opt.blksize) > 0) {}
+        close(fd);
+    }
+}
+
+static int cmp_u64(const void *av, const void *bv)
+{
+    uint64_t a = *(const uint64_t *) av, b = *(const uint64_t *) bv;
+    return (a < b)? -1 : (a > b);
+}
+
+static double percentile(double q)
+{
+    size_t k = q * result.nops;
+    if (k >= result.nops) k = result.nops - 1;
+    return result.latency[k] / 1e3;
+}
+
+static int run(const char *scheme, const char *fname, const char *url,
+               unsigned pattern, int cold, char *buffer)
+{
+    unsigned long long seed = opt.seed;
+    uint64_t start, elapsed;
+    double seconds, sum = 0;
+    hFILE *fp;
+    size_t i;
+    int ret;
+
+    if (cold) drop_cache(fname);
+    else warm_cache(fname, buffer);
+
+    result.nops = 0;
+    result.bytes = 0;
+
+    start = now();
+    fp = hopen(url, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "hfile_bench: can't open \"%s\": %s\n", url, strerror(errno));
+        return -1;
+    }
+    ret = patterns[pattern].func(fp, buffer);
+    if (ret < 0 && errno == ESPIPE) {
+        // Not a failure: this pattern is not applicable to this scheme.
+        hclose_abruptly(fp);
+        opt.seed = seed;
+        return 0;
+    }
+    else if (ret < 0)
+        fprintf(stderr, "hfile_bench: %s pattern on \"%s\" failed: %s\n",
+                patterns[pattern].name, url, strerror(errno));
+    if (hclose(fp) < 0) ret = -1;
+    elapsed = now() - start;
+    opt.seed = seed;  // Use the same offsets for each scheme
+
+    if (ret < 0 || result.nops == 0) return ret;
+
+    qsort(result.latency, result.nops, sizeof (uint64_t), cmp_u64);
+    for (i = 0; i < result.nops; i++) sum += result.latency[i];
+    seconds = elapsed / 1e9;
+
+    printf("%s\t%s\t%s\t%zu\t%llu\t%.6f\t%.3f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+           scheme, patterns[pattern].name, cold? "cold" : "warm",
+           result.nops, (unsigned long long) result.bytes, seconds,
+           result.bytes / seconds / 1e6, sum / result.nops / 1e3,
+           percentile(0.5), percentile(0.99), result.latency[result.nops-1] / 1e3);
+    fflush(stdout);
+    return 0;
+}
+
+static int select_patterns(char *list, int *selected)
+{
+    char *name;
+    unsigned i;
+
+    memset(selected, 0, NPATTERNS * sizeof (int));
+    for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        for (i = 0; i < NPATTERNS; i++)
+            if (strcmp(name, patterns[i].name) == 0) { selected[i] = 1; break; }
+        if (i == NPATTERNS) return -1;
+    }
+
+    return 0;
+}
+
+static void usage(FILE *fp)
+{
+    fprintf(fp,
+"Usage: hfile_bench [OPTION]... FILE [SCHEME]...\n"
+"Time access patterns on FILE (generated if necessary) via each URL SCHEME\n"
+"(e.g. \"mmap:\"; \"plain\" means plain FILE).  Schemes ending \"cip:\" use\n"
+"an encrypted copy, FILE.cip.\n"
+"\n"
+"  -b SIZE     Size of each read [64K]\n"
+"  -c MODE     Page cache state: cold, warm, or both [both]\n"
+"  -n COUNT    Number of strided, random, and index operations [1024]\n"
+"  -p LIST     Comma-separated patterns: sequential, strided, random, index\n"
+"              [all]\n"
+"  -s SIZE     Size of FILE [256M]\n"
+"  -S SIZE     Distance between strided reads [1M]\n"
+"  -r SEED     Random number seed [1]\n"
+"\n"
+"Results are written as tab-separated columns, with a header line.\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const char *default_schemes[] = { "plain" };
+    const char **schemes;
+    int selected[NPATTERNS];
+    char *fname, *cipname, *buffer;
+    int c, i, nschemes, status = EXIT_SUCCESS;
+    unsigned p;
+
+    opt.size = 256 << 20;
+    opt.blksize = 65536;
+    opt.stride = 1048576;
+    opt.count = 1024;
+    opt.seed = 1;
+    opt.cold = opt.warm = 1;
+    for (p = 0; p < NPATTERNS; p++) selected[p] = 1;
+
+    while ((c = getopt(argc, argv, "b:c:n:p:s:S:r:h")) >= 0)
+        switch (c) {
+        case 'b':
+            if (hfile_parse_size(optarg, &opt.blksize) < 0 || opt.blksize < 4096)
+                goto bad_usage;
+            break;
+        case 'c':
+            opt.cold = (strcmp(optarg, "cold") == 0 || strcmp(optarg, "both") == 0);
+            opt.warm = (strcmp(optarg, "warm") == 0 || strcmp(optarg, "both") == 0);
+            if (!opt.cold && !opt.warm) goto bad_usage;
+            break;
+        case 'n': opt.count = strtoul(optarg, NULL, 10); break;
+        case 'p': if (select_patterns(optarg, selected) < 0) goto bad_usage; break;
+        case 's': if (hfile_parse_size(optarg, &opt.size) < 0) goto bad_usage; break;
+        case 'S': if (hfile_parse_size(optarg, &opt.stride) < 0) goto bad_usage; break;
+        case 'r': opt.seed = strtoull(optarg, NULL, 0) | 1; break;
+        case 'h': usage(stdout); return EXIT_SUCCESS;
+        default:  goto bad_usage;
+        }
+
+    if (optind >= argc || opt.size < opt.blksize) goto bad_usage;
+
+    fname = argv[optind++];
+    if (optind < argc) {
+        schemes = (const char **) &argv[optind];
+        nschemes = argc - optind;
+    }
+    else {
+        schemes = default_schemes;
+        nschemes = 1;
+    }
+
+    buffer = malloc(opt.blksize);
+    cipname = malloc(strlen(fname) + 5);
+    if (buffer == NULL || cipname == NULL) {
+        fprintf(stderr, "hfile_bench: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    sprintf(cipname, "%s.cip", fname);
+
+    if (generate(fname, opt.size) < 0) {
+        fprintf(stderr, "hfile_bench: can't generate \"%s\": %s\n",
+                fname, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // The key only needs to be consistent between writing and reading.
+    setenv("HTS_CIP_KEY", "hfile_bench", 0);
+
+    printf("scheme\tpattern\tcache\tops\tbytes\tseconds\tMBps\tmean_us\tp50_us\tp99_us\tmax_us\n");
+
+    for (i = 0; i < nschemes; i++) {
+        const char *scheme = schemes[i];
+        size_t len = strlen(scheme);
+        const char *file = fname;
+        char *url;
+
+        if (len >= 4 && strcmp(&scheme[len-4], "cip:") == 0) {
+            if (generate_cip(fname, cipname) < 0) {
+                fprintf(stderr, "hfile_bench: can't generate \"%s\": %s\n",
+                        cipname, strerror(errno));
+                status = EXIT_FAILURE;
+                continue;
+            }
+            file = cipname;
+        }
+
+        if (strcmp(scheme, "plain") == 0) len = 0;
+        url = malloc(len + strlen(file) + 1);
+        if (url == NULL) { status = EXIT_FAILURE; break; }
+        sprintf(url, "%.*s%s", (int) len, scheme, file);
+
+        for (p = 0; p < NPATTERNS; p++) {
+            if (!selected[p]) continue;
+            if (opt.cold && run(scheme, file, url, p, 1, buffer) < 0)
+                status = EXIT_FAILURE;
+            if (opt.warm && run(scheme, file, url, p, 0, buffer) < 0)
+                status = EXIT_FAILURE;
+        }
+
+        free(url);
+    }
+
+    free(buffer);
+    free(cipname);
+    free(result.latency);
+    return status;
+
+bad_usage:
+    usage(stderr);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,485 @@
+/*  hfile_cache.c -- Block cache wrapper backend for low-level file streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+typedef struct cache_block {
+    off_t number;
+    size_t length;
+    struct cache_block *prev, *next;  // Doubly-linked LRU list
+    struct cache_block *chain;        // Hash bucket chain
+    char data[];
+} cache_block;
+
+typedef struct {
+    hFILE base;
+    hFILE *rawfp;
+    off_t pos, rawpos, size;  // size is -1 if not (yet) known
+    int seekable;
+
+    size_t blksize, nblocks, maxblocks, nbuckets;
+    cache_block **buckets;
+    cache_block lru;  // Sentinel: lru.next is most recently used
+
+    // Optional disk tier: a sparse file of blocks plus a bitmap of which
+    // blocks it contains, saved alongside it when the stream is closed.
+    int diskfd;
+    unsigned char *present;
+    size_t presentlen;
+    char *diskpath;
+    uint64_t created;  // When the disk tier's contents were first saved
+} hFILE_cache;
+
+#define MAP_MAGIC 0x50414d4548434802ULL
+
+typedef struct {
+    uint64_t magic, blksize, size, created;
+} cache_map_header;
+
+static inline size_t bucket_of(hFILE_cache *fp, off_t number)
+{
+    return (size_t) number & (fp->nbuckets - 1);
+}
+
+static void lru_unlink(cache_block *b)
+{
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+}
+
+static void lru_push_front(hFILE_cache *fp, cache_block *b)
+{
+    b->prev = &fp->lru;
+    b->next = fp->lru.next;
+    b->next->prev = b;
+    fp->lru.next = b;
+}
+
+static cache_block *lookup(hFILE_cache *fp, off_t number)
+{
+    cache_block *b;
+    for (b = fp->buckets[bucket_of(fp, number)]; b; b = b->chain)
+        if (b->number == number) {
+            lru_unlink(b);
+            lru_push_front(fp, b);
+            return b;
+        }
+    return NULL;
+}
+
+// Returns a block structure to be filled, evicting the least recently used
+// block if the cache is full.  The block is not yet in the hash table.
+static cache_block *new_block(hFILE_cache *fp)
+{
+    cache_block *b;
+
+    if (fp->nblocks < fp->maxblocks) {
+        b = malloc(sizeof (cache_block) + fp->blksize);
+        if (b == NULL) return NULL;
+        fp->nblocks++;
+        return b;
+    }
+
+    b = fp->lru.prev;
+    lru_unlink(b);
+    cache_block **bp = &fp->buckets[bucket_of(fp, b->number)];
+    while (*bp != b) bp = &(*bp)->chain;
+    *bp = b->chain;
+    return b;
+}
+
+static void insert(hFILE_cache *fp, cache_block *b)
+{
+    size_t i = bucket_of(fp, b->number);
+    b->chain = fp->buckets[i];
+    fp->buckets[i] = b;
+    lru_push_front(fp, b);
+}
+
+static inline int on_disk(hFILE_cache *fp, off_t number)
+{
+    size_t i = number / 8;
+    return fp->diskfd >= 0 && i < fp->presentlen &&
+           (fp->present[i] & (1 << (number % 8)));
+}
+
+static void save_to_disk(hFILE_cache *fp, const cache_block *b)
+{
+    size_t i = b->number / 8;
+    if (fp->diskfd < 0 || i >= fp->presentlen) return;
+    // Only complete blocks are kept, so a partial final block is refetched.
+    if (b->length < fp->blksize && b->number * fp->blksize + b->length < fp->size) return;
+
+    if (pwrite(fp->diskfd, b->data, b->length, b->number * fp->blksize)
+        == (ssize_t) b->length)
+        fp->present[i] |= 1 << (b->number % 8);
+}
+
+// Reads the given block from the inner stream, which must be positioned
+// at or before it if it is not seekable.  Returns the number of bytes read.
+static ssize_t fetch_raw(hFILE_cache *fp, off_t number, char *data)
+{
+    off_t offset = number * fp->blksize;
+
+    if (fp->rawpos != offset) {
+        if (fp->seekable) {
+            if (hseek(fp->rawfp, offset, SEEK_SET) < 0) return -1;
+            fp->rawpos = offset;
+        }
+        else if (fp->rawpos > offset) { errno = ESPIPE; return -1; }
+    }
+
+    // A non-seekable stream is read forward to the desired block, caching
+    // each intervening block along the way.
+    while (fp->rawpos < offset) {
+        off_t skipped = fp->rawpos / fp->blksize;
+        ssize_t n = hread(fp->rawfp, data, fp->blksize);
+        if (n < 0) return -1;
+        fp->rawpos += n;
+
+        if (lookup(fp, skipped) == NULL) {
+            cache_block *b = new_block(fp);
+            if (b == NULL) return -1;
+            b->number = skipped;
+            b->length = n;
+            memcpy(b->data, data, n);
+            insert(fp, b);
+            save_to_disk(fp, b);
+        }
+
+        if (n < (ssize_t) fp->blksize) { fp->size = fp->rawpos; return 0; }
+    }
+
+    ssize_t n = hread(fp->rawfp, data, fp->blksize);
+    if (n < 0) return -1;
+    fp->rawpos += n;
+    if (n < (ssize_t) fp->blksize) fp->size = fp->rawpos;
+    return n;
+}
+
+static cache_block *get_block(hFILE_cache *fp, off_t number)
+{
+    cache_block *b = lookup(fp, number);
+    if (b) return b;
+
+    b = new_block(fp);
+    if (b == NULL) return NULL;
+    b->number = number;
+
+    ssize_t n = -1;
+    if (on_disk(fp, number)) {
+        size_t length = fp->blksize;
+        if (fp->size >= 0 && number * fp->blksize + length > fp->size)
+            length = fp->size - number * fp->blksize;
+        n = pread(fp->diskfd, b->data, length, number * fp->blksize);
+        if (n != (ssize_t) length) n = -1;
+    }
+
+    if (n < 0) {
+        n = fetch_raw(fp, number, b->data);
+        if (n < 0) { fp->nblocks--; free(b); return NULL; }
+        b->length = n;
+        save_to_disk(fp, b);
+    }
+    else b->length = n;
+
+    insert(fp, b);
+    return b;
+}
+
+static ssize_t cache_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_cache *fp = (hFILE_cache *) fpv;
+    if (fp->size >= 0 && fp->pos >= fp->size) return 0;
+
+    off_t number = fp->pos / fp->blksize;
+    cache_block *b = get_block(fp, number);
+    if (b == NULL) return -1;
+
+    size_t skip = fp->pos - number * fp->blksize;
+    size_t avail = (b->length > skip)? b->length - skip : 0;
+    if (nbytes > avail) nbytes = avail;
+    memcpy(buffer, b->data + skip, nbytes);
+    fp->pos += nbytes;
+    return nbytes;
+}
+
+static ssize_t cache_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    errno = EBADF;
+    return -1;
+}
+
+static off_t cache_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_cache *fp = (hFILE_cache *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END:
+        if (fp->size < 0) { errno = ESPIPE; return -1; }
+        origin = fp->size;
+        break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || (fp->size >= 0 && offset > fp->size - origin)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void save_map(hFILE_cache *fp)
+{
+    char tmppath[PATH_MAX];
+    cache_map_header hdr = { MAP_MAGIC, fp->blksize, fp->size, fp->created };
+    unsigned char *ondisk = malloc(fp->presentlen);
+    size_t i;
+    FILE *f;
+
+    // Merge in blocks saved meanwhile by other processes, unless another
+    // process has meanwhile discarded these contents as too old.
+    snprintf(tmppath, sizeof tmppath, "%s.map", fp->diskpath);
+    if (ondisk && (f = fopen(tmppath, "rb")) != NULL) {
+        cache_map_header old;
+        int newer = 0;
+        if (fread(&old, sizeof old, 1, f) == 1 && old.magic == MAP_MAGIC &&
+            old.blksize == hdr.blksize && old.size == hdr.size) {
+            if (old.created == hdr.created &&
+                fread(ondisk, 1, fp->presentlen, f) == fp->presentlen)
+                for (i = 0; i < fp->presentlen; i++)
+                    fp->present[i] |= ondisk[i];
+            else if (old.created > hdr.created) newer = 1;
+        }
+        fclose(f);
+        if (newer) { free(ondisk); return; }
+    }
+    free(ondisk);
+
+    snprintf(tmppath, sizeof tmppath, "%s.map.%ld", fp->diskpath, (long) getpid());
+    f = fopen(tmppath, "wb");
+    if (f == NULL) return;
+    int ok = fwrite(&hdr, sizeof hdr, 1, f) == 1 &&
+             fwrite(fp->present, 1, fp->presentlen, f) == fp->presentlen;
+    if (fclose(f) != 0) ok = 0;
+
+    char mappath[PATH_MAX];
+    snprintf(mappath, sizeof mappath, "%s.map", fp->diskpath);
+    if (! ok || rename(tmppath, mappath) < 0) (void) unlink(tmppath);
+}
+
+static int cache_close(hFILE *fpv)
+{
+    hFILE_cache *fp = (hFILE_cache *) fpv;
+    cache_block *b, *next;
+    int err = 0;
+
+    if (fp->diskfd >= 0) {
+        save_map(fp);
+        if (close(fp->diskfd) < 0) err = errno;
+    }
+    free(fp->diskpath);
+    free(fp->present);
+
+    for (b = fp->lru.next; b != &fp->lru; b = next) {
+        next = b->next;
+        free(b);
+    }
+    free(fp->buckets);
+
+    if (hclose(fp->rawfp) < 0) err = errno;
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend cache_backend =
+{
+    cache_read, cache_write, cache_seek, NULL, cache_close
+};
+
+// Opens the disk tier for this URL in $HTS_CACHE_DIR, if that is set.
+// This is only possible when the inner stream's size is known, so that
+// the cached blocks can at least be checked against that.  Backends do not
+// report validators such as ETags, so a changed file of the same size is
+// not noticed; instead, blocks first saved more than $HTS_CACHE_MAX_AGE
+// seconds ago are discarded.
+static void open_disk_tier(hFILE_cache *fp, const char *url)
+{
+    const char *dir = getenv("HTS_CACHE_DIR");
+    uint64_t now = time(NULL);
+    long max_age;
+    char path[PATH_MAX];
+    uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+    const unsigned char *s;
+    FILE *f;
+
+    if (dir == NULL || *dir == '\0' || fp->size < 0) return;
+    max_age = hfile_env_int("HTS_CACHE_MAX_AGE", 86400, 0, LONG_MAX);
+
+    for (s = (const unsigned char *) url; *s; s++)
+        hash = (hash ^ *s) * 0x100000001b3ULL;
+    snprintf(path, sizeof path, "%s/%016llx-%llu.cache", dir,
+             (unsigned long long) hash, (unsigned long long) fp->size);
+
+    fp->presentlen = (fp->size / fp->blksize) / 8 + 1;
+    fp->present = calloc(fp->presentlen, 1);
+    fp->diskpath = strdup(path);
+    if (fp->present == NULL || fp->diskpath == NULL) goto error;
+
+    fp->diskfd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fp->diskfd < 0) goto error;
+
+    // Blocks already in the file but not marked in the map are ignored, and
+    // are overwritten as they are fetched again.
+    fp->created = now;
+    snprintf(path, sizeof path, "%s.map", fp->diskpath);
+    if ((f = fopen(path, "rb")) != NULL) {
+        cache_map_header hdr;
+        if (fread(&hdr, sizeof hdr, 1, f) == 1 && hdr.magic == MAP_MAGIC &&
+            hdr.blksize == fp->blksize && hdr.size == (uint64_t) fp->size &&
+            (max_age == 0 || hdr.created + max_age > now) &&
+            fread(fp->present, 1, fp->presentlen, f) == fp->presentlen)
+            fp->created = hdr.created;
+        else
+            memset(fp->present, 0, fp->presentlen);
+        fclose(f);
+    }
+
+    return;
+
+error:
+    if (hts_verbose >= 4)
+        fprintf(stderr, "[W::hfile_cache] can't use disk cache \"%s\": %s\n",
+                path, strerror(errno));
+    free(fp->present);
+    free(fp->diskpath);
+    fp->present = NULL;
+    fp->presentlen = 0;
+    fp->diskpath = NULL;
+    fp->diskfd = -1;
+}
+
+static const char *strip_cache_scheme(const char *filename)
+{
+    if (strncmp(filename, "cache+", 6) == 0) filename += 6;
+    else if (strncmp(filename, "cache:", 6) == 0) filename += 6;
+    return filename;
+}
+
+static hFILE *hopen_cache(const char *filename, const char *mode)
+{
+    const char *url = strip_cache_scheme(filename);
+    hFILE_cache *fp = NULL;
+    int save;
+
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_RDONLY) { errno = EINVAL; goto error; }
+
+    fp = (hFILE_cache *) hfile_init(sizeof (hFILE_cache), mode, 0);
+    if (fp == NULL) goto error;
+
+    fp->buckets = NULL;
+    fp->diskfd = -1;
+    fp->present = NULL;
+    fp->presentlen = 0;
+    fp->diskpath = NULL;
+    fp->lru.prev = fp->lru.next = &fp->lru;
+    fp->nblocks = 0;
+
+    fp->rawfp = hopen(url, mode);
+    if (fp->rawfp == NULL) goto error;
+
+    fp->blksize = hfile_env_size("HTS_CACHE_BLOCK_SIZE", 262144);
+    if (fp->blksize < 512) fp->blksize = 512;
+    fp->maxblocks = hfile_env_size("HTS_CACHE_MEMORY", 67108864) / fp->blksize;
+    if (fp->maxblocks < 2) fp->maxblocks = 2;
+    for (fp->nbuckets = 16; fp->nbuckets < fp->maxblocks; fp->nbuckets *= 2) ;
+    fp->buckets = calloc(fp->nbuckets, sizeof (cache_block *));
+    if (fp->buckets == NULL) goto error;
+
+    fp->size = hseek(fp->rawfp, 0, SEEK_END);
+    fp->seekable = (fp->size >= 0 && hseek(fp->rawfp, 0, SEEK_SET) == 0);
+    if (! fp->seekable) {
+        // Clear the failed seek's error so it isn't reported by hclose().
+        hclearerr(fp->rawfp);
+        fp->size = -1;
+    }
+    fp->pos = fp->rawpos = 0;
+
+    open_disk_tier(fp, url);
+
+    fp->base.backend = &cache_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp) {
+        if (fp->rawfp) hclose_abruptly(fp->rawfp);
+        free(fp->buckets);
+        hfile_destroy((hFILE *) fp);
+    }
+    errno = save;
+    return NULL;
+}
+
+static int cache_isremote(const char *filename)
+{
+    return hisremote(strip_cache_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_cache, cache_isremote, "cache", 50 };
+
+    // HTSlib dispatches on the entire scheme, so "cache+URL" must be
+    // registered for each inner scheme.  Other URLs can use "cache:URL".
+    static const char *const schemes[] = {
+        "cache", "cache+file", "cache+http", "cache+https", "cache+ftp",
+        "cache+ftps", "cache+s3", "cache+s3+http", "cache+s3+https",
+        "cache+gs", "cache+gs+http", "cache+gs+https", "cache+irods",
+        "cache+cip", "cache+mmap", "cache+direct", "cache+uring"
+    };
+    size_t i;
+
+    self->name = "cache";
+    for (i = 0; i < sizeof schemes / sizeof schemes[0]; i++)
+        hfile_add_scheme_handler(schemes[i], &handler);
+    return 0;
+}
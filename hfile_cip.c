@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #if defined HAVE_OPENSSL
 #include <openssl/aes.h>
@@ -50,17 +51,29 @@ DEALINGS IN THE SOFTWARE.  */
 
 #include "htslib/hts.h"  // for hts_verbose
 #include "hfile_internal.h"
+#include "hfile_ext.h"
+#include "hfile_env.h"
+#include "hfile_probes.h"
+#include "hfile_ranges.h"
+#include "hfile_stats.h"
+#include "hfile_view.h"
+
+#if defined HAVE_OPENSSL
+typedef EVP_CIPHER_CTX *cipher_ctx;
+#elif defined HAVE_COMMONCRYPTO
+typedef CCCryptorRef cipher_ctx;
+#endif
 
 typedef struct {
     hFILE base;
     unsigned char *buffer;
     size_t bufsize;
     hFILE *rawfp;
-#if defined HAVE_OPENSSL
-    EVP_CIPHER_CTX *ctx;
-#elif defined HAVE_COMMONCRYPTO
-    CCCryptorRef cryptor;
-#endif
+    int rawfd;  // For positional reads of local files, or -1
+    unsigned nthreads;  // For reading ranges
+    hfile_stats stats;
+    cipher_ctx ctx;
+    uint8_t secret[16], iv[16];
 } hFILE_cip;
 
 #if defined HAVE_OPENSSL
@@ -89,15 +102,33 @@ static inline int gen_random(uint8_t *buffer, size_t length)
     return 0;
 }
 
+static int
+cipher_init(cipher_ctx *ctx, const uint8_t *secret, const uint8_t *iv,
+            int encrypt)
+{
+    *ctx = EVP_CIPHER_CTX_new();
+    if (*ctx == NULL)
+        { errno = ssl_errno("EVP_CIPHER_CTX_new"); return -1; }
+    if (! EVP_CipherInit_ex(*ctx, EVP_aes_128_ctr(), NULL, secret, iv, encrypt))
+        { errno = ssl_errno("EVP_CipherInit_ex"); return -1; }
+    return 0;
+}
+
 static inline ssize_t
-cipher_update(hFILE_cip *fp, const void *in, void *out, size_t length)
+cipher_update(cipher_ctx ctx, const void *in, void *out, size_t length)
 {
     int n = length;
-    if (! EVP_CipherUpdate(fp->ctx, out, &n, in, length))
+    if (! EVP_CipherUpdate(ctx, out, &n, in, length))
         { errno = ssl_errno("EVP_CipherUpdate"); return -1; }
     return n;
 }
 
+static int cipher_free(cipher_ctx ctx)
+{
+    EVP_CIPHER_CTX_free(ctx);
+    return 0;
+}
+
 #elif defined HAVE_COMMONCRYPTO
 
 static int cc_errno(CCStatus status, const char *function)
@@ -131,38 +162,70 @@ static inline int gen_random(uint8_t *buffer, size_t length)
     return 0;
 }
 
+static int
+cipher_init(cipher_ctx *ctx, const uint8_t *secret, const uint8_t *iv,
+            int encrypt)
+{
+    // Even though kCCModeOptionCTR_BE is deprecated, CCCryptorCreateWithMode()
+    // fails (returning kCCUnimplemented) if it is not specified.
+    CCOperation operation = encrypt? kCCEncrypt : kCCDecrypt;
+    CCStatus ret = CCCryptorCreateWithMode(operation, kCCModeCTR,
+            kCCAlgorithmAES, 0, iv, secret, 16, NULL, 0, 0,
+            kCCModeOptionCTR_BE, ctx);
+    if (ret != kCCSuccess) {
+        *ctx = NULL;
+        errno = cc_errno(ret, "CCCryptorCreateWithMode");
+        return -1;
+    }
+    return 0;
+}
+
 static inline ssize_t
-cipher_update(hFILE_cip *fp, const void *in, void *out, size_t length)
+cipher_update(cipher_ctx ctx, const void *in, void *out, size_t length)
 {
     size_t n;
-    CCStatus ret = CCCryptorUpdate(fp->cryptor, in, length, out, length, &n);
+    CCStatus ret = CCCryptorUpdate(ctx, in, length, out, length, &n);
     if (ret != kCCSuccess)
         { errno = cc_errno(ret, "CCCryptorUpdate"); return -1; }
     return n;
 }
 
+static int cipher_free(cipher_ctx ctx)
+{
+    CCStatus ret = CCCryptorRelease(ctx);
+    if (ret != kCCSuccess) return cc_errno(ret, "CCCryptorRelease");
+    return 0;
+}
+
 #endif
 
+static hfile_stats cip_stats = { "cip" };
+
 static ssize_t cip_read(hFILE *fpv, void *bufferv, size_t nbytes)
 {
     hFILE_cip *fp = (hFILE_cip *) fpv;
     char *buffer = (char *) bufferv;
+    HFILE_PROBE3(read_entry, fpv, fpv->offset, nbytes);
+    uint64_t start = hfile_stats_start();
+    size_t length = nbytes;
     ssize_t total = 0;
 
     while (nbytes > 0) {
         size_t n = (nbytes < fp->bufsize)? nbytes : fp->bufsize;
         ssize_t nread = hread(fp->rawfp, fp->buffer, n);
         if (nread == 0) break;
-        else if (nread < 0) return -1;
+        else if (nread < 0) { total = -1; break; }
 
-        ssize_t nout = cipher_update(fp, fp->buffer, buffer, nread);
-        if (nout < 0) return -1;
+        ssize_t nout = cipher_update(fp->ctx, fp->buffer, buffer, nread);
+        if (nout < 0) { total = -1; break; }
 
         buffer += nout;
         nbytes -= nout;
         total += nout;
     }
 
+    hfile_stats_end(&fp->stats, HFILE_STATS_READ, start, total);
+    HFILE_PROBE4(read_return, fpv, fpv->offset, length, total);
     return total;
 }
 
@@ -170,25 +233,114 @@ static ssize_t cip_write(hFILE *fpv, const void *bufferv, size_t nbytes)
 {
     hFILE_cip *fp = (hFILE_cip *) fpv;
     const char *buffer = (const char *) bufferv;
+    HFILE_PROBE3(write_entry, fpv, fpv->offset, nbytes);
+    uint64_t start = hfile_stats_start();
+    size_t length = nbytes;
     ssize_t total = 0;
 
     while (nbytes > 0) {
         size_t n = (nbytes < fp->bufsize)? nbytes : fp->bufsize;
-        ssize_t nout = cipher_update(fp, buffer, fp->buffer, n);
-        if (nout < 0) return -1;
+        ssize_t nout = cipher_update(fp->ctx, buffer, fp->buffer, n);
+        if (nout < 0) { total = -1; break; }
 
-        if (hwrite(fp->rawfp, fp->buffer, nout) != nout) return -1;
+        if (hwrite(fp->rawfp, fp->buffer, nout) != nout) { total = -1; break; }
 
         buffer += n;
         nbytes -= n;
         total += n;
     }
 
+    hfile_stats_end(&fp->stats, HFILE_STATS_WRITE, start, total);
+    HFILE_PROBE4(write_return, fpv, fpv->offset, length, total);
+    return total;
+}
+
+// Reads the encrypted data at OFFSET (excluding the IV) without disturbing
+// the stream position of RAWFP.
+static ssize_t
+raw_read_at(hFILE_cip *fp, off_t offset, char *buffer, size_t length)
+{
+    size_t total = 0;
+    offset += sizeof fp->iv;
+
+    while (total < length) {
+        ssize_t n = (fp->rawfd >= 0)
+            ? pread(fp->rawfd, &buffer[total], length - total, offset + total)
+            : hfile_read_at(fp->rawfp, offset + total, &buffer[total],
+                            length - total);
+        if (n < 0 && errno == EINTR && fp->rawfd >= 0) continue;
+        else if (n < 0) return -1;
+        else if (n == 0) break;
+        total += n;
+    }
+
     return total;
 }
 
+// In CTR mode, block N of the data is XORed with AES(secret, IV + N), so
+// a fresh context whose counter starts at the block containing OFFSET can
+// decrypt from there without reference to the stream's own cipher state.
+static ssize_t
+cip_read_at(void *fpv, off_t offset, void *buffer, size_t nbytes)
+{
+    hFILE_cip *fp = (hFILE_cip *) fpv;
+    HFILE_PROBE3(read_entry, fpv, offset, nbytes);
+    uint64_t start = hfile_stats_start();
+    uint64_t block = offset / BLOCKSIZE;
+    size_t skip = offset % BLOCKSIZE;
+    uint8_t counter[16], discard[BLOCKSIZE];
+    cipher_ctx ctx = NULL;
+    ssize_t n = -1;
+    int i, carry;
+
+    if (fp->base.readonly == 0) { errno = EBADF; goto done; }
+
+    n = raw_read_at(fp, offset, buffer, nbytes);
+    if (n <= 0) goto done;
+
+    // Add BLOCK to the IV, treated as a 128-bit big-endian integer.
+    for (i = 15, carry = 0; i >= 0; i--) {
+        unsigned sum = fp->iv[i] + (block & 0xff) + carry;
+        counter[i] = sum & 0xff;
+        carry = sum >> 8;
+        block >>= 8;
+    }
+
+    if (cipher_init(&ctx, fp->secret, counter, 0) < 0 ||
+        cipher_update(ctx, discard, discard, skip) < 0 ||
+        cipher_update(ctx, buffer, buffer, n) < 0) n = -1;
+
+done:
+    if (ctx) { int save = errno; cipher_free(ctx); errno = save; }
+    hfile_stats_end(&fp->stats, HFILE_STATS_READ, start, n);
+    HFILE_PROBE4(read_return, fpv, offset, nbytes, n);
+    return n;
+}
+
 static off_t cip_seek(hFILE *fpv, off_t offset, int whence)
 {
+    // Ranges are fetched and decrypted by several threads, each starting
+    // from the counter for its own offset.  This needs positional reads of
+    // the encrypted data, so requests are declined (leaving callers to fall
+    // back to reading sequentially) if the inner stream can't provide them.
+    if (whence == HFILE_EXT_WHENCE) {
+        hFILE_cip *fp = (hFILE_cip *) fpv;
+        if (fp->rawfd < 0 && hfile_read_at(fp->rawfp, 0, NULL, 0) < 0) {
+            errno = ENOTSUP;
+            return -1;
+        }
+
+        hfile_ext_request *req = hfile_ext_accept(offset,
+            (1U << HFILE_EXT_READ_AT) | (1U << HFILE_EXT_READ_RANGES));
+        if (req == NULL) { errno = EINVAL; return -1; }
+        else if (req->op == HFILE_EXT_READ_AT)
+            return cip_read_at(fpv, req->offset, req->buffer, req->length);
+        else return hfile_ranges_read(req, cip_read_at, fpv, fp->nthreads,
+                                      64 * 1024);
+    }
+
+    HFILE_PROBE3(seek_entry, fpv, offset, whence);
+    HFILE_PROBE4(seek_return, fpv, offset, whence, -1);
     errno = ESPIPE;
     return -1;
 }
@@ -198,15 +350,14 @@ static int cip_close(hFILE *fpv)
     hFILE_cip *fp = (hFILE_cip *) fpv;
     int err = 0;
 
-#if defined HAVE_OPENSSL
-    EVP_CIPHER_CTX_free(fp->ctx);
-#elif defined HAVE_COMMONCRYPTO
-    CCStatus ret = CCCryptorRelease(fp->cryptor);
-    if (ret != kCCSuccess) err = cc_errno(ret, "CCCryptorRelease");
-#endif
+    HFILE_PROBE1(close_entry, fpv);
+    hfile_stats_close(&fp->stats, &cip_stats);
 
+    err = cipher_free(fp->ctx);
+    if (fp->rawfd >= 0 && close(fp->rawfd) < 0) err = errno;
     if (hclose(fp->rawfp) < 0) err = errno;
 
+    HFILE_PROBE2(close_return, fpv, err? -1 : 0);
     if (err) { errno = err; return -1; }
     else return 0;
 }
@@ -229,6 +380,8 @@ static hFILE *hopen_cip(const char *filename, const char *mode)
     hFILE_cip *fp = NULL;
     int save;
 
+    HFILE_PROBE2(open_entry, filename, mode);
+
     const char *key = getenv("HTS_CIP_KEY");
     if (key == NULL) { errno = EPERM; goto error; }
 
@@ -236,9 +389,13 @@ static hFILE *hopen_cip(const char *filename, const char *mode)
     if (fp == NULL) goto error;
 
     fp->rawfp = NULL;
+    fp->rawfd = -1;
     fp->buffer = NULL;
+    fp->ctx = NULL;
+    fp->nthreads = hfile_env_int("HTS_CIP_THREADS", 4, 1, 64);
 
-    fp->rawfp = hopen(strip_cip_scheme(filename), mode);
+    const char *rawname = strip_cip_scheme(filename);
+    fp->rawfp = hopen(rawname, mode);
     if (fp->rawfp == NULL) goto error;
 
     fp->bufsize = 8192 * BLOCKSIZE;
@@ -246,60 +403,56 @@ static hFILE *hopen_cip(const char *filename, const char *mode)
 
     int accmode = hfile_oflags(mode) & O_ACCMODE;
 
-    uint8_t iv[16];
+    uint8_t *iv = fp->iv;
     if (accmode == O_RDONLY) {
-        ssize_t n = hread(fp->rawfp, iv, sizeof iv);
+        ssize_t n = hread(fp->rawfp, iv, sizeof fp->iv);
         if (n < 0) goto error;
-        if (n < sizeof iv) { errno = EDOM; goto error; }
+        if (n < sizeof fp->iv) { errno = EDOM; goto error; }
+
+        // Positional reads of local files use a descriptor of their own.
+        const char *rawpath = hfile_view_local_path(rawname);
+        if (rawpath) fp->rawfd = open(rawpath, O_RDONLY);
     }
     else if (accmode == O_WRONLY) {
-        if (gen_random(iv, sizeof iv) < 0) goto error;
-        if (hwrite(fp->rawfp, iv, sizeof iv) != sizeof iv) goto error;
+        if (gen_random(iv, sizeof fp->iv) < 0) goto error;
+        if (hwrite(fp->rawfp, iv, sizeof fp->iv) != sizeof fp->iv) goto error;
     }
     else { errno = EINVAL; goto error; }
 
     static const uint8_t salt[] = { 244, 34, 1, 0, 158, 223, 78, 21 };
-    uint8_t secret[16];
+    uint8_t *secret = fp->secret;
 
 #if defined HAVE_OPENSSL
     if (! PKCS5_PBKDF2_HMAC(key, -1, salt, sizeof salt, 1024, EVP_sha1(),
-            sizeof secret, secret))
+            sizeof fp->secret, secret))
         { errno = ssl_errno("PKCS5_PBKDF2_HMAC"); goto error; }
 
-    fp->ctx = EVP_CIPHER_CTX_new();
-    if (fp->ctx == NULL)
-        { errno = ssl_errno("EVP_CIPHER_CTX_new"); goto error; }
-    if (! EVP_CipherInit_ex(fp->ctx, EVP_aes_128_ctr(), NULL, secret, iv,
-            (accmode == O_WRONLY)))
-        { errno = ssl_errno("EVP_CipherInit_ex"); goto error; }
-
 #elif defined HAVE_COMMONCRYPTO
     CCStatus ret;
     ret = CCKeyDerivationPBKDF(kCCPBKDF2, key, strlen(key), salt, sizeof salt,
-            kCCPRFHmacAlgSHA1, 1024, secret, sizeof secret);
+            kCCPRFHmacAlgSHA1, 1024, secret, sizeof fp->secret);
     if (ret != kCCSuccess)
         { errno = cc_errno(ret, "CCKeyDerivationPBKDF"); goto error; }
-
-    // Even though kCCModeOptionCTR_BE is deprecated, CCCryptorCreateWithMode()
-    // fails (returning kCCUnimplemented) if it is not specified.
-    CCOperation operation = (accmode == O_RDONLY)? kCCDecrypt : kCCEncrypt;
-    ret = CCCryptorCreateWithMode(operation, kCCModeCTR, kCCAlgorithmAES, 0,
-            iv, secret, sizeof secret, NULL, 0, 0, kCCModeOptionCTR_BE,
-            &fp->cryptor);
-    if (ret != kCCSuccess)
-        { errno = cc_errno(ret, "CCCryptorCreateWithMode"); goto error; }
 #endif
 
+    if (cipher_init(&fp->ctx, secret, iv, (accmode == O_WRONLY)) < 0)
+        goto error;
+
+    hfile_stats_open(&fp->stats, "cip", filename);
     fp->base.backend = &cip_backend;
+    HFILE_PROBE2(open_return, filename, fp);
     return &fp->base;
 
 error:
     save = errno;
     if (fp) {
+        if (fp->ctx) cipher_free(fp->ctx);
+        if (fp->rawfd >= 0) close(fp->rawfd);
         if (fp->rawfp) hclose_abruptly(fp->rawfp);
         free(fp->buffer);
         hfile_destroy((hFILE *) fp);
     }
+    HFILE_PROBE2(open_return, filename, NULL);
     errno = save;
     return NULL;
 }
@@ -309,12 +462,19 @@ static int cip_isremote(const char *filename)
     return hisremote(strip_cip_scheme(filename));
 }
 
+static void cip_exit(void)
+{
+    hfile_stats_exit(&cip_stats);
+}
+
 int hfile_plugin_init(struct hFILE_plugin *self)
 {
     static const struct hFILE_scheme_handler handler =
         { hopen_cip, cip_isremote, "cip", 50 };
 
     self->name = "cip";
+    self->destroy = cip_exit;
+    hfile_stats_setup();
     hfile_add_scheme_handler("cip", &handler);
     return 0;
 }
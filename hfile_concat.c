@@ -0,0 +1,492 @@
+/*  hfile_concat.c -- Multi-part objects presented as one stream.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_view.h"
+
+/* concat:PATTERN presents the parts PATTERN with "%d" (or e.g. "%03d")
+   replaced by 0, 1, 2, ... (or starting at 1 if there is no part 0) up to
+   the first that does not exist, as one read-only seekable stream, as does
+   concat:@LIST for the part URLs listed one per line in LIST.  */
+
+enum part_state { IDLE, OPENING, OPEN, FAILED };
+
+typedef struct {
+    char *url;
+    off_t start, size;
+
+    // The following are shared with the worker thread and protected by
+    // lock, except that once OPEN the reader alone uses fp, head, and rawpos.
+    enum part_state state;
+    hFILE *fp;
+    char *head;  // The first headlen bytes, read when opened in advance
+    size_t headlen;
+    off_t rawpos;
+} concat_part;
+
+typedef struct {
+    hFILE base;
+    concat_part *parts;
+    size_t nparts;
+    off_t pos, total;
+    size_t headsize;
+    unsigned ahead;
+
+    // The following are shared with the worker thread and protected by lock.
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t current;
+    int stop;
+} hFILE_concat;
+
+// Opens part P and reads its first bytes.  Called without fp->lock held.
+static int open_part(hFILE_concat *fp, concat_part *p, int readahead)
+{
+    p->fp = hopen(p->url, "r");
+    if (p->fp == NULL) return -1;
+    p->rawpos = 0;
+    p->headlen = 0;
+
+    if (readahead && fp->headsize > 0 && p->size > 0) {
+        size_t len = (p->size < (off_t) fp->headsize)? p->size : fp->headsize;
+        ssize_t n;
+        p->head = malloc(len);
+        if (p->head == NULL) goto error;
+        n = hread(p->fp, p->head, len);
+        if (n < 0) goto error;
+        p->headlen = p->rawpos = n;
+    }
+    return 0;
+
+error:
+    hclose_abruptly(p->fp);
+    p->fp = NULL;
+    free(p->head);
+    p->head = NULL;
+    return -1;
+}
+
+static void *worker(void *fpv)
+{
+    hFILE_concat *fp = (hFILE_concat *) fpv;
+
+    pthread_mutex_lock(&fp->lock);
+    while (! fp->stop) {
+        size_t k, last = fp->current + fp->ahead;
+        concat_part *p = NULL;
+        if (last >= fp->nparts) last = fp->nparts - 1;
+        for (k = fp->current + 1; k <= last; k++)
+            if (fp->parts[k].state == IDLE) { p = &fp->parts[k]; break; }
+
+        if (p == NULL) {
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        p->state = OPENING;
+        pthread_mutex_unlock(&fp->lock);
+
+        int ret = open_part(fp, p, 1);
+
+        pthread_mutex_lock(&fp->lock);
+        p->state = (ret == 0)? OPEN : FAILED;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+static int close_part(concat_part *p)
+{
+    int ret = hclose(p->fp);
+    p->fp = NULL;
+    free(p->head);
+    p->head = NULL;
+    return ret;
+}
+
+// Makes part K current, and closes finished parts and those opened in
+// advance that are no longer ahead.  Called with fp->lock held.
+static void move_to(hFILE_concat *fp, size_t k)
+{
+    size_t j;
+
+    fp->current = k;
+    pthread_cond_broadcast(&fp->cond);
+
+    for (j = 0; j < fp->nparts; j++) {
+        concat_part *p = &fp->parts[j];
+        if (p->state == FAILED && j != k) p->state = IDLE;
+        if (p->state == OPEN && (j < k || j > k + fp->ahead)) {
+            p->state = OPENING;  // Prevent the worker reopening it meanwhile
+            pthread_mutex_unlock(&fp->lock);
+            (void) close_part(p);
+            pthread_mutex_lock(&fp->lock);
+            p->state = IDLE;
+        }
+    }
+}
+
+static size_t find_part(hFILE_concat *fp, off_t pos)
+{
+    size_t lo = 0, hi = fp->nparts;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (fp->parts[mid].start <= pos) lo = mid; else hi = mid;
+    }
+    return lo;
+}
+
+static ssize_t concat_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_concat *fp = (hFILE_concat *) fpv;
+    size_t k;
+    concat_part *p;
+    off_t offset;
+    ssize_t n;
+
+    if (fp->pos >= fp->total) return 0;
+
+    k = find_part(fp, fp->pos);
+    p = &fp->parts[k];
+
+    pthread_mutex_lock(&fp->lock);
+    if (fp->current != k) move_to(fp, k);
+    while (p->state == OPENING) pthread_cond_wait(&fp->cond, &fp->lock);
+    int need_open = (p->state != OPEN);
+    if (need_open) p->state = OPENING;
+    pthread_mutex_unlock(&fp->lock);
+
+    if (need_open) {
+        // Not opened in advance (or that failed), so open it here.
+        int ret = open_part(fp, p, 0);
+        pthread_mutex_lock(&fp->lock);
+        p->state = (ret == 0)? OPEN : IDLE;
+        pthread_cond_broadcast(&fp->cond);
+        pthread_mutex_unlock(&fp->lock);
+        if (ret < 0) return -1;
+    }
+
+    offset = fp->pos - p->start;
+    if (nbytes > (size_t) (p->size - offset)) nbytes = p->size - offset;
+
+    if (offset < (off_t) p->headlen) {
+        if (nbytes > p->headlen - offset) nbytes = p->headlen - offset;
+        memcpy(buffer, p->head + offset, nbytes);
+        n = nbytes;
+    }
+    else {
+        if (p->rawpos != offset) {
+            if (hseek(p->fp, offset, SEEK_SET) < 0) return -1;
+            p->rawpos = offset;
+        }
+
+        n = hread(p->fp, buffer, nbytes);
+        if (n < 0) return -1;
+        else if (n == 0) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_concat] part \"%s\" is shorter "
+                        "than expected\n", p->url);
+            errno = EIO;
+            return -1;
+        }
+        p->rawpos += n;
+    }
+
+    fp->pos += n;
+    return n;
+}
+
+static off_t concat_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_concat *fp = (hFILE_concat *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->total; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > fp->total - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // concat_read() will switch parts as necessary.
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void destroy_parts(hFILE_concat *fp)
+{
+    size_t k;
+    for (k = 0; k < fp->nparts; k++) {
+        free(fp->parts[k].url);
+        free(fp->parts[k].head);
+    }
+    free(fp->parts);
+}
+
+static int concat_close(hFILE *fpv)
+{
+    hFILE_concat *fp = (hFILE_concat *) fpv;
+    int err = 0;
+    size_t k;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    pthread_join(fp->worker, NULL);
+
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+
+    for (k = 0; k < fp->nparts; k++)
+        if (fp->parts[k].fp && close_part(&fp->parts[k]) < 0) err = errno;
+    destroy_parts(fp);
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend concat_backend =
+{
+    concat_read, NULL, concat_seek, NULL, concat_close
+};
+
+static int add_part(hFILE_concat *fp, size_t *capacity, char *url)
+{
+    if (fp->nparts == *capacity) {
+        size_t n = *capacity? 2 * *capacity : 16;
+        concat_part *parts = realloc(fp->parts, n * sizeof (concat_part));
+        if (parts == NULL) { free(url); return -1; }
+        fp->parts = parts;
+        *capacity = n;
+    }
+
+    concat_part *p = &fp->parts[fp->nparts++];
+    memset(p, 0, sizeof (concat_part));
+    p->url = url;
+    p->state = IDLE;
+    return 0;
+}
+
+// Sets the part's size, or returns -1 (with errno ENOENT if it does not
+// exist).  Remote parts are opened to find their size.
+static int find_size(concat_part *p)
+{
+    const char *path = hfile_view_local_path(p->url);
+
+    if (path) {
+        struct stat st;
+        if (stat(path, &st) < 0) return -1;
+        p->size = st.st_size;
+    }
+    else {
+        hFILE *fp = hopen(p->url, "r");
+        if (fp == NULL) return -1;
+        p->size = hseek(fp, 0, SEEK_END);
+        if (p->size < 0) { hclose_abruptly(fp); return -1; }
+        if (hclose(fp) < 0) return -1;
+    }
+    return 0;
+}
+
+// Finds the part number conversion in PATTERN, returning its start and
+// setting *LENGTH and *WIDTH, or NULL if there is none.
+static const char *find_conversion(const char *pattern, size_t *length,
+                                   int *width)
+{
+    const char *s;
+    for (s = strchr(pattern, '%'); s; s = strchr(s + 1, '%')) {
+        char *end;
+        *width = strtol(s + 1, &end, 10);
+        if (*end == 'd' && s[1] != '-' && s[1] != '+' && s[1] != ' ') {
+            *length = end + 1 - s;
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static int expand_pattern(hFILE_concat *fp, const char *pattern)
+{
+    size_t capacity = 0, length;
+    int width, number, first;
+    const char *conv = find_conversion(pattern, &length, &width);
+
+    if (conv == NULL) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_concat] no part number (\"%%d\") in "
+                    "\"%s\"\n", pattern);
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (number = first = 0; ; number++) {
+        char *url = malloc(strlen(pattern) + width + 24);
+        if (url == NULL) return -1;
+        sprintf(url, "%.*s%0*d%s", (int) (conv - pattern), pattern,
+                width, number, conv + length);
+
+        if (add_part(fp, &capacity, url) < 0) return -1;
+        if (find_size(&fp->parts[fp->nparts - 1]) < 0) {
+            int save = errno;
+            free(fp->parts[--fp->nparts].url);
+            if (save != ENOENT) { errno = save; return -1; }
+
+            // Numbering may start from 1 instead of 0.
+            if (number == 0 && first == 0) { first = 1; continue; }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int read_list(hFILE_concat *fp, const char *listurl)
+{
+    hFILE *list = hopen(listurl, "r");
+    char line[8192];
+    size_t capacity = 0;
+    ssize_t n;
+
+    if (list == NULL) return -1;
+
+    while ((n = hgetln(line, sizeof line, list)) > 0) {
+        while (n > 0 && (line[n-1] == '\n' || line[n-1] == '\r')) line[--n] = '\0';
+        if (n == 0 || line[0] == '#') continue;
+
+        char *url = strdup(line);
+        if (url == NULL || add_part(fp, &capacity, url) < 0) goto error;
+        if (find_size(&fp->parts[fp->nparts - 1]) < 0) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_concat] can't open part \"%s\": "
+                        "%s\n", url, strerror(errno));
+            goto error;
+        }
+    }
+    if (n < 0) goto error;
+
+    return hclose(list);
+
+error:
+    hclose_abruptly(list);
+    return -1;
+}
+
+static const char *strip_concat_scheme(const char *filename)
+{
+    if (strncmp(filename, "concat:", 7) == 0) filename += 7;
+    return filename;
+}
+
+static hFILE *hopen_concat(const char *filename, const char *mode)
+{
+    hFILE_concat *fp = NULL;
+    const char *spec = strip_concat_scheme(filename);
+    size_t k;
+    int save, ret;
+
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_RDONLY) { errno = EINVAL; goto error; }
+
+    fp = (hFILE_concat *) hfile_init(sizeof (hFILE_concat), mode, 0);
+    if (fp == NULL) goto error;
+
+    fp->parts = NULL;
+    fp->nparts = 0;
+    ret = (spec[0] == '@')? read_list(fp, spec + 1) : expand_pattern(fp, spec);
+    if (ret < 0) goto error;
+
+    if (fp->nparts == 0) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_concat] no parts found for \"%s\"\n",
+                    spec);
+        errno = ENOENT;
+        goto error;
+    }
+
+    fp->total = 0;
+    for (k = 0; k < fp->nparts; k++) {
+        fp->parts[k].start = fp->total;
+        fp->total += fp->parts[k].size;
+    }
+
+    fp->ahead = hfile_env_int("HTS_CONCAT_AHEAD", 2, 0, 64);
+    fp->headsize = hfile_env_size("HTS_CONCAT_PREFETCH", 1048576);
+    fp->pos = 0;
+    fp->current = 0;
+    fp->stop = 0;
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+    ret = pthread_create(&fp->worker, NULL, worker, fp);
+    if (ret != 0) {
+        pthread_mutex_destroy(&fp->lock);
+        pthread_cond_destroy(&fp->cond);
+        errno = ret;
+        goto error;
+    }
+
+    fp->base.backend = &concat_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp) {
+        if (fp->parts) destroy_parts(fp);
+        hfile_destroy((hFILE *) fp);
+    }
+    errno = save;
+    return NULL;
+}
+
+static int concat_isremote(const char *filename)
+{
+    const char *spec = strip_concat_scheme(filename);
+    return hisremote((spec[0] == '@')? spec + 1 : spec);
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_concat, concat_isremote, "concat", 50 };
+
+    self->name = "concat";
+    hfile_add_scheme_handler("concat", &handler);
+    return 0;
+}
@@ -0,0 +1,534 @@
+/*  hfile_direct.c -- O_DIRECT local file backend for low-level file streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // for O_DIRECT
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_layout.h"
+
+// Buffer addresses, file offsets, and transfer sizes must all be multiples
+// of the device's logical block size, which is at most this on current systems.
+#define ALIGNMENT 4096
+
+// Upper limit on the number of buffers, each of which is several megabytes.
+#define MAX_BUFFERS 256
+
+typedef struct {
+    char *data;
+    off_t offset;
+    size_t length;
+    int ready, error;
+} direct_buffer;
+
+typedef struct {
+    hFILE base;
+    direct_buffer *bufs;
+    char *pool;
+    size_t bufsize, align;  // Read-ahead restarts at multiples of align
+    hfile_layout layout;
+    unsigned nbufs;
+    int fd, writing, direct;
+    off_t size;
+
+    // The front end's position (reading), or the file offset of the buffer
+    // being filled and the number of bytes in it so far (writing).
+    off_t pos;
+    size_t wlen;
+
+    // The following are shared with the worker thread and protected by lock.
+    // Buffers are used in rotation: the front end consumes (reading) or fills
+    // (writing) bufs[head], while the worker fills or writes out bufs[fill].
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned head, fill, generation;
+    off_t headoff, next;
+    int eof, stop, error;
+} hFILE_direct;
+
+static void *read_worker(void *fpv)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+
+    pthread_mutex_lock(&fp->lock);
+    while (! fp->stop) {
+        direct_buffer *b = &fp->bufs[fp->fill];
+        if (fp->eof || b->ready) {
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        off_t offset = fp->next;
+        unsigned generation = fp->generation;
+        pthread_mutex_unlock(&fp->lock);
+
+        // A short read need not mean end of file, so keep reading until the
+        // buffer is full or the end of the file has been reached.
+        size_t done = 0;
+        int err = 0, at_eof = 0;
+        while (done < fp->bufsize) {
+            ssize_t n = pread(fp->fd, b->data + done, fp->bufsize - done,
+                              offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            else if (n < 0) { err = errno; break; }
+            else if (n == 0) { at_eof = 1; break; }
+            done += n;
+            if (offset + (off_t) done >= fp->size) { at_eof = 1; break; }
+        }
+
+        pthread_mutex_lock(&fp->lock);
+        // Discard the data if the front end has seeked elsewhere meanwhile.
+        if (generation != fp->generation) continue;
+
+        b->offset = offset;
+        b->length = done;
+        b->error = err;
+        b->ready = 1;
+        fp->next += fp->bufsize;
+        fp->fill = (fp->fill + 1) % fp->nbufs;
+        if (at_eof || err) fp->eof = 1;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+static void *write_worker(void *fpv)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        direct_buffer *b = &fp->bufs[fp->fill];
+        if (! b->ready) {
+            if (fp->stop) break;
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&fp->lock);
+
+        size_t done = 0;
+        int err = 0;
+        while (done < b->length) {
+            ssize_t n = pwrite(fp->fd, b->data + done, b->length - done,
+                               b->offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            else if (n <= 0) { err = (n < 0)? errno : EIO; break; }
+            done += n;
+        }
+
+        pthread_mutex_lock(&fp->lock);
+        if (err && ! fp->error) fp->error = err;
+        b->ready = 0;
+        fp->fill = (fp->fill + 1) % fp->nbufs;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+// Discards all buffers and starts reading ahead from the aligned block
+// containing fp->pos.  Called with fp->lock held.
+static void restart(hFILE_direct *fp)
+{
+    unsigned i;
+    for (i = 0; i < fp->nbufs; i++) fp->bufs[i].ready = 0;
+    fp->head = fp->fill = 0;
+    fp->headoff = fp->next = fp->pos - fp->pos % fp->align;
+    fp->eof = 0;
+    fp->generation++;
+    pthread_cond_broadcast(&fp->cond);
+}
+
+static ssize_t direct_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+    direct_buffer *b;
+
+    if (fp->pos >= fp->size) return 0;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        b = &fp->bufs[fp->head];
+        if (fp->headoff < 0 || fp->pos < fp->headoff ||
+            fp->pos >= fp->headoff + (off_t) (fp->nbufs * fp->bufsize)) {
+            restart(fp);
+            continue;
+        }
+
+        // The head buffer will never be filled if the worker hit EOF first.
+        while (! b->ready && ! (fp->eof && fp->head == fp->fill))
+            pthread_cond_wait(&fp->cond, &fp->lock);
+        if (! b->ready) {
+            pthread_mutex_unlock(&fp->lock);
+            return 0;
+        }
+
+        if (b->error) {
+            errno = b->error;
+            fp->headoff = -1;  // Retry via restart() on the next read
+            pthread_mutex_unlock(&fp->lock);
+            return -1;
+        }
+
+        if (fp->pos < fp->headoff + (off_t) fp->bufsize) break;
+
+        // Skip over buffers that the front end has seeked past.
+        b->ready = 0;
+        fp->head = (fp->head + 1) % fp->nbufs;
+        fp->headoff += fp->bufsize;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    // The worker leaves ready buffers alone, so this can be done unlocked.
+    size_t skip = fp->pos - b->offset;
+    size_t avail = (b->length > skip)? b->length - skip : 0;
+    if (nbytes > avail) nbytes = avail;
+    memcpy(buffer, b->data + skip, nbytes);
+    fp->pos += nbytes;
+
+    if (fp->pos >= b->offset + (off_t) fp->bufsize) {
+        pthread_mutex_lock(&fp->lock);
+        b->ready = 0;
+        fp->head = (fp->head + 1) % fp->nbufs;
+        fp->headoff += fp->bufsize;
+        pthread_cond_broadcast(&fp->cond);
+        pthread_mutex_unlock(&fp->lock);
+    }
+
+    return nbytes;
+}
+
+// Waits until the worker has written out all full buffers.
+// Called with fp->lock held.
+static int wait_for_writes(hFILE_direct *fp)
+{
+    unsigned i;
+    for (i = 0; i < fp->nbufs; i++)
+        while (fp->bufs[i].ready) pthread_cond_wait(&fp->cond, &fp->lock);
+
+    if (fp->error) { errno = fp->error; return -1; }
+    return 0;
+}
+
+static ssize_t direct_write(hFILE *fpv, const void *bufferv, size_t nbytes)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+    const char *buffer = (const char *) bufferv;
+    size_t total = 0;
+
+    while (total < nbytes) {
+        direct_buffer *b = &fp->bufs[fp->head];
+        size_t n = fp->bufsize - fp->wlen;
+        if (n > nbytes - total) n = nbytes - total;
+        memcpy(b->data + fp->wlen, buffer + total, n);
+        fp->wlen += n;
+        total += n;
+
+        if (fp->wlen == fp->bufsize) {
+            // Hand this buffer to the worker and move on to the next one.
+            pthread_mutex_lock(&fp->lock);
+            b->offset = fp->pos;
+            b->length = fp->bufsize;
+            b->ready = 1;
+            fp->head = (fp->head + 1) % fp->nbufs;
+            pthread_cond_broadcast(&fp->cond);
+            while (fp->bufs[fp->head].ready)
+                pthread_cond_wait(&fp->cond, &fp->lock);
+            int err = fp->error;
+            pthread_mutex_unlock(&fp->lock);
+
+            fp->pos += fp->bufsize;
+            fp->wlen = 0;
+            if (err) { errno = err; return -1; }
+        }
+    }
+
+    return total;
+}
+
+// Writes the final partial buffer, whose length is not a multiple of the
+// alignment, by temporarily clearing O_DIRECT.  The data is retained, so
+// if more is written later the block will be rewritten in full.
+static int write_tail(hFILE_direct *fp)
+{
+    int flags = fcntl(fp->fd, F_GETFL);
+    if (flags < 0) return -1;
+    if (fp->direct && fcntl(fp->fd, F_SETFL, flags & ~O_DIRECT) < 0) return -1;
+
+    const char *data = fp->bufs[fp->head].data;
+    size_t done = 0;
+    int ret = 0;
+    while (done < fp->wlen) {
+        ssize_t n = pwrite(fp->fd, data + done, fp->wlen - done, fp->pos + done);
+        if (n < 0 && errno == EINTR) continue;
+        else if (n <= 0) { if (n == 0) errno = EIO; ret = -1; break; }
+        done += n;
+    }
+
+    int save = errno;
+    if (fp->direct && fcntl(fp->fd, F_SETFL, flags) < 0 && ret == 0) ret = -1;
+    else errno = save;
+    return ret;
+}
+
+static int direct_flush(hFILE *fpv)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+
+    pthread_mutex_lock(&fp->lock);
+    int ret = wait_for_writes(fp);
+    pthread_mutex_unlock(&fp->lock);
+    if (ret < 0) return -1;
+
+    return (fp->wlen > 0)? write_tail(fp) : 0;
+}
+
+static off_t direct_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos + fp->wlen; break;
+    case SEEK_END: origin = fp->size; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (fp->writing) {
+        // Output is streamed, so only the current position can be reported.
+        if (origin + offset == fp->pos + (off_t) fp->wlen)
+            return fp->pos + fp->wlen;
+        errno = ESPIPE;
+        return -1;
+    }
+
+    if (offset < -origin || offset > fp->size - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // direct_read() will discard or skip buffers as necessary.
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void destroy_buffers(hFILE_direct *fp)
+{
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    free(fp->bufs);
+    free(fp->pool);
+}
+
+static int stop_worker(hFILE_direct *fp)
+{
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    return pthread_join(fp->worker, NULL);
+}
+
+static int direct_close(hFILE *fpv)
+{
+    hFILE_direct *fp = (hFILE_direct *) fpv;
+    int err = 0;
+
+    if (fp->writing) {
+        pthread_mutex_lock(&fp->lock);
+        if (wait_for_writes(fp) < 0) err = errno;
+        pthread_mutex_unlock(&fp->lock);
+        if (fp->wlen > 0 && write_tail(fp) < 0 && ! err) err = errno;
+    }
+
+    (void) stop_worker(fp);
+    destroy_buffers(fp);
+    if (close(fp->fd) < 0 && ! err) err = errno;
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend direct_backend =
+{
+    direct_read, direct_write, direct_seek, direct_flush, direct_close
+};
+
+// Sets up the buffers, as configured by OPTIONS or the environment.
+static int init_buffers(hFILE_direct *fp, const char *options)
+{
+    unsigned i;
+
+    // For striped files, each buffer by default spans all the servers, and
+    // is a whole number of stripes so that transfers align with them.
+    size_t bufsize = hfile_layout_span(&fp->layout, 64 << 20);
+    if (bufsize < 4194304) bufsize = 4194304;
+
+    fp->nbufs = hfile_option_int(options, "buffers", "HTS_DIRECT_BUFFERS", 2,
+                                 2, MAX_BUFFERS);
+    fp->bufsize = hfile_option_size(options, "buffer_size",
+                                    "HTS_DIRECT_BUFFER_SIZE", bufsize);
+    if (fp->bufsize < ALIGNMENT) fp->bufsize = ALIGNMENT;
+    fp->bufsize = hfile_layout_align(&fp->layout, fp->bufsize);
+    fp->bufsize -= fp->bufsize % ALIGNMENT;
+    fp->align = (fp->layout.stripe_size > 0 &&
+                 fp->layout.stripe_size % ALIGNMENT == 0 &&
+                 fp->bufsize % fp->layout.stripe_size == 0)
+              ? fp->layout.stripe_size : ALIGNMENT;
+
+    fp->bufs = calloc(fp->nbufs, sizeof (direct_buffer));
+    if (posix_memalign((void **) &fp->pool, ALIGNMENT,
+                       fp->nbufs * fp->bufsize) != 0) fp->pool = NULL;
+    if (fp->bufs == NULL || fp->pool == NULL) {
+        free(fp->bufs);
+        free(fp->pool);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < fp->nbufs; i++)
+        fp->bufs[i].data = fp->pool + i * fp->bufsize;
+
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+    fp->head = fp->fill = fp->generation = 0;
+    fp->eof = fp->stop = fp->error = 0;
+    return 0;
+}
+
+static hFILE *hopen_direct(const char *url, const char *modestr)
+{
+    static const char *const option_names[] =
+        { "buffer_size", "buffers", NULL };
+    int mode = hfile_oflags(modestr);
+    struct stat st;
+    int fd = -1, have_buffers = 0;
+    hFILE_direct *fp = NULL;
+    const char *options;
+    char *filename = NULL;
+    int save, ret;
+
+    if (strncmp(url, "direct://localhost/", 19) == 0) url += 18;
+    else if (strncmp(url, "direct:///", 10) == 0) url += 9;
+    else if (strncmp(url, "direct:", 7) == 0) url += 7;
+
+    if ((mode & O_ACCMODE) == O_RDWR) { errno = EINVAL; goto error; }
+
+    options = url + hfile_options_start(url, option_names);
+    filename = strndup(url, options - url);
+    if (filename == NULL) goto error;
+
+    // Appending is done by explicit offset, so that the final partial block
+    // can be rewritten.  Since pwrite(2) on an O_APPEND descriptor ignores
+    // the offset on some platforms, that flag is not used; instead the file
+    // is opened read-write so the existing partial block can be reloaded.
+    int direct = 1;
+    int flags = mode & ~O_APPEND;
+    if (mode & O_APPEND) flags = (flags & ~O_ACCMODE) | O_RDWR;
+    fd = open(filename, flags | O_DIRECT, 0666);
+    if (fd < 0 && errno == EINVAL) {
+        // Some filesystems (e.g., older tmpfs) refuse O_DIRECT entirely.
+        if (hts_verbose >= 4)
+            fprintf(stderr, "[W::hfile_direct] O_DIRECT is not supported "
+                    "for \"%s\"; using buffered I/O\n", filename);
+        direct = 0;
+        fd = open(filename, flags, 0666);
+    }
+    if (fd < 0) goto error;
+    if (fstat(fd, &st) < 0) goto error;
+
+    fp = (hFILE_direct *) hfile_init(sizeof (hFILE_direct), modestr, 0);
+    if (fp == NULL) goto error;
+
+    fp->fd = fd;
+    fp->direct = direct;
+    fp->size = st.st_size;
+    fp->writing = ((mode & O_ACCMODE) == O_WRONLY);
+    fp->pos = 0;
+    fp->wlen = 0;
+    hfile_layout_get(fd, filename, &fp->layout);
+    if (init_buffers(fp, options) < 0) goto error;
+    have_buffers = 1;
+
+    if (fp->writing) {
+        if (mode & O_APPEND) {
+            // Start from the aligned block containing the end of the file,
+            // preloading its existing contents into the first buffer.
+            fp->pos = st.st_size - st.st_size % ALIGNMENT;
+            fp->wlen = st.st_size % ALIGNMENT;
+            if (fp->wlen > 0) {
+                ssize_t n = pread(fd, fp->bufs[0].data, ALIGNMENT, fp->pos);
+                if (n < 0) goto error;
+                if (n != (ssize_t) fp->wlen) { errno = EIO; goto error; }
+            }
+        }
+        ret = pthread_create(&fp->worker, NULL, write_worker, fp);
+    }
+    else {
+        // Leave the worker idle until the first read starts the read-ahead.
+        fp->headoff = -1;
+        fp->eof = 1;
+        ret = pthread_create(&fp->worker, NULL, read_worker, fp);
+    }
+    if (ret != 0) { errno = ret; goto error; }
+
+    free(filename);
+    fp->base.backend = &direct_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    free(filename);
+    if (have_buffers) destroy_buffers(fp);
+    if (fp) hfile_destroy((hFILE *) fp);
+    if (fd >= 0) (void) close(fd);
+    errno = save;
+    return NULL;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_direct, hfile_always_local, "direct", 10 };
+
+    self->name = "direct";
+    hfile_add_scheme_handler("direct", &handler);
+    return 0;
+}
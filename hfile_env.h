@@ -0,0 +1,234 @@
+/*  hfile_env.h -- environment variable parameters for plugins.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#ifndef HFILE_ENV_H
+#define HFILE_ENV_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+
+/* Parses a size such as "4096", "64k", "16M", or "2G" (suffixes denote
+   powers of 1024).  Returns 0 on success, or -1 if TEXT is not such a size. */
+static inline int hfile_parse_size(const char *text, size_t *size)
+{
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (end == text) return -1;
+
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    case 't': case 'T': n <<= 40; end++; break;
+    }
+    if (*end == 'i') end++;
+    if (*end == 'b' || *end == 'B') end++;
+    if (*end != '\0') return -1;
+
+    *size = n;
+    return 0;
+}
+
+/* Parses a plain decimal integer.  Returns 0 on success, or -1 if TEXT is
+   not such an integer or is out of range for a long.  */
+static inline int hfile_parse_int(const char *text, long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtol(text, &end, 10);
+    return (end == text || *end != '\0' || errno == ERANGE)? -1 : 0;
+}
+
+/* Parses a duration such as "250us", "5ms", or "1.5s" (a bare number is in
+   microseconds) into nanoseconds.  Returns 0 on success, or -1 if TEXT is
+   not such a duration. */
+static inline int hfile_parse_duration(const char *text, double *ns)
+{
+    char *end;
+    double t = strtod(text, &end);
+    if (end == text || t < 0) return -1;
+
+    if (strcmp(end, "ns") == 0) *ns = t;
+    else if (strcmp(end, "us") == 0 || *end == '\0') *ns = t * 1e3;
+    else if (strcmp(end, "ms") == 0) *ns = t * 1e6;
+    else if (strcmp(end, "s") == 0) *ns = t * 1e9;
+    else return -1;
+
+    return 0;
+}
+
+/* Returns the size given by environment variable NAME, or DEFAULT_SIZE if
+   it is unset or (with a warning) not a valid size.  */
+static inline size_t hfile_env_size(const char *name, size_t default_size)
+{
+    const char *text = getenv(name);
+    size_t size;
+
+    if (text == NULL || *text == '\0') return default_size;
+    if (hfile_parse_size(text, &size) < 0) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_env] ignoring invalid %s value \"%s\"\n",
+                    name, text);
+        return default_size;
+    }
+
+    return size;
+}
+
+/* Returns the integer given by environment variable NAME, or DEFAULT_VALUE
+   if it is unset or (with a warning) not an integer between MIN and MAX.  */
+static inline long hfile_env_int(const char *name, long default_value,
+                                 long min, long max)
+{
+    const char *text = getenv(name);
+    long value;
+
+    if (text == NULL || *text == '\0') return default_value;
+    if (hfile_parse_int(text, &value) < 0 || value < min || value > max) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_env] ignoring invalid %s value \"%s\" "
+                    "(must be between %ld and %ld)\n", name, text, min, max);
+        return default_value;
+    }
+
+    return value;
+}
+
+/* Returns the duration in nanoseconds given by environment variable NAME,
+   or DEFAULT_NS if it is unset or (with a warning) not a valid duration.  */
+static inline double hfile_env_duration(const char *name, double default_ns)
+{
+    const char *text = getenv(name);
+    double ns;
+
+    if (text == NULL || *text == '\0') return default_ns;
+    if (hfile_parse_duration(text, &ns) < 0) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_env] ignoring invalid %s value \"%s\"\n",
+                    name, text);
+        return default_ns;
+    }
+
+    return ns;
+}
+
+/* Some backends also accept their parameters as options appended to the
+   URL, as in "prefetch:URL#block_size=4M,depth=8", which take precedence
+   over the environment.  Returns the length of URL excluding any such
+   options: a final "#..." is taken to be options only if each of its
+   comma-separated items is NAME=VALUE with NAME in the NULL-terminated
+   list NAMES.  */
+static inline size_t hfile_options_start(const char *url,
+                                         const char *const *names)
+{
+    const char *hash = strrchr(url, '#'), *s;
+    size_t i, len;
+
+    if (hash == NULL || hash[1] == '\0') return strlen(url);
+
+    for (s = hash + 1; *s; s += strcspn(s, ","), s += (*s == ',')) {
+        len = strcspn(s, "=,");
+        if (s[len] != '=') return strlen(url);
+        for (i = 0; names[i]; i++)
+            if (strncmp(s, names[i], len) == 0 && names[i][len] == '\0')
+                break;
+        if (names[i] == NULL) return strlen(url);
+    }
+
+    return hash - url;
+}
+
+/* Copies the value of option NAME in OPTIONS (the part of a URL following
+   the length returned by hfile_options_start()) to TEXT, of SIZE bytes.
+   Returns 1 if it was found, 0 if absent, or -1 (with a warning) if it is
+   too long to be valid.  */
+static inline int hfile_option_text(const char *options, const char *name,
+                                    char *text, size_t size)
+{
+    size_t namelen = strlen(name);
+    const char *s;
+
+    if (*options == '#') options++;
+    for (s = options; *s; s += strcspn(s, ","), s += (*s == ',')) {
+        size_t len = strcspn(s, ",");
+        if (len <= namelen || strncmp(s, name, namelen) != 0 ||
+            s[namelen] != '=') continue;
+
+        len -= namelen + 1;
+        if (len >= size) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[W::hfile_env] ignoring invalid %s option "
+                        "value \"%.*s\"\n", name, (int) len, &s[namelen + 1]);
+            return -1;
+        }
+        memcpy(text, &s[namelen + 1], len);
+        text[len] = '\0';
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Returns the size given by option NAME in OPTIONS, if present and valid,
+   or otherwise as hfile_env_size(ENVNAME, DEFAULT_SIZE) does.  */
+static inline size_t hfile_option_size(const char *options, const char *name,
+                                       const char *envname, size_t default_size)
+{
+    char text[32];
+    size_t size;
+
+    if (hfile_option_text(options, name, text, sizeof text) > 0) {
+        if (hfile_parse_size(text, &size) == 0) return size;
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_env] ignoring invalid %s option "
+                    "value \"%s\"\n", name, text);
+    }
+
+    return hfile_env_size(envname, default_size);
+}
+
+/* Returns the integer given by option NAME in OPTIONS, if present and
+   between MIN and MAX, or otherwise as hfile_env_int() does.  */
+static inline long hfile_option_int(const char *options, const char *name,
+                                    const char *envname, long default_value,
+                                    long min, long max)
+{
+    char text[32];
+    long value;
+
+    if (hfile_option_text(options, name, text, sizeof text) > 0) {
+        if (hfile_parse_int(text, &value) == 0 &&
+            value >= min && value <= max) return value;
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_env] ignoring invalid %s option "
+                    "value \"%s\" (must be between %ld and %ld)\n",
+                    name, text, min, max);
+    }
+
+    return hfile_env_int(envname, default_value, min, max);
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*  hfile_ext.h -- Extension operations provided by some backends.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#ifndef HFILE_EXT_H
+#define HFILE_EXT_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "htslib/hfile.h"
+
+/* Operations beyond those of struct hFILE_backend are requested by calling
+   the backend's seek method with WHENCE set to HFILE_EXT_WHENCE and OFFSET
+   holding a pointer to an hfile_ext_request.  Backends that do not provide
+   them reject this WHENCE as they do any other they don't recognise, so the
+   request remains unhandled and callers see ENOTSUP.  They bypass the hFILE
+   buffer and the backend's own stream position, so need no locking.  */
+#define HFILE_EXT_WHENCE 0x68657874
+
+enum hfile_ext_op {
+    HFILE_EXT_READ_AT = 1,
+    HFILE_EXT_READ_RANGES = 2
+};
+
+/* One of several ranges to be read by hfile_read_ranges().  The caller
+   fills in OFFSET, LENGTH, and BUFFER; RESULT is set to the number of bytes
+   read (less than LENGTH only at end of file) or -1, in which case ERROR
+   holds the errno value.  */
+typedef struct hfile_range {
+    off_t offset;
+    size_t length;
+    void *buffer;
+    ssize_t result;
+    int error;
+} hfile_range;
+
+typedef void hfile_range_done(hfile_range *range, void *data);
+
+typedef struct hfile_ext_request {
+    int op;        // One of enum hfile_ext_op
+    int handled;   // Set by backends that recognise OP
+
+    // For HFILE_EXT_READ_AT
+    off_t offset;
+    void *buffer;
+    size_t length;
+
+    // For HFILE_EXT_READ_RANGES
+    hfile_range *ranges;
+    size_t nranges;
+    hfile_range_done *done;
+    void *data;
+} hfile_ext_request;
+
+// The leading members of struct hFILE_backend (see hfile_internal.h).
+struct hfile_ext_backend {
+    ssize_t (*read)(hFILE *fp, void *buffer, size_t nbytes);
+    ssize_t (*write)(hFILE *fp, const void *buffer, size_t nbytes);
+    off_t (*seek)(hFILE *fp, off_t offset, int whence);
+};
+
+/* Passes REQ to FP's backend.  Returns the backend's result, or -1 with
+   errno set to ENOTSUP if the backend does not provide the operation.  */
+static inline off_t hfile_ext_call(hFILE *fp, hfile_ext_request *req)
+{
+    const struct hfile_ext_backend *backend =
+        (const struct hfile_ext_backend *) fp->backend;
+    off_t ret;
+
+    req->handled = 0;
+    ret = backend->seek(fp, (off_t) (intptr_t) req, HFILE_EXT_WHENCE);
+    if (ret < 0 && ! req->handled) errno = ENOTSUP;
+    return ret;
+}
+
+/* Reads up to LENGTH bytes at OFFSET within FP into BUFFER, without using
+   or changing FP's current position, like pread(2).  Any number of threads
+   may call this concurrently on the same hFILE, as long as none of them is
+   using FP's ordinary read, write, or seek functions at the same time.
+   Returns the number of bytes read, which is less than LENGTH only at end
+   of file, or -1 on error.  Fails with ENOTSUP if FP's backend does not
+   provide positional reads; a zero-length call checks for this cheaply.  */
+static inline ssize_t
+hfile_read_at(hFILE *fp, off_t offset, void *buffer, size_t length)
+{
+    hfile_ext_request req = { HFILE_EXT_READ_AT, 0, offset, buffer, length,
+                              NULL, 0, NULL, NULL };
+    if (offset < 0) { errno = EINVAL; return -1; }
+    return hfile_ext_call(fp, &req);
+}
+
+/* Reads each of the NRANGES RANGES, for example the chunks produced by an
+   index query.  Backends that provide this merge ranges lying close
+   together into single requests and issue them concurrently, and calls
+   DONE (if non-NULL) with DATA for each range as soon as it has been read,
+   so ranges may complete in any order and DONE may be called from other
+   threads, though never concurrently with itself.  For other streams, the
+   ranges are read in turn with hfile_read_at() if available, or otherwise
+   with hseek() and hread(), which leave FP's position changed.  Returns 0
+   if every range was read successfully, or -1 if any failed.  */
+static inline int
+hfile_read_ranges(hFILE *fp, hfile_range *ranges, size_t nranges,
+                  hfile_range_done *done, void *data)
+{
+    hfile_ext_request req = { HFILE_EXT_READ_RANGES, 0, 0, NULL, 0,
+                              ranges, nranges, done, data };
+    int use_read_at, err = 0;
+    size_t i;
+
+    if (hfile_ext_call(fp, &req) >= 0) return 0;
+    else if (req.handled) return -1;
+
+    use_read_at = (hfile_read_at(fp, 0, NULL, 0) == 0);
+    for (i = 0; i < nranges; i++) {
+        hfile_range *r = &ranges[i];
+        if (use_read_at)
+            r->result = hfile_read_at(fp, r->offset, r->buffer, r->length);
+        else if (hseek(fp, r->offset, SEEK_SET) < 0) r->result = -1;
+        else r->result = hread(fp, r->buffer, r->length);
+        r->error = (r->result < 0)? errno : 0;
+        if (r->error && ! err) err = r->error;
+        if (done) done(r, data);
+    }
+
+    if (err) { errno = err; return -1; }
+    return 0;
+}
+
+/* For backends: returns the request passed as OFFSET, and marks it handled
+   if its operation is one of those in the bitmask OPS, e.g.,
+   (1 << HFILE_EXT_READ_AT).  Backends providing HFILE_EXT_READ_RANGES
+   usually do so with hfile_ranges_read() (see hfile_ranges.h).  Returns NULL if the operation is not among
+   OPS, in which case the backend should fail with EINVAL.  */
+static inline hfile_ext_request *hfile_ext_accept(off_t offset, unsigned ops)
+{
+    hfile_ext_request *req = (hfile_ext_request *) (intptr_t) offset;
+    if (! (req->op > 0 && req->op < 32 && (ops & (1U << req->op))))
+        return NULL;
+    req->handled = 1;
+    return req;
+}
+
+#endif
@@ -22,12 +22,18 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
 FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.  */
 
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
 #include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_ext.h"
+#include "hfile_probes.h"
+#include "hfile_ranges.h"
+#include "hfile_stats.h"
 #include "htslib/hts.h"  // for hts_verbose
 #include "htslib/kstring.h"
 
@@ -63,11 +69,27 @@ static void init_client_api_table() { }
 #endif
 
 
+// A further connection with its own descriptor for the data object,
+// used for positional reads.
+typedef struct irods_pooled {
+    struct irods_pooled *next;
+    rcComm_t *conn;
+    int descriptor;
+} irods_pooled;
+
 typedef struct {
     hFILE base;
     int descriptor;
+    hfile_stats stats;
+    char *path;
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    irods_pooled *idle;     // Pooled connections not currently in use
+    unsigned nconns, max_conns;
 } hFILE_irods;
 
+static hfile_stats irods_stats = { "irods" };
+
 static int status_errno(int status)
 {
     switch (status) {
@@ -109,11 +131,41 @@ static void irods_exit()
     irods.conn = NULL;
 }
 
-static int irods_init()
+static rcComm_t *irods_connect(int *status)
 {
     struct sigaction pipehandler;
     rErrMsg_t err;
-    int ret, pipehandler_ret;
+    rcComm_t *conn;
+    int pipehandler_ret;
+
+    // Prior to iRODS 4.1, rcConnect() (even if it fails) installs its own
+    // SIGPIPE handler, which just prints a message and otherwise ignores the
+    // signal.  Most actual SIGPIPEs encountered will pertain to e.g. stdout
+    // rather than iRODS's connection, so we save and restore the existing
+    // state (by default, termination; or as already set by our caller).
+    pipehandler_ret = sigaction(SIGPIPE, NULL, &pipehandler);
+
+    conn = rcConnect(irods.env.rodsHost, irods.env.rodsPort,
+                     irods.env.rodsUserName, irods.env.rodsZone,
+                     NO_RECONN, &err);
+    if (pipehandler_ret == 0) sigaction(SIGPIPE, &pipehandler, NULL);
+    if (conn == NULL) { *status = err.status; return NULL; }
+
+    if (strcmp(irods.env.rodsUserName, PUBLIC_USER_NAME) != 0) {
+        int ret = clientLogin(conn, NULL, NULL);
+        if (ret != 0) {
+            (void) rcDisconnect(conn);
+            *status = ret;
+            return NULL;
+        }
+    }
+
+    return conn;
+}
+
+static int irods_init()
+{
+    int ret;
 
     if (hts_verbose >= 5) {
         fputs("[M::hfile_irods.init] version " PLUGINS_VERSION
@@ -128,19 +180,9 @@ static int irods_init()
     // Set iRODS User-Agent, if our caller hasn't already done so.
     (void) setenv(SP_OPTION, "htslib-irods/" PLUGINS_VERSION, 0);
 
-    // Prior to iRODS 4.1, rcConnect() (even if it fails) installs its own
-    // SIGPIPE handler, which just prints a message and otherwise ignores the
-    // signal.  Most actual SIGPIPEs encountered will pertain to e.g. stdout
-    // rather than iRODS's connection, so we save and restore the existing
-    // state (by default, termination; or as already set by our caller).
-    pipehandler_ret = sigaction(SIGPIPE, NULL, &pipehandler);
-
     init_client_api_table();
-    irods.conn = rcConnect(irods.env.rodsHost, irods.env.rodsPort,
-                           irods.env.rodsUserName, irods.env.rodsZone,
-                           NO_RECONN, &err);
-    if (pipehandler_ret == 0) sigaction(SIGPIPE, &pipehandler, NULL);
-    if (irods.conn == NULL) { ret = err.status; goto error; }
+    irods.conn = irods_connect(&ret);
+    if (irods.conn == NULL) goto error;
 
     if (hts_verbose >= 5) {
         fprintf(stderr, "[M::hfile_irods.init] connected to %s(%s)",
@@ -153,11 +195,6 @@ static int irods_init()
             fprintf(stderr, "\n");
     }
 
-    if (strcmp(irods.env.rodsUserName, PUBLIC_USER_NAME) != 0) {
-        ret = clientLogin(irods.conn, NULL, NULL);
-        if (ret != 0) goto error;
-    }
-
     // Register irods_exit() here rather than via hFILE_plugin::destroy
     // so that it is invoked while iRODS is still up, i.e., before any
     // atexit()-functions or C++ static object destructors invoked due
@@ -173,15 +210,14 @@ error:
     return -1;
 }
 
-static ssize_t irods_read(hFILE *fpv, void *buffer, size_t nbytes)
+static int
+read_descriptor(rcComm_t *conn, int descriptor, void *buffer, size_t nbytes)
 {
-    hFILE_irods *fp = (hFILE_irods *) fpv;
     openedDataObjInp_t args;
     bytesBuf_t buf;
-    int ret;
 
     memset(&args, 0, sizeof args);
-    args.l1descInx = fp->descriptor;
+    args.l1descInx = descriptor;
     args.len = nbytes;
 
 #if IRODS_VERSION_INTEGER >= 4001000
@@ -193,7 +229,19 @@ static ssize_t irods_read(hFILE *fpv, void *buffer, size_t nbytes)
     buf.buf = buffer;
     buf.len = nbytes;
 
-    ret = rcDataObjRead(irods.conn, &args, &buf);
+    return rcDataObjRead(conn, &args, &buf);
+}
+
+static ssize_t irods_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_irods *fp = (hFILE_irods *) fpv;
+    int ret;
+
+    HFILE_PROBE3(read_entry, fpv, fpv->offset, nbytes);
+    uint64_t start = hfile_stats_start();
+    ret = read_descriptor(irods.conn, fp->descriptor, buffer, nbytes);
+    hfile_stats_end(&fp->stats, HFILE_STATS_READ, start, ret);
+    HFILE_PROBE4(read_return, fpv, fpv->offset, nbytes, ret);
     if (ret < 0) set_errno(ret);
     return ret;
 }
@@ -212,11 +260,143 @@ static ssize_t irods_write(hFILE *fpv, const void *buffer, size_t nbytes)
     buf.buf = (void *) buffer; // ...the iRODS API is not const-correct here
     buf.len = nbytes;
 
+    HFILE_PROBE3(write_entry, fpv, fpv->offset, nbytes);
+    uint64_t start = hfile_stats_start();
     ret = rcDataObjWrite(irods.conn, &args, &buf);
+    hfile_stats_end(&fp->stats, HFILE_STATS_WRITE, start, ret);
+    HFILE_PROBE4(write_return, fpv, fpv->offset, nbytes, ret);
     if (ret < 0) set_errno(ret);
     return ret;
 }
 
+static int open_object(rcComm_t *conn, const char *path, int flags)
+{
+    dataObjInp_t args;
+
+    memset(&args, 0, sizeof args);
+    strcpy(args.objPath, path);
+    args.openFlags = flags;
+    args.oprType = (args.openFlags & O_RDONLY)? GET_OPR : PUT_OPR;
+    if (args.openFlags & O_CREAT) {
+        args.createMode = 0666;
+        addKeyVal(&args.condInput, DEST_RESC_NAME_KW,irods.env.rodsDefResource);
+    }
+
+    return rcDataObjOpen(conn, &args);
+}
+
+static void close_pooled(irods_pooled *p)
+{
+    openedDataObjInp_t args;
+
+    memset(&args, 0, sizeof args);
+    args.l1descInx = p->descriptor;
+    (void) rcDataObjClose(p->conn, &args);
+    (void) rcDisconnect(p->conn);
+    free(p);
+}
+
+// Returns an idle pooled connection, making a new one if there are fewer
+// than max_conns or otherwise waiting until another thread releases one.
+static irods_pooled *acquire_pooled(hFILE_irods *fp)
+{
+    irods_pooled *p;
+    int ret = SYS_MALLOC_ERR;
+
+    pthread_mutex_lock(&fp->lock);
+    while (fp->idle == NULL && fp->nconns >= fp->max_conns)
+        pthread_cond_wait(&fp->available, &fp->lock);
+    p = fp->idle;
+    if (p) fp->idle = p->next;
+    else fp->nconns++;
+    pthread_mutex_unlock(&fp->lock);
+    if (p) return p;
+
+    p = malloc(sizeof (irods_pooled));
+    if (p == NULL) goto error;
+
+    p->conn = irods_connect(&ret);
+    if (p->conn == NULL) goto error;
+
+    ret = open_object(p->conn, fp->path, O_RDONLY);
+    if (ret < 0) { (void) rcDisconnect(p->conn); goto error; }
+    p->descriptor = ret;
+    return p;
+
+error:
+    free(p);
+    pthread_mutex_lock(&fp->lock);
+    fp->nconns--;
+    pthread_cond_signal(&fp->available);
+    pthread_mutex_unlock(&fp->lock);
+    set_errno(ret);
+    return NULL;
+}
+
+static void release_pooled(hFILE_irods *fp, irods_pooled *p)
+{
+    pthread_mutex_lock(&fp->lock);
+    p->next = fp->idle;
+    fp->idle = p;
+    pthread_cond_signal(&fp->available);
+    pthread_mutex_unlock(&fp->lock);
+}
+
+// Each positional read borrows a pooled connection, whose descriptor has its
+// own offset, so concurrent reads neither share a cursor with the stream
+// nor serialise on the main connection.
+static ssize_t
+irods_read_at(void *fpv, off_t offset, void *bufferv, size_t nbytes)
+{
+    hFILE_irods *fp = (hFILE_irods *) fpv;
+    HFILE_PROBE3(read_entry, fpv, offset, nbytes);
+    uint64_t start = hfile_stats_start();
+    char *buffer = (char *) bufferv;
+    ssize_t total = -1;
+    irods_pooled *p = NULL;
+    openedDataObjInp_t args;
+    fileLseekOut_t *out = NULL;
+    int ret;
+
+    if (fp->base.readonly == 0) { errno = EBADF; goto done; }
+
+    p = acquire_pooled(fp);
+    if (p == NULL) goto done;
+
+    memset(&args, 0, sizeof args);
+    args.l1descInx = p->descriptor;
+    args.offset = offset;
+    args.whence = SEEK_SET;
+    ret = rcDataObjLseek(p->conn, &args, &out);
+    free(out);
+    if (ret < 0) { set_errno(ret); goto done; }
+
+    total = 0;
+    while (total < nbytes) {
+        size_t remaining = nbytes - total;
+        if (remaining >= 2) {
+            ret = read_descriptor(p->conn, p->descriptor, &buffer[total],
+                                  remaining);
+        }
+        else {
+            // See the iRODS bug in read_descriptor(): allow for the extra byte
+            char last[2];
+            ret = read_descriptor(p->conn, p->descriptor, last, sizeof last);
+            if (ret > 0) buffer[total] = last[0];
+        }
+
+        if (ret < 0) { set_errno(ret); total = -1; break; }
+        else if (ret == 0) break;
+        total += ret;
+    }
+
+done:
+    if (p) release_pooled(fp, p);
+    hfile_stats_end(&fp->stats, HFILE_STATS_READ, start, total);
+    HFILE_PROBE4(read_return, fpv, offset, nbytes, total);
+    return total;
+}
+
 static off_t irods_seek(hFILE *fpv, off_t offset, int whence)
 {
     hFILE_irods *fp = (hFILE_irods *) fpv;
@@ -224,17 +404,34 @@ static off_t irods_seek(hFILE *fpv, off_t offset, int whence)
     fileLseekOut_t *out = NULL;
     int ret;
 
+    // Ranges are fetched by parallel requests, one per pooled connection.
+    // Round trips are costly, so ranges up to 256KiB apart are merged.
+    if (whence == HFILE_EXT_WHENCE) {
+        hfile_ext_request *req = hfile_ext_accept(offset,
+            (1U << HFILE_EXT_READ_AT) | (1U << HFILE_EXT_READ_RANGES));
+        if (req == NULL) { errno = EINVAL; return -1; }
+        else if (req->op == HFILE_EXT_READ_AT)
+            return irods_read_at(fp, req->offset, req->buffer, req->length);
+        else return hfile_ranges_read(req, irods_read_at, fp,
+                                      fp->max_conns, 256 * 1024);
+    }
+
     memset(&args, 0, sizeof args);
     args.l1descInx = fp->descriptor;
     args.offset = offset;
     args.whence = whence;
 
+    HFILE_PROBE3(seek_entry, fpv, offset, whence);
+    uint64_t start = hfile_stats_start();
     ret = rcDataObjLseek(irods.conn, &args, &out);
+    hfile_stats_end(&fp->stats, HFILE_STATS_SEEK, start, ret);
 
-    if (out) { offset = out->offset; free(out); }
-    else offset = -1;
+    off_t pos = -1;
+    if (out) { pos = out->offset; free(out); }
+    if (ret < 0) pos = -1;
+    HFILE_PROBE4(seek_return, fpv, offset, whence, pos);
     if (ret < 0) { set_errno(ret); return -1; }
-    return offset;
+    return pos;
 }
 
 static int irods_close(hFILE *fpv)
@@ -243,10 +440,24 @@ static int irods_close(hFILE *fpv)
     openedDataObjInp_t args;
     int ret;
 
+    HFILE_PROBE1(close_entry, fpv);
+    hfile_stats_close(&fp->stats, &irods_stats);
+
     memset(&args, 0, sizeof args);
     args.l1descInx = fp->descriptor;
 
     ret = rcDataObjClose(irods.conn, &args);
+
+    while (fp->idle) {
+        irods_pooled *p = fp->idle;
+        fp->idle = p->next;
+        close_pooled(p);
+    }
+    pthread_cond_destroy(&fp->available);
+    pthread_mutex_destroy(&fp->lock);
+    free(fp->path);
+
+    HFILE_PROBE2(close_return, fpv, ret);
     if (ret < 0) set_errno(ret);
     return ret;
 }
@@ -256,11 +467,10 @@ static const struct hFILE_backend irods_backend =
     irods_read, irods_write, irods_seek, NULL, irods_close
 };
 
-static hFILE *hopen_irods(const char *filename, const char *mode)
+static hFILE *open_data_object(const char *filename, const char *mode)
 {
     hFILE_irods *fp;
     rodsPath_t path;
-    dataObjInp_t args;
     int ret;
 
     // Initialise the iRODS connection if this is the first use.
@@ -278,37 +488,57 @@ static hFILE *hopen_irods(const char *filename, const char *mode)
     strncpy(path.inPath, filename, MAX_NAME_LEN-1);
     path.inPath[MAX_NAME_LEN-1] = '\0';
 
+    fp->path = NULL;
+
     ret = parseRodsPath(&path, &irods.env);
     if (ret < 0) goto error;
 
-    memset(&args, 0, sizeof args);
-    strcpy(args.objPath, path.outPath);
-    args.openFlags = hfile_oflags(mode);
-    args.oprType = (args.openFlags & O_RDONLY)? GET_OPR : PUT_OPR;
-    if (args.openFlags & O_CREAT) {
-        args.createMode = 0666;
-        addKeyVal(&args.condInput, DEST_RESC_NAME_KW,irods.env.rodsDefResource);
-    }
+    fp->path = strdup(path.outPath);
+    if (fp->path == NULL) { ret = SYS_MALLOC_ERR; goto error; }
 
-    ret = rcDataObjOpen(irods.conn, &args);
+    ret = open_object(irods.conn, fp->path, hfile_oflags(mode));
     if (ret < 0) goto error;
     fp->descriptor = ret;
 
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->available, NULL);
+    fp->idle = NULL;
+    fp->nconns = 0;
+    fp->max_conns = hfile_env_int("HTS_IRODS_CONNECTIONS", 4, 1, 64);
+
+    hfile_stats_open(&fp->stats, "irods", path.outPath);
     fp->base.backend = &irods_backend;
     return &fp->base;
 
 error:
+    free(fp->path);
     hfile_destroy((hFILE *) fp);
     set_errno(ret);
     return NULL;
 }
 
+static hFILE *hopen_irods(const char *filename, const char *mode)
+{
+    hFILE *fp;
+    HFILE_PROBE2(open_entry, filename, mode);
+    fp = open_data_object(filename, mode);
+    HFILE_PROBE2(open_return, filename, fp);
+    return fp;
+}
+
+static void irods_stats_exit(void)
+{
+    hfile_stats_exit(&irods_stats);
+}
+
 int hfile_plugin_init(struct hFILE_plugin *self)
 {
     static const struct hFILE_scheme_handler handler =
         { hopen_irods, hfile_always_remote, "iRODS", PRIORITY };
 
     self->name = "iRODS";
+    self->destroy = irods_stats_exit;
+    hfile_stats_setup();
     hfile_add_scheme_handler("irods", &handler);
     // At present RODS_REL_VERSION looks like "rodsX.Y[.Z]".
     hfile_add_scheme_handler("i"RODS_REL_VERSION, &handler);
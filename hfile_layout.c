@@ -0,0 +1,304 @@
+/*  hfile_layout.c -- Parallel filesystem stripe layouts.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#include <sys/xattr.h>
+#endif
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_env.h"
+#include "hfile_layout.h"
+
+// Limits the number of threads used by hfile_layout_pread().
+#define MAX_THREADS 16
+
+// Servers assumed when striping is evident but their number is not.
+#define DEFAULT_COUNT 4
+
+// Upper limit on $HTS_LAYOUT_STRIPE_COUNT, as for Lustre's stripe count.
+#define MAX_COUNT 2000
+
+#define GPFS_MAGIC 0x47504653
+
+#ifdef __linux__
+// Layout xattr formats, from <lustre/lustre_user.h>, which is not needed
+// for this as the fields used are at fixed offsets in little-endian order.
+#define LOV_MAGIC_V1      0x0BD10BD0
+#define LOV_MAGIC_V3      0x0BD30BD0
+#define LOV_MAGIC_COMP_V1 0x0BD60BD0
+#define LCME_FL_INIT      0x00000010
+
+static uint32_t le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t le64(const unsigned char *p)
+{
+    return le32(p) | ((uint64_t) le32(p + 4) << 32);
+}
+
+// Parses a plain lov_user_md (v1 or v3) of LEN bytes.
+static int lustre_plain(const unsigned char *md, size_t len, hfile_layout *l)
+{
+    if (len < 32) return 0;
+    uint32_t magic = le32(md);
+    if (magic != LOV_MAGIC_V1 && magic != LOV_MAGIC_V3) return 0;
+
+    l->stripe_size = le32(&md[24]);
+    l->stripe_count = md[28] | (md[29] << 8);
+    if (l->stripe_count == 0xffff) l->stripe_count = DEFAULT_COUNT;
+    return l->stripe_size > 0;
+}
+
+// For composite (progressive file layout) files, uses the last instantiated
+// component that the file reaches into, where most of a large file lies.
+static int lustre_layout(int fd, off_t size, hfile_layout *l)
+{
+    ssize_t len = fgetxattr(fd, "lustre.lov", NULL, 0);
+    unsigned char *md;
+    unsigned i, n;
+    int found = 0;
+
+    if (len < 32 || (md = malloc(len)) == NULL) return 0;
+    len = fgetxattr(fd, "lustre.lov", md, len);
+    if (len < 32) { free(md); return 0; }
+    if (le32(md) != LOV_MAGIC_COMP_V1) {
+        found = lustre_plain(md, len, l);
+        free(md);
+        return found;
+    }
+
+    n = md[14] | (md[15] << 8);
+    for (i = 0; i < n && 32 + (i+1) * 48 <= (size_t) len; i++) {
+        const unsigned char *e = &md[32 + i * 48];
+        uint64_t start = le64(&e[8]);
+        uint32_t offset = le32(&e[24]), esize = le32(&e[28]);
+        if (! (le32(&e[4]) & LCME_FL_INIT)) continue;
+        if (start > 0 && start >= (uint64_t) size) continue;
+        if ((size_t) offset + esize > (size_t) len) continue;
+        if (lustre_plain(&md[offset], esize, l)) found = 1;
+    }
+
+    free(md);
+    return found;
+}
+
+// Reads a CephFS virtual xattr holding a decimal number.
+static size_t ceph_attr(int fd, const char *name)
+{
+    char text[32];
+    ssize_t len = fgetxattr(fd, name, text, sizeof text - 1);
+    if (len <= 0) return 0;
+    text[len] = '\0';
+    return strtoull(text, NULL, 10);
+}
+
+// Consecutive objects are on different servers even with a stripe count
+// of 1, in which case the object size is the effective stripe size.
+static int ceph_layout(int fd, hfile_layout *l)
+{
+    size_t unit = ceph_attr(fd, "ceph.file.layout.stripe_unit");
+    size_t count = ceph_attr(fd, "ceph.file.layout.stripe_count");
+    size_t object = ceph_attr(fd, "ceph.file.layout.object_size");
+
+    if (unit == 0) return 0;
+    if (count > 1) {
+        l->stripe_size = unit;
+        l->stripe_count = count;
+    }
+    else {
+        l->stripe_size = (object > 0)? object : unit;
+        l->stripe_count = DEFAULT_COUNT;
+    }
+    return 1;
+}
+#endif
+
+int hfile_layout_get(int fd, const char *filename, hfile_layout *layout)
+{
+    struct stat st;
+    const char *source = "environment";
+
+    layout->stripe_size = 0;
+    layout->stripe_count = 1;
+    if (fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode)) return 0;
+
+#ifdef __linux__
+    struct statfs sfs;
+    if (lustre_layout(fd, st.st_size, layout)) source = "lustre";
+    else if (ceph_layout(fd, layout)) source = "cephfs";
+    else if (fstatfs(fd, &sfs) == 0 &&
+             (unsigned long) sfs.f_type == GPFS_MAGIC) {
+        // GPFS stripes each file across all its disks in units of the
+        // filesystem block size, which it reports as the I/O block size.
+        layout->stripe_size = st.st_blksize;
+        layout->stripe_count = DEFAULT_COUNT;
+        source = "gpfs";
+    }
+#endif
+
+    // The environment may override the detected layout, or supply one.
+    if (layout->stripe_size == 0) layout->stripe_count = DEFAULT_COUNT;
+    layout->stripe_size =
+        hfile_env_size("HTS_LAYOUT_STRIPE_SIZE", layout->stripe_size);
+    layout->stripe_count = hfile_env_int("HTS_LAYOUT_STRIPE_COUNT",
+                                         layout->stripe_count, 0, MAX_COUNT);
+
+    if (layout->stripe_size == 0 || layout->stripe_count <= 1) {
+        layout->stripe_size = 0;
+        layout->stripe_count = 1;
+        return 0;
+    }
+
+    if (hts_verbose >= 5)
+        fprintf(stderr, "[M::hfile_layout] \"%s\" (%s): %u stripes of %zu "
+                "bytes\n", filename, source, layout->stripe_count,
+                layout->stripe_size);
+    return 1;
+}
+
+size_t hfile_layout_align(const hfile_layout *layout, size_t size)
+{
+    size_t stripe = layout->stripe_size;
+    if (stripe == 0) return size;
+    if (size < stripe) return stripe;
+    return (size + stripe - 1) / stripe * stripe;
+}
+
+size_t hfile_layout_span(const hfile_layout *layout, size_t max)
+{
+    size_t stripe = layout->stripe_size, span;
+    if (stripe == 0) return 0;
+
+    span = stripe * layout->stripe_count;
+    if (span > max) span = max - max % stripe;
+    return (span >= stripe)? span : stripe;
+}
+
+typedef struct {
+    int fd;
+    char *buffer;
+    off_t offset, end;     // The whole read
+    size_t stripe;
+    unsigned nthreads, next;
+    off_t eof;             // Lowest offset at which a short read occurred
+    int error;
+    pthread_mutex_t lock;  // Protects next, eof, and error
+} layout_read;
+
+// Stripe numbers are dealt out by their residue modulo the number of
+// threads, so each thread keeps to one server throughout.  Residues are
+// claimed dynamically, so that all are covered even if some threads could
+// not be started.
+static void *read_worker(void *rv)
+{
+    layout_read *r = (layout_read *) rv;
+    off_t first = r->offset / r->stripe, last = (r->end - 1) / r->stripe;
+
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        unsigned t = r->next++;
+        int stop = (t >= r->nthreads || r->error);
+        pthread_mutex_unlock(&r->lock);
+        if (stop) break;
+
+        off_t number;
+        for (number = first + t; number <= last; number += r->nthreads) {
+            off_t begin = number * r->stripe, end = begin + r->stripe;
+            if (begin < r->offset) begin = r->offset;
+            if (end > r->end) end = r->end;
+
+            ssize_t n = 1;
+            while (begin < end) {
+                n = pread(r->fd, r->buffer + (begin - r->offset),
+                          end - begin, begin);
+                if (n < 0 && errno == EINTR) continue;
+                else if (n <= 0) break;
+                begin += n;
+            }
+
+            if (n <= 0) {
+                pthread_mutex_lock(&r->lock);
+                if (n < 0 && ! r->error) r->error = errno;
+                if (n == 0 && begin < r->eof) r->eof = begin;
+                pthread_mutex_unlock(&r->lock);
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+ssize_t hfile_layout_pread(int fd, void *buffer, size_t length, off_t offset,
+                           const hfile_layout *layout)
+{
+    layout_read r;
+    pthread_t threads[MAX_THREADS];
+    unsigned i, nstarted;
+
+    if (layout->stripe_size == 0 || length <= layout->stripe_size) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = pread(fd, (char *) buffer + done, length - done,
+                              offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            else if (n < 0) return -1;
+            else if (n == 0) break;
+            done += n;
+        }
+        return done;
+    }
+
+    r.fd = fd;
+    r.buffer = (char *) buffer;
+    r.offset = offset;
+    r.end = r.eof = offset + length;
+    r.stripe = layout->stripe_size;
+    r.nthreads = layout->stripe_count;
+    if (r.nthreads > MAX_THREADS) r.nthreads = MAX_THREADS;
+    r.next = 0;
+    r.error = 0;
+    pthread_mutex_init(&r.lock, NULL);
+
+    // The calling thread reads its own share of the stripes too.
+    for (nstarted = 0; nstarted + 1 < r.nthreads; nstarted++)
+        if (pthread_create(&threads[nstarted], NULL, read_worker, &r) != 0)
+            break;
+    read_worker(&r);
+    for (i = 0; i < nstarted; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&r.lock);
+
+    if (r.error) { errno = r.error; return -1; }
+    return r.eof - offset;
+}
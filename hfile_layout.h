@@ -0,0 +1,69 @@
+/*  hfile_layout.h -- Parallel filesystem stripe layouts.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#ifndef HFILE_LAYOUT_H
+#define HFILE_LAYOUT_H
+
+#include <sys/types.h>
+
+/* hfile_layout.o is linked into each plugin that uses it, so its symbols
+   are hidden to avoid clashes between plugins loaded with RTLD_GLOBAL.  */
+#if defined __GNUC__ && !defined _WIN32 && !defined __CYGWIN__
+#define HFILE_LAYOUT_HIDDEN __attribute__ ((visibility ("hidden")))
+#else
+#define HFILE_LAYOUT_HIDDEN
+#endif
+
+/* A file striped round-robin in units of stripe_size bytes across
+   stripe_count servers.  Unstriped files have stripe_size 0.  */
+typedef struct {
+    size_t stripe_size;
+    unsigned stripe_count;
+} hfile_layout;
+
+/* Fills LAYOUT for FILENAME, open on descriptor FD, from its Lustre or
+   CephFS layout or GPFS block size, or from $HTS_LAYOUT_STRIPE_SIZE and
+   $HTS_LAYOUT_STRIPE_COUNT if set.  Returns 1 if the file is striped
+   across several servers, or 0 otherwise.  */
+int hfile_layout_get(int fd, const char *filename, hfile_layout *layout)
+    HFILE_LAYOUT_HIDDEN;
+
+/* Returns SIZE rounded up to a whole number of stripes, or SIZE itself if
+   the file is not striped.  */
+size_t hfile_layout_align(const hfile_layout *layout, size_t size)
+    HFILE_LAYOUT_HIDDEN;
+
+/* Returns the size of a read covering one stripe on each server, limited
+   to at most MAX (but at least one stripe), or 0 if the file is not
+   striped.  */
+size_t hfile_layout_span(const hfile_layout *layout, size_t max)
+    HFILE_LAYOUT_HIDDEN;
+
+/* Reads LENGTH bytes at OFFSET like a pread(2) loop, but for striped files
+   in stripe-aligned pieces by one thread per server, so that all servers
+   are read from concurrently.  Returns the number of bytes read, which is
+   less than LENGTH only at end of file, or -1 with errno set.  */
+ssize_t hfile_layout_pread(int fd, void *buffer, size_t length, off_t offset,
+                           const hfile_layout *layout) HFILE_LAYOUT_HIDDEN;
+
+#endif
@@ -0,0 +1,367 @@
+/*  hfile_mem.c -- In-memory files.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+/* mem:NAME files are held in a process-wide store in chunks of CHUNK_SIZE
+   bytes.  When the store's total would exceed $HTS_MEM_LIMIT, a file that
+   is being extended is instead moved to an unlinked temporary file in
+   $HTS_MEM_SPILL_DIR (or $TMPDIR, or /tmp).  Opening with "d" in the mode
+   removes the name, as with unlink(2), so the file is freed when that
+   handle (and any others) are closed.  See also hfile_mem.h.  */
+
+#define CHUNK_SIZE 1048576
+
+typedef struct mem_file {
+    struct mem_file *next;
+    char *name;
+    pthread_mutex_t lock;
+    unsigned refs;  // Protected by store.lock
+
+    // The following are protected by lock.
+    char **chunks;
+    size_t nchunks;
+    off_t size;
+    int fd;  // The temporary file once spilled, or -1
+} mem_file;
+
+static struct {
+    pthread_mutex_t lock;
+    mem_file *files;  // Files that have names
+    size_t used, limit;
+} store = { PTHREAD_MUTEX_INITIALIZER };
+
+typedef struct {
+    hFILE base;
+    mem_file *file;
+    off_t pos;
+    int append;
+} hFILE_mem;
+
+static void release_chunks(mem_file *f)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < f->nchunks; i++)
+        if (f->chunks[i]) { free(f->chunks[i]); n++; }
+    free(f->chunks);
+    f->chunks = NULL;
+    f->nchunks = 0;
+
+    pthread_mutex_lock(&store.lock);
+    store.used -= n * CHUNK_SIZE;
+    pthread_mutex_unlock(&store.lock);
+}
+
+static void free_file(mem_file *f)
+{
+    release_chunks(f);
+    if (f->fd >= 0) close(f->fd);
+    pthread_mutex_destroy(&f->lock);
+    free(f->name);
+    free(f);
+}
+
+// Moves F's contents to a temporary file.  Called with f->lock held.
+static int spill(mem_file *f)
+{
+    const char *dir = getenv("HTS_MEM_SPILL_DIR");
+    char path[4096];
+    off_t offset;
+    size_t i;
+
+    if (dir == NULL || *dir == '\0') dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0') dir = "/tmp";
+    snprintf(path, sizeof path, "%s/hfile_mem.XXXXXX", dir);
+
+    f->fd = mkstemp(path);
+    if (f->fd < 0) return -1;
+    unlink(path);
+
+    for (i = 0, offset = 0; offset < f->size; i++, offset += CHUNK_SIZE) {
+        size_t len = (f->size - offset < CHUNK_SIZE)? f->size - offset
+                                                      : CHUNK_SIZE;
+        if (i >= f->nchunks || f->chunks[i] == NULL) continue;  // A hole
+        if (pwrite(f->fd, f->chunks[i], len, offset) != (ssize_t) len) {
+            int save = errno;
+            close(f->fd);
+            f->fd = -1;
+            errno = save;
+            return -1;
+        }
+    }
+    if (ftruncate(f->fd, f->size) < 0) return -1;
+
+    if (hts_verbose >= 4)
+        fprintf(stderr, "[M::hfile_mem] \"%s\" (%lld bytes) spilled to disk\n",
+                f->name, (long long) f->size);
+
+    release_chunks(f);
+    return 0;
+}
+
+// Ensures chunks are allocated for bytes up to END.  Returns 0 on success,
+// 1 if the file was spilled to disk instead, or -1 on error.  Called with
+// f->lock held.
+static int reserve(mem_file *f, off_t end)
+{
+    size_t i, n = (end + CHUNK_SIZE - 1) / CHUNK_SIZE, needed = 0;
+
+    if (n > f->nchunks) {
+        char **chunks = realloc(f->chunks, n * sizeof (char *));
+        if (chunks == NULL) return -1;
+        for (i = f->nchunks; i < n; i++) chunks[i] = NULL;
+        f->chunks = chunks;
+        f->nchunks = n;
+    }
+
+    for (i = 0; i < n; i++) if (f->chunks[i] == NULL) needed++;
+    if (needed == 0) return 0;
+
+    pthread_mutex_lock(&store.lock);
+    int over = store.used + needed * CHUNK_SIZE > store.limit;
+    if (! over) store.used += needed * CHUNK_SIZE;
+    pthread_mutex_unlock(&store.lock);
+
+    if (over) return (spill(f) < 0)? -1 : 1;
+
+    for (i = 0; i < n; i++)
+        if (f->chunks[i] == NULL) {
+            f->chunks[i] = calloc(1, CHUNK_SIZE);
+            if (f->chunks[i] == NULL) {
+                // Return the reservation for this and the remaining chunks.
+                pthread_mutex_lock(&store.lock);
+                for (; i < n; i++)
+                    if (f->chunks[i] == NULL) store.used -= CHUNK_SIZE;
+                pthread_mutex_unlock(&store.lock);
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+
+    return 0;
+}
+
+static ssize_t mem_read(hFILE *fpv, void *bufferv, size_t nbytes)
+{
+    hFILE_mem *fp = (hFILE_mem *) fpv;
+    mem_file *f = fp->file;
+    char *buffer = (char *) bufferv;
+    ssize_t total = 0;
+
+    pthread_mutex_lock(&f->lock);
+    if (fp->pos >= f->size) nbytes = 0;
+    else if ((off_t) nbytes > f->size - fp->pos) nbytes = f->size - fp->pos;
+
+    if (f->fd >= 0) {
+        total = (nbytes > 0)? pread(f->fd, buffer, nbytes, fp->pos) : 0;
+        if (total > 0) fp->pos += total;
+    }
+    else while ((size_t) total < nbytes) {
+        size_t i = fp->pos / CHUNK_SIZE, skip = fp->pos % CHUNK_SIZE;
+        size_t n = CHUNK_SIZE - skip;
+        if (n > nbytes - total) n = nbytes - total;
+
+        if (i < f->nchunks && f->chunks[i])
+            memcpy(&buffer[total], f->chunks[i] + skip, n);
+        else memset(&buffer[total], 0, n);
+
+        total += n;
+        fp->pos += n;
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    return total;
+}
+
+static ssize_t mem_write(hFILE *fpv, const void *bufferv, size_t nbytes)
+{
+    hFILE_mem *fp = (hFILE_mem *) fpv;
+    mem_file *f = fp->file;
+    const char *buffer = (const char *) bufferv;
+    ssize_t total = 0;
+
+    pthread_mutex_lock(&f->lock);
+    if (fp->append) fp->pos = f->size;
+
+    if (f->fd < 0 && reserve(f, fp->pos + nbytes) < 0) total = -1;
+    else if (f->fd >= 0) {
+        total = pwrite(f->fd, buffer, nbytes, fp->pos);
+        if (total > 0) fp->pos += total;
+    }
+    else while ((size_t) total < nbytes) {
+        size_t i = fp->pos / CHUNK_SIZE, skip = fp->pos % CHUNK_SIZE;
+        size_t n = CHUNK_SIZE - skip;
+        if (n > nbytes - total) n = nbytes - total;
+
+        memcpy(f->chunks[i] + skip, &buffer[total], n);
+        total += n;
+        fp->pos += n;
+    }
+
+    if (fp->pos > f->size) f->size = fp->pos;
+    pthread_mutex_unlock(&f->lock);
+
+    return total;
+}
+
+static off_t mem_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_mem *fp = (hFILE_mem *) fpv;
+    mem_file *f = fp->file;
+    off_t origin, size;
+
+    pthread_mutex_lock(&f->lock);
+    size = f->size;
+    pthread_mutex_unlock(&f->lock);
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = size; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > size - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static int mem_close(hFILE *fpv)
+{
+    hFILE_mem *fp = (hFILE_mem *) fpv;
+    mem_file *f = fp->file, **fptr;
+    int last;
+
+    pthread_mutex_lock(&store.lock);
+    last = (--f->refs == 0);
+    if (last) {
+        // Still named files remain after being closed.
+        for (fptr = &store.files; *fptr; fptr = &(*fptr)->next)
+            if (*fptr == f) { last = 0; break; }
+    }
+    pthread_mutex_unlock(&store.lock);
+
+    if (last) free_file(f);
+    return 0;
+}
+
+static const struct hFILE_backend mem_backend =
+{
+    mem_read, mem_write, mem_seek, NULL, mem_close
+};
+
+static hFILE *hopen_mem(const char *filename, const char *mode)
+{
+    int flags = hfile_oflags(mode);
+    const char *name = filename + 4;  // Skip "mem:"
+    hFILE_mem *fp;
+    mem_file *f, **fptr;
+
+    fp = (hFILE_mem *) hfile_init(sizeof (hFILE_mem), mode, 0);
+    if (fp == NULL) return NULL;
+
+    pthread_mutex_lock(&store.lock);
+
+    for (fptr = &store.files; *fptr; fptr = &(*fptr)->next)
+        if (strcmp((*fptr)->name, name) == 0) break;
+    f = *fptr;
+
+    if (f && (flags & O_CREAT) && (flags & O_EXCL)) { errno = EEXIST; goto error; }
+    if (f == NULL) {
+        if (! (flags & O_CREAT)) { errno = ENOENT; goto error; }
+
+        f = calloc(1, sizeof (mem_file));
+        if (f == NULL || (f->name = strdup(name)) == NULL) {
+            free(f);
+            errno = ENOMEM;
+            goto error;
+        }
+        pthread_mutex_init(&f->lock, NULL);
+        f->fd = -1;
+        f->next = store.files;
+        store.files = f;
+        fptr = &store.files;
+    }
+
+    if (strchr(mode, 'd')) *fptr = f->next;  // Remove the name
+    f->refs++;
+    pthread_mutex_unlock(&store.lock);
+
+    if (flags & O_TRUNC) {
+        pthread_mutex_lock(&f->lock);
+        release_chunks(f);
+        if (f->fd >= 0) { close(f->fd); f->fd = -1; }
+        f->size = 0;
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    fp->file = f;
+    fp->pos = 0;
+    fp->append = (flags & O_APPEND)? 1 : 0;
+    fp->base.backend = &mem_backend;
+    return &fp->base;
+
+error:
+    pthread_mutex_unlock(&store.lock);
+    hfile_destroy((hFILE *) fp);
+    return NULL;
+}
+
+static void mem_exit(void)
+{
+    mem_file *f, *next;
+
+    for (f = store.files; f; f = next) {
+        next = f->next;
+        if (f->refs == 0) free_file(f);
+    }
+    store.files = NULL;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_mem, hfile_always_local, "mem", 10 };
+
+    store.limit = hfile_env_size("HTS_MEM_LIMIT", (size_t) 1 << 30);
+
+    self->name = "mem";
+    self->destroy = mem_exit;
+    hfile_add_scheme_handler("mem", &handler);
+    return 0;
+}
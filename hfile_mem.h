@@ -0,0 +1,93 @@
+/*  hfile_mem.h -- Access to the in-memory files of the mem: scheme.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#ifndef HFILE_MEM_H
+#define HFILE_MEM_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "htslib/hfile.h"
+
+/* Files named mem:NAME are held in memory by the hfile_mem plugin, and exist
+   until the process exits or they are removed.  Opening one with "d" in the
+   mode (e.g., "rd") removes its name at once, as with unlink(2), so that
+   later opens of the name fail while the contents remain readable through
+   open handles until they are closed.  These functions use ordinary hFILE
+   calls to populate or extract the contents of such files, so that
+   programs need not link against the plugin.  */
+
+/* Creates or replaces the in-memory file URL (e.g., "mem:foo.bam") with
+   LENGTH bytes from DATA.  Returns 0 on success, or -1 on error.  */
+static inline int hfile_mem_put(const char *url, const void *data, size_t length)
+{
+    hFILE *fp = hopen(url, "w");
+    if (fp == NULL) return -1;
+    if (hwrite(fp, data, length) != (ssize_t) length) {
+        hclose_abruptly(fp);
+        return -1;
+    }
+    return hclose(fp);
+}
+
+/* Returns a malloc()ed copy of the contents of URL, setting *LENGTH to its
+   size, or NULL on error.  The file is removed afterwards if REMOVE is
+   non-zero.  */
+static inline void *hfile_mem_get(const char *url, size_t *length, int remove)
+{
+    hFILE *fp = hopen(url, remove? "rd" : "r");
+    char *data = NULL;
+    off_t size;
+    int save;
+
+    if (fp == NULL) return NULL;
+    size = hseek(fp, 0, SEEK_END);
+    if (size < 0 || hseek(fp, 0, SEEK_SET) < 0) goto error;
+
+    data = (char *) malloc(size? size : 1);
+    if (data == NULL) goto error;
+    if (hread(fp, data, size) != size) { errno = EIO; goto error; }
+
+    if (hclose(fp) < 0) { free(data); return NULL; }
+    *length = size;
+    return data;
+
+error:
+    save = errno;
+    hclose_abruptly(fp);
+    free(data);
+    errno = save;
+    return NULL;
+}
+
+/* Removes the in-memory file URL.  Returns 0 on success, or -1 on error.  */
+static inline int hfile_mem_remove(const char *url)
+{
+    hFILE *fp = hopen(url, "rd");
+    if (fp == NULL) return -1;
+    return hclose(fp);
+}
+
+#endif
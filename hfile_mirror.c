@@ -0,0 +1,488 @@
+/*  hfile_mirror.c -- Hedged reads across mirrored sources.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+/* mirror:URL1|URL2|... reads content available identically from each of
+   the URLs.  Each read is issued to the source with the lowest recent
+   latency, and if it has not completed within that source's usual latency
+   (the $HTS_MIRROR_HEDGE_PERCENTILE percentile of its recent reads), the
+   read is also issued to the next best idle source, and whichever completes
+   first is used.  Failed reads are retried immediately on other sources.  */
+
+#define NSAMPLES 64
+
+// A read request, which may be in progress on several sources at once.
+// It is freed by whichever of the reader and the sources finishes with it
+// last, but only the first source to complete it writes to the buffer.
+typedef struct {
+    off_t offset;
+    size_t length;
+    char *buffer;
+    ssize_t result;
+    unsigned issued, failed, refs;
+    int done, error, abandoned;
+} mirror_request;
+
+struct hFILE_mirror;
+
+typedef struct {
+    struct hFILE_mirror *fp;
+    char *url;
+    hFILE *in;
+    off_t pos;
+    char *buffer;
+    size_t bufsize;
+    pthread_t thread;
+    int started;
+
+    // The following are protected by fp->lock.
+    mirror_request *req;
+    double mean_ns;  // Exponentially weighted moving average
+    uint64_t samples[NSAMPLES];
+    unsigned nsamples, reads, wins, hedges;
+} mirror_source;
+
+typedef struct hFILE_mirror {
+    hFILE base;
+    mirror_source *sources;
+    unsigned nsources;
+    off_t pos, size;
+    double percentile, default_hedge_ns;
+
+    // The following are shared with the worker threads and protected by lock.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+} hFILE_mirror;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *av, const void *bv)
+{
+    uint64_t a = *(const uint64_t *) av, b = *(const uint64_t *) bv;
+    return (a > b) - (a < b);
+}
+
+// Returns the time after which a read from S is hedged.  Called with
+// fp->lock held.
+static double hedge_delay(hFILE_mirror *fp, mirror_source *s)
+{
+    uint64_t sorted[NSAMPLES];
+    unsigned n = (s->nsamples < NSAMPLES)? s->nsamples : NSAMPLES;
+
+    if (n < 8) return fp->default_hedge_ns;
+
+    memcpy(sorted, s->samples, n * sizeof (uint64_t));
+    qsort(sorted, n, sizeof (uint64_t), compare_u64);
+    return sorted[(unsigned) (fp->percentile / 100.0 * (n - 1) + 0.5)];
+}
+
+static void record_latency(mirror_source *s, uint64_t ns, int failed)
+{
+    // Failures count as very slow, so other sources are preferred for a while.
+    if (failed) ns = (s->mean_ns > 1e9)? 2 * s->mean_ns : 1e9;
+
+    s->samples[s->nsamples++ % NSAMPLES] = ns;
+    s->mean_ns = (s->reads == 0)? ns : 0.8 * s->mean_ns + 0.2 * ns;
+    s->reads++;
+}
+
+static void release(mirror_request *req)
+{
+    if (--req->refs == 0 && req->abandoned) free(req);
+}
+
+static void *worker(void *sv)
+{
+    mirror_source *s = (mirror_source *) sv;
+    hFILE_mirror *fp = s->fp;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        mirror_request *req = s->req;
+        if (req == NULL) {
+            if (fp->stop) break;
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        off_t offset = req->offset;
+        size_t length = req->length;
+        pthread_mutex_unlock(&fp->lock);
+
+        uint64_t start = now_ns();
+        ssize_t n = 0;
+        if (s->pos != offset) {
+            if (hseek(s->in, offset, SEEK_SET) < 0) n = -1;
+            else s->pos = offset;
+        }
+        while (n >= 0 && (size_t) n < length) {
+            ssize_t got = hread(s->in, s->buffer + n, length - n);
+            if (got < 0) n = -1;
+            else if (got == 0) break;
+            else { n += got; s->pos += got; }
+        }
+        int err = errno;
+        if (n < 0) s->pos = -1;
+
+        pthread_mutex_lock(&fp->lock);
+        record_latency(s, now_ns() - start, n < 0);
+        if (n < 0) {
+            req->failed++;
+            req->error = err;
+        }
+        else if (! req->done) {
+            memcpy(req->buffer, s->buffer, n);
+            req->result = n;
+            req->done = 1;
+            s->wins++;
+        }
+        s->req = NULL;
+        release(req);
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+// Returns the idle source not yet tried with the lowest mean latency, or
+// NULL if there is none.  Called with fp->lock held.
+static mirror_source *choose(hFILE_mirror *fp, const char *tried)
+{
+    mirror_source *best = NULL;
+    unsigned i;
+
+    for (i = 0; i < fp->nsources; i++) {
+        mirror_source *s = &fp->sources[i];
+        if (tried[i] || s->req) continue;
+        if (best == NULL || s->mean_ns < best->mean_ns) best = s;
+    }
+    return best;
+}
+
+static int untried(hFILE_mirror *fp, const char *tried)
+{
+    unsigned i;
+    for (i = 0; i < fp->nsources; i++) if (! tried[i]) return 1;
+    return 0;
+}
+
+static void issue(hFILE_mirror *fp, mirror_source *s, mirror_request *req,
+                  char *tried)
+{
+    s->req = req;
+    req->refs++;
+    req->issued++;
+    tried[s - fp->sources] = 1;
+    pthread_cond_broadcast(&fp->cond);
+}
+
+static ssize_t mirror_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_mirror *fp = (hFILE_mirror *) fpv;
+    mirror_request *req;
+    mirror_source *s;
+    char tried[fp->nsources];
+    struct timespec deadline;
+    ssize_t result;
+    int hedged = 0, err;
+
+    if (fp->pos >= fp->size) return 0;
+    if (nbytes > fp->sources[0].bufsize) nbytes = fp->sources[0].bufsize;
+
+    req = calloc(1, sizeof (mirror_request));
+    if (req == NULL) return -1;
+    req->offset = fp->pos;
+    req->length = nbytes;
+    req->buffer = buffer;
+    memset(tried, 0, fp->nsources);
+
+    pthread_mutex_lock(&fp->lock);
+
+    // Wait for a source to become idle (only necessary if all are still
+    // busy with hedged reads that lost).
+    while ((s = choose(fp, tried)) == NULL)
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    issue(fp, s, req, tried);
+
+    uint64_t when = 0;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    when = (uint64_t) deadline.tv_sec * 1000000000 + deadline.tv_nsec +
+           hedge_delay(fp, s);
+    deadline.tv_sec = when / 1000000000;
+    deadline.tv_nsec = when % 1000000000;
+
+    while (! req->done) {
+        if (req->failed == req->issued) {
+            // All attempts so far have failed, so fail over immediately.
+            if (! untried(fp, tried)) break;
+            if ((s = choose(fp, tried)) != NULL) issue(fp, s, req, tried);
+            else pthread_cond_wait(&fp->cond, &fp->lock);
+        }
+        else if (! hedged && untried(fp, tried)) {
+            if (pthread_cond_timedwait(&fp->cond, &fp->lock, &deadline)
+                    == ETIMEDOUT && ! req->done) {
+                if ((s = choose(fp, tried)) != NULL) {
+                    issue(fp, s, req, tried);
+                    s->hedges++;
+                }
+                hedged = 1;
+            }
+        }
+        else pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+
+    result = req->done? req->result : -1;
+    err = req->error;
+    req->abandoned = 1;
+    if (req->refs == 0) free(req);
+    pthread_mutex_unlock(&fp->lock);
+
+    if (result < 0) errno = err;
+    else fp->pos += result;
+    return result;
+}
+
+static off_t mirror_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_mirror *fp = (hFILE_mirror *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->size; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > fp->size - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void stop_workers(hFILE_mirror *fp)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+
+    for (i = 0; i < fp->nsources; i++)
+        if (fp->sources[i].started) pthread_join(fp->sources[i].thread, NULL);
+}
+
+static void destroy(hFILE_mirror *fp)
+{
+    unsigned i;
+
+    for (i = 0; i < fp->nsources; i++) {
+        free(fp->sources[i].url);
+        free(fp->sources[i].buffer);
+    }
+    free(fp->sources);
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+}
+
+static int mirror_close(hFILE *fpv)
+{
+    hFILE_mirror *fp = (hFILE_mirror *) fpv;
+    int err = 0;
+    unsigned i;
+
+    stop_workers(fp);
+
+    for (i = 0; i < fp->nsources; i++) {
+        mirror_source *s = &fp->sources[i];
+        if (hts_verbose >= 4)
+            fprintf(stderr, "[M::hfile_mirror] \"%s\": %u reads, %u used, "
+                    "%u hedged, mean latency %.0f us\n",
+                    s->url, s->reads, s->wins, s->hedges, s->mean_ns / 1000);
+        if (hclose(s->in) < 0 && ! err) err = errno;
+    }
+
+    destroy(fp);
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend mirror_backend =
+{
+    mirror_read, NULL, mirror_seek, NULL, mirror_close
+};
+
+static const char *strip_mirror_scheme(const char *filename)
+{
+    if (strncmp(filename, "mirror:", 7) == 0) filename += 7;
+    return filename;
+}
+
+static hFILE *hopen_mirror(const char *filename, const char *mode)
+{
+    hFILE_mirror *fp = NULL;
+    const char *url, *end;
+    size_t bufsize;
+    unsigned i, n;
+    int save, ret;
+
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_RDONLY) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    bufsize = hfile_env_size("HTS_MIRROR_BLOCK_SIZE", 262144);
+    if (bufsize < 4096) bufsize = 4096;
+
+    fp = (hFILE_mirror *) hfile_init(sizeof (hFILE_mirror), mode, bufsize);
+    if (fp == NULL) return NULL;
+
+    fp->pos = 0;
+    fp->size = -1;
+    fp->stop = 0;
+    fp->percentile = hfile_env_int("HTS_MIRROR_HEDGE_PERCENTILE", 95, 1, 99);
+    fp->default_hedge_ns = hfile_env_duration("HTS_MIRROR_HEDGE_DELAY", 50e6);
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+
+    url = strip_mirror_scheme(filename);
+    for (n = 1, end = url; (end = strchr(end, '|')) != NULL; end++) n++;
+    fp->nsources = 0;
+    fp->sources = calloc(n, sizeof (mirror_source));
+    if (fp->sources == NULL) goto error;
+
+    for (; *url; url = (*end)? end + 1 : end) {
+        end = strchr(url, '|');
+        if (end == NULL) end = url + strlen(url);
+        if (end == url) continue;
+
+        mirror_source *s = &fp->sources[fp->nsources++];
+        s->fp = fp;
+        s->url = malloc(end - url + 1);
+        s->bufsize = bufsize;
+        s->buffer = malloc(bufsize);
+        if (s->url == NULL || s->buffer == NULL) goto error;
+        memcpy(s->url, url, end - url);
+        s->url[end - url] = '\0';
+
+        s->in = hopen(s->url, mode);
+        if (s->in == NULL) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_mirror] can't open \"%s\": %s\n",
+                        s->url, strerror(errno));
+            goto error;
+        }
+
+        // Sources must be seekable, and all of the same size.
+        off_t size = hseek(s->in, 0, SEEK_END);
+        if (size < 0 || hseek(s->in, 0, SEEK_SET) < 0) goto error;
+        s->pos = 0;
+        if (fp->size >= 0 && size != fp->size) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_mirror] \"%s\" is %lld bytes, "
+                        "unlike \"%s\" (%lld bytes)\n", s->url,
+                        (long long) size, fp->sources[0].url,
+                        (long long) fp->size);
+            errno = EINVAL;
+            goto error;
+        }
+        fp->size = size;
+    }
+
+    if (fp->nsources == 0) { errno = EINVAL; goto error; }
+
+    for (i = 0; i < fp->nsources; i++) {
+        mirror_source *s = &fp->sources[i];
+        ret = pthread_create(&s->thread, NULL, worker, s);
+        if (ret != 0) { errno = ret; goto error; }
+        s->started = 1;
+    }
+
+    fp->base.backend = &mirror_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp->sources) {
+        stop_workers(fp);
+        for (i = 0; i < fp->nsources; i++)
+            if (fp->sources[i].in) hclose_abruptly(fp->sources[i].in);
+    }
+    destroy(fp);
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+// Remote if any of the sources is.
+static int mirror_isremote(const char *filename)
+{
+    const char *url = strip_mirror_scheme(filename), *end;
+    char buffer[4096];
+    int remote = 0;
+
+    for (; *url && ! remote; url = (*end)? end + 1 : end) {
+        end = strchr(url, '|');
+        if (end == NULL) end = url + strlen(url);
+        if (end == url || end - url >= (ptrdiff_t) sizeof buffer) continue;
+        memcpy(buffer, url, end - url);
+        buffer[end - url] = '\0';
+        remote = hisremote(buffer);
+    }
+    return remote;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_mirror, mirror_isremote, "mirror", 50 };
+
+    self->name = "mirror";
+    hfile_add_scheme_handler("mirror", &handler);
+    return 0;
+}
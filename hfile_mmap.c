@@ -29,37 +29,133 @@ DEALINGS IN THE SOFTWARE.  */
 #include <unistd.h>
 
 #include "hfile_internal.h"
+#include "hfile_ext.h"
+#include "hfile_layout.h"
+#include "hfile_probes.h"
+#include "hfile_ranges.h"
+#include "hfile_stats.h"
 
 typedef struct {
     hFILE base;
     char *buffer;
     size_t length, pos;
-    int fd;
+    int fd, readable;
+    hfile_layout layout;
+    size_t window, advised;  // Read-ahead span, and how far it has reached
+    hfile_stats stats;
 } hFILE_mmap;
 
+static hfile_stats mmap_stats = { "mmap" };
+
+// For striped files, keeps the stripes within a window spanning all the
+// servers ahead of the reader advised, so that the kernel reads them from
+// all servers concurrently rather than faulting in one stripe at a time.
+static void read_ahead(hFILE_mmap *fp)
+{
+    size_t begin = fp->pos - fp->pos % fp->layout.stripe_size;
+    size_t end = begin + fp->window;
+
+    if (end > fp->length) end = fp->length;
+    if (begin < fp->advised) begin = fp->advised;
+    if (begin >= end) return;
+
+    (void) madvise(fp->buffer + begin, end - begin, MADV_WILLNEED);
+    fp->advised = end;
+}
+
 static ssize_t mmap_read(hFILE *fpv, void *buffer, size_t nbytes)
 {
     hFILE_mmap *fp = (hFILE_mmap *) fpv;
+    HFILE_PROBE3(read_entry, fpv, fp->pos, nbytes);
+    uint64_t start = hfile_stats_start();
     size_t avail = fp->length - fp->pos;
-    if (nbytes > avail) nbytes = avail;
-    memcpy(buffer, fp->buffer + fp->pos, nbytes);
-    fp->pos += nbytes;
-    return nbytes;
+    size_t n = (nbytes < avail)? nbytes : avail;
+    if (fp->window > 0) read_ahead(fp);
+    memcpy(buffer, fp->buffer + fp->pos, n);
+    fp->pos += n;
+    hfile_stats_end(&fp->stats, HFILE_STATS_READ, start, n);
+    HFILE_PROBE4(read_return, fpv, fp->pos - n, nbytes, n);
+    return n;
 }
 
 static ssize_t mmap_write(hFILE *fpv, const void *buffer, size_t nbytes)
 {
     hFILE_mmap *fp = (hFILE_mmap *) fpv;
+    HFILE_PROBE3(write_entry, fpv, fp->pos, nbytes);
+    uint64_t start = hfile_stats_start();
     size_t avail = fp->length - fp->pos;
-    if (nbytes > avail) nbytes = avail;
-    memcpy(fp->buffer + fp->pos, buffer, nbytes);
-    fp->pos += nbytes;
-    return nbytes;
+    size_t n = (nbytes < avail)? nbytes : avail;
+    memcpy(fp->buffer + fp->pos, buffer, n);
+    fp->pos += n;
+    hfile_stats_end(&fp->stats, HFILE_STATS_WRITE, start, n);
+    HFILE_PROBE4(write_return, fpv, fp->pos - n, nbytes, n);
+    return n;
+}
+
+// The mapping and its length are fixed while the file is open, so this
+// needs no locking and may be called from several threads at once.
+static ssize_t
+mmap_read_at(void *fpv, off_t offset, void *buffer, size_t nbytes)
+{
+    hFILE_mmap *fp = (hFILE_mmap *) fpv;
+    HFILE_PROBE3(read_entry, fpv, offset, nbytes);
+    uint64_t start = hfile_stats_start();
+    ssize_t n = 0;
+
+    if (! fp->readable) { errno = EBADF; n = -1; goto done; }
+
+    if (offset < fp->length) {
+        size_t avail = fp->length - offset;
+        n = (nbytes < avail)? nbytes : avail;
+        memcpy(buffer, fp->buffer + offset, n);
+    }
+
+done:
+    hfile_stats_end(&fp->stats, HFILE_STATS_READ, start, n);
+    HFILE_PROBE4(read_return, fpv, offset, nbytes, n);
+    return n;
+}
+
+// Asks the kernel to start reading in all the ranges, then copies them in
+// turn, by which time the later ones are likely to be resident.
+static int mmap_read_ranges(hFILE_mmap *fp, hfile_ext_request *req)
+{
+    size_t pagemask = sysconf(_SC_PAGESIZE) - 1;
+    size_t i;
+
+    if (! fp->readable) { errno = EBADF; return -1; }
+
+    for (i = 0; i < req->nranges; i++) {
+        const hfile_range *r = &req->ranges[i];
+        if (r->offset < 0 || r->offset >= fp->length) continue;
+
+        size_t begin = r->offset & ~pagemask;
+        size_t end = (r->length < fp->length - r->offset)
+                   ? r->offset + r->length : fp->length;
+        (void) madvise(fp->buffer + begin, end - begin, MADV_WILLNEED);
+    }
+
+    // Copying in several threads faults in pages from several servers.
+    unsigned nthreads = fp->layout.stripe_count;
+    if (nthreads > 16) nthreads = 16;
+    return hfile_ranges_read(req, mmap_read_at, fp, nthreads, 0);
 }
 
 static off_t mmap_seek(hFILE *fpv, off_t offset, int whence)
 {
     hFILE_mmap *fp = (hFILE_mmap *) fpv;
+
+    if (whence == HFILE_EXT_WHENCE) {
+        hfile_ext_request *req = hfile_ext_accept(offset,
+            (1U << HFILE_EXT_READ_AT) | (1U << HFILE_EXT_READ_RANGES));
+        if (req == NULL) { errno = EINVAL; return -1; }
+        else if (req->op == HFILE_EXT_READ_AT)
+            return mmap_read_at(fp, req->offset, req->buffer, req->length);
+        else return mmap_read_ranges(fp, req);
+    }
+
+    HFILE_PROBE3(seek_entry, fpv, offset, whence);
+    uint64_t start = hfile_stats_start();
     size_t absoffset = (offset >= 0)? offset : -offset;
     size_t origin;
 
@@ -67,25 +163,35 @@ static off_t mmap_seek(hFILE *fpv, off_t offset, int whence)
     case SEEK_SET: origin = 0; break;
     case SEEK_CUR: origin = fp->pos; break;
     case SEEK_END: origin = fp->length; break;
-    default: errno = EINVAL; return -1;
+    default: errno = EINVAL; goto error;
     }
 
     if ((offset  < 0 && absoffset > origin) ||
         (offset >= 0 && absoffset > fp->length - origin)) {
         errno = EINVAL;
-        return -1;
+        goto error;
     }
 
     fp->pos = origin + offset;
+    fp->advised = 0;
+    hfile_stats_end(&fp->stats, HFILE_STATS_SEEK, start, 0);
+    HFILE_PROBE4(seek_return, fpv, offset, whence, fp->pos);
     return fp->pos;
+
+error:
+    HFILE_PROBE4(seek_return, fpv, offset, whence, -1);
+    return -1;
 }
 
 static int mmap_close(hFILE *fpv)
 {
     hFILE_mmap *fp = (hFILE_mmap *) fpv;
     int ret = 0;
+    HFILE_PROBE1(close_entry, fpv);
+    hfile_stats_close(&fp->stats, &mmap_stats);
     if (munmap(fp->buffer, fp->length) < 0) ret = -1;
     if (close(fp->fd) < 0) ret = -1;
+    HFILE_PROBE2(close_return, fpv, ret);
     return ret;
 }
 
@@ -101,8 +207,11 @@ static hFILE *hopen_mmap(const char *filename, const char *modestr)
     int fd = -1;
     void *data = MAP_FAILED;
     hFILE_mmap *fp = NULL;
+    hfile_layout layout;
     int prot, save;
 
+    HFILE_PROBE2(open_entry, filename, modestr);
+
     if (strncmp(filename, "mmap://localhost/", 17) == 0) filename += 16;
     else if (strncmp(filename, "mmap:///", 8) == 0) filename += 7;
     else if (strncmp(filename, "mmap:", 5) == 0) filename += 5;
@@ -121,14 +230,23 @@ static hFILE *hopen_mmap(const char *filename, const char *modestr)
     data = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
     if (data == MAP_FAILED) goto error;
 
-    fp = (hFILE_mmap *) hfile_init(sizeof (hFILE_mmap), modestr, st.st_blksize);
+    hfile_layout_get(fd, filename, &layout);
+    fp = (hFILE_mmap *) hfile_init(sizeof (hFILE_mmap), modestr,
+                                   layout.stripe_size? layout.stripe_size
+                                                     : st.st_blksize);
     if (fp == NULL) goto error;
 
     fp->fd = fd;
+    fp->layout = layout;
+    fp->window = hfile_layout_span(&layout, 64 << 20);
+    fp->advised = 0;
+    fp->readable = (prot & PROT_READ) != 0;
     fp->buffer = data;
     fp->length = st.st_size;
     fp->pos = 0;
+    hfile_stats_open(&fp->stats, "mmap", filename);
     fp->base.backend = &mmap_backend;
+    HFILE_PROBE2(open_return, filename, fp);
     return &fp->base;
 
 error:
@@ -136,16 +254,24 @@ error:
     if (fp) hfile_destroy((hFILE *) fp);
     if (data != MAP_FAILED) (void) munmap(data, st.st_size);
     if (fd >= 0) (void) close(fd);
+    HFILE_PROBE2(open_return, filename, NULL);
     errno = save;
     return NULL;
 }
 
+static void mmap_exit(void)
+{
+    hfile_stats_exit(&mmap_stats);
+}
+
 int hfile_plugin_init(struct hFILE_plugin *self)
 {
     static const struct hFILE_scheme_handler handler =
         { hopen_mmap, hfile_always_local, "mmap", 10 };
 
     self->name = "mmap";
+    self->destroy = mmap_exit;
+    hfile_stats_setup();
     hfile_add_scheme_handler("mmap", &handler);
     return 0;
 }
@@ -0,0 +1,363 @@
+/*  hfile_prefetch.c -- Asynchronous read-ahead wrapper backend for low-level
+    file streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_layout.h"
+#include "hfile_view.h"
+
+// Upper limits on the depth and history, which are each numbers of blocks.
+#define MAX_DEPTH 4096
+#define MAX_HISTORY 4096
+
+// Block number k is held in slots[k % nslots].  The worker fills blocks in
+// order up to depth blocks beyond the reader's current block, so the slots
+// of the preceding history blocks remain intact for short backward seeks.
+typedef struct {
+    char *data;
+    off_t number;
+    size_t length;
+    int ready, error;
+} prefetch_slot;
+
+typedef struct {
+    hFILE base;
+    hFILE *rawfp;
+    prefetch_slot *slots;
+    size_t blksize;
+    unsigned nslots, depth;
+    off_t pos, size;  // size is -1 if the inner stream is not seekable
+
+    // The following are shared with the worker thread and protected by lock.
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    off_t current, next, eofnum;
+    unsigned generation;
+    int eof, reseek, stop;
+} hFILE_prefetch;
+
+static void *worker(void *fpv)
+{
+    hFILE_prefetch *fp = (hFILE_prefetch *) fpv;
+
+    pthread_mutex_lock(&fp->lock);
+    while (! fp->stop) {
+        if (fp->eof || fp->next >= fp->current + fp->depth) {
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        off_t number = fp->next++;
+        prefetch_slot *s = &fp->slots[number % fp->nslots];
+        s->number = number;
+        s->ready = 0;
+        int reseek = fp->reseek;
+        fp->reseek = 0;
+        unsigned generation = fp->generation;
+        pthread_mutex_unlock(&fp->lock);
+
+        ssize_t n = 0;
+        if (reseek && hseek(fp->rawfp, number * fp->blksize, SEEK_SET) < 0)
+            n = -1;
+        if (n == 0) n = hread(fp->rawfp, s->data, fp->blksize);
+        int err = errno;
+
+        pthread_mutex_lock(&fp->lock);
+        if (generation != fp->generation) continue;
+
+        s->length = (n > 0)? n : 0;
+        s->error = (n < 0)? err : 0;
+        s->ready = 1;
+        if (n < (ssize_t) fp->blksize) { fp->eof = 1; fp->eofnum = number; }
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+// Cancels outstanding read-ahead and restarts it from block NUMBER.
+// Called with fp->lock held.  An in-progress inner read cannot be
+// interrupted, but its result will be discarded.
+static void restart(hFILE_prefetch *fp, off_t number)
+{
+    unsigned i;
+    for (i = 0; i < fp->nslots; i++) {
+        fp->slots[i].number = -1;
+        fp->slots[i].ready = 0;
+    }
+    fp->current = fp->next = number;
+    fp->eof = 0;
+    fp->reseek = 1;
+    fp->generation++;
+    pthread_cond_broadcast(&fp->cond);
+}
+
+static ssize_t prefetch_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_prefetch *fp = (hFILE_prefetch *) fpv;
+    off_t number = fp->pos / fp->blksize;
+    prefetch_slot *s = &fp->slots[number % fp->nslots];
+
+    if (fp->size >= 0 && fp->pos >= fp->size) return 0;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        if (s->number == number && s->ready) break;
+
+        if (fp->eof && number > fp->eofnum) {
+            pthread_mutex_unlock(&fp->lock);
+            return 0;
+        }
+
+        // Wait if the block is being read or will be shortly; otherwise
+        // start reading ahead afresh from here.
+        if (! (s->number == number && fp->next > number) &&
+            ! (number >= fp->next && number < fp->next + fp->depth))
+            restart(fp, number);
+
+        if (fp->current != number) {
+            fp->current = number;
+            pthread_cond_broadcast(&fp->cond);
+        }
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+
+    if (fp->current != number) {
+        fp->current = number;
+        pthread_cond_broadcast(&fp->cond);
+    }
+
+    if (s->error) {
+        errno = s->error;
+        s->number = -1;  // Retry via restart() on the next read
+        s->ready = 0;
+        pthread_mutex_unlock(&fp->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    // The worker does not reuse this slot until the reader moves on.
+    size_t skip = fp->pos - number * fp->blksize;
+    size_t avail = (s->length > skip)? s->length - skip : 0;
+    if (nbytes > avail) nbytes = avail;
+    memcpy(buffer, s->data + skip, nbytes);
+    fp->pos += nbytes;
+    return nbytes;
+}
+
+static ssize_t prefetch_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    errno = EBADF;
+    return -1;
+}
+
+static off_t prefetch_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_prefetch *fp = (hFILE_prefetch *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END:
+        if (fp->size < 0) { errno = ESPIPE; return -1; }
+        origin = fp->size;
+        break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || (fp->size >= 0 && offset > fp->size - origin)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // prefetch_read() will use retained blocks or restart as necessary.
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void destroy_slots(hFILE_prefetch *fp)
+{
+    unsigned i;
+    for (i = 0; i < fp->nslots; i++) free(fp->slots[i].data);
+    free(fp->slots);
+}
+
+static int prefetch_close(hFILE *fpv)
+{
+    hFILE_prefetch *fp = (hFILE_prefetch *) fpv;
+    int err = 0;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    pthread_join(fp->worker, NULL);
+
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    destroy_slots(fp);
+
+    if (hclose(fp->rawfp) < 0) err = errno;
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend prefetch_backend =
+{
+    prefetch_read, prefetch_write, prefetch_seek, NULL, prefetch_close
+};
+
+static const char *strip_prefetch_scheme(const char *filename)
+{
+    if (strncmp(filename, "prefetch:", 9) == 0) filename += 9;
+    return filename;
+}
+
+// Returns the default block size for URL: for a local file on striped
+// storage, a whole number of stripes spanning all its servers.
+static size_t default_block_size(const char *url, hfile_layout *layout)
+{
+    const char *path = hfile_view_local_path(url);
+    size_t blksize;
+    int fd;
+
+    layout->stripe_size = 0;
+    layout->stripe_count = 1;
+    if (path && (fd = open(path, O_RDONLY)) >= 0) {
+        hfile_layout_get(fd, path, layout);
+        close(fd);
+    }
+
+    blksize = hfile_layout_span(layout, 64 << 20);
+    return (blksize > 1048576)? blksize : 1048576;
+}
+
+static hFILE *hopen_prefetch(const char *filename, const char *mode)
+{
+    static const char *const option_names[] =
+        { "block_size", "depth", "history", NULL };
+    hFILE_prefetch *fp = NULL;
+    hfile_layout layout;
+    const char *url, *options;
+    char *rawurl = NULL;
+    size_t blksize;
+    unsigned i;
+    int save, ret;
+
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_RDONLY) { errno = EINVAL; goto error; }
+
+    url = strip_prefetch_scheme(filename);
+    options = url + hfile_options_start(url, option_names);
+    rawurl = strndup(url, options - url);
+    if (rawurl == NULL) goto error;
+
+    fp = (hFILE_prefetch *) hfile_init(sizeof (hFILE_prefetch), mode, 0);
+    if (fp == NULL) goto error;
+
+    fp->slots = NULL;
+    fp->rawfp = hopen(rawurl, mode);
+    if (fp->rawfp == NULL) goto error;
+
+    blksize = default_block_size(rawurl, &layout);
+    fp->depth = hfile_option_int(options, "depth", "HTS_PREFETCH_DEPTH", 4,
+                                 1, MAX_DEPTH);
+    fp->blksize = hfile_option_size(options, "block_size",
+                                    "HTS_PREFETCH_BLOCK_SIZE", blksize);
+    if (fp->blksize < 512) fp->blksize = 512;
+    fp->blksize = hfile_layout_align(&layout, fp->blksize);
+    fp->nslots = fp->depth + hfile_option_int(options, "history",
+                                              "HTS_PREFETCH_HISTORY", 2,
+                                              0, MAX_HISTORY);
+    if (fp->nslots < fp->depth) { errno = EINVAL; goto error; }
+
+    fp->slots = calloc(fp->nslots, sizeof (prefetch_slot));
+    if (fp->slots == NULL) goto error;
+    for (i = 0; i < fp->nslots; i++) {
+        fp->slots[i].number = -1;
+        fp->slots[i].data = malloc(fp->blksize);
+        if (fp->slots[i].data == NULL) goto error;
+    }
+
+    fp->size = hseek(fp->rawfp, 0, SEEK_END);
+    if (fp->size < 0 || hseek(fp->rawfp, 0, SEEK_SET) < 0) {
+        hclearerr(fp->rawfp);
+        fp->size = -1;
+    }
+
+    fp->pos = 0;
+    fp->current = fp->next = 0;
+    fp->eof = fp->reseek = fp->stop = 0;
+    fp->generation = 0;
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+    ret = pthread_create(&fp->worker, NULL, worker, fp);
+    if (ret != 0) {
+        pthread_mutex_destroy(&fp->lock);
+        pthread_cond_destroy(&fp->cond);
+        errno = ret;
+        goto error;
+    }
+
+    free(rawurl);
+    fp->base.backend = &prefetch_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    free(rawurl);
+    if (fp) {
+        if (fp->rawfp) hclose_abruptly(fp->rawfp);
+        if (fp->slots) destroy_slots(fp);
+        hfile_destroy((hFILE *) fp);
+    }
+    errno = save;
+    return NULL;
+}
+
+static int prefetch_isremote(const char *filename)
+{
+    return hisremote(strip_prefetch_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_prefetch, prefetch_isremote, "prefetch", 50 };
+
+    self->name = "prefetch";
+    hfile_add_scheme_handler("prefetch", &handler);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*  hfile_probes.h -- USDT static probes in backend hot paths.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#ifndef HFILE_PROBES_H
+#define HFILE_PROBES_H
+
+/* When compiled with -DHAVE_SDT (see USDT in the Makefile), plugins contain
+   probes in the "hfile" provider, which are no-ops unless attached:
+
+     open_entry(url, mode)               open_return(url, fp)
+     read_entry(fp, offset, length)      read_return(fp, offset, length, result)
+     write_entry(fp, offset, length)     write_return(fp, offset, length, result)
+     seek_entry(fp, offset, whence)      seek_return(fp, offset, whence, result)
+     close_entry(fp)                     close_return(fp, result)
+
+   FP is the hFILE pointer, which identifies the stream, and OFFSET is the
+   stream position before the call (for seeks, the requested offset).  */
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define HFILE_PROBE1(name, a)          DTRACE_PROBE1(hfile, name, a)
+#define HFILE_PROBE2(name, a, b)       DTRACE_PROBE2(hfile, name, a, b)
+#define HFILE_PROBE3(name, a, b, c)    DTRACE_PROBE3(hfile, name, a, b, c)
+#define HFILE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(hfile, name, a, b, c, d)
+
+#else
+
+// Arguments appear only within sizeof, so are not evaluated, but variables
+// used solely as probe arguments do not provoke unused variable warnings.
+#define HFILE_PROBE1(name, a)          ((void) sizeof (a))
+#define HFILE_PROBE2(name, a, b)       ((void) (sizeof (a) + sizeof (b)))
+#define HFILE_PROBE3(name, a, b, c)    ((void) (sizeof (a) + sizeof (b) + sizeof (c)))
+#define HFILE_PROBE4(name, a, b, c, d) \
+    ((void) (sizeof (a) + sizeof (b) + sizeof (c) + sizeof (d)))
+
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+/*  hfile_range.c -- Byte-range views of other streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_view.h"
+
+/* range:OFFSET+LENGTH:URL, or range:OFFSET:URL for the rest of the stream,
+   presents that range of bytes of URL as a standalone seekable file.  */
+
+static int parse_range(const char *filename, off_t *offset, off_t *length,
+                       const char **url)
+{
+    const char *s = filename + 6;  // Skip "range:"
+    char *end;
+
+    if (! (*s >= '0' && *s <= '9')) goto invalid;
+    *offset = strtoll(s, &end, 10);
+    *length = -1;
+    if (*end == '+') {
+        s = end + 1;
+        if (! (*s >= '0' && *s <= '9')) goto invalid;
+        *length = strtoll(s, &end, 10);
+    }
+    if (*end != ':' || *offset < 0 || *length < -1) goto invalid;
+
+    *url = end + 1;
+    return 0;
+
+invalid:
+    if (hts_verbose >= 2)
+        fprintf(stderr, "[E::hfile_range] invalid range URL \"%s\"\n",
+                filename);
+    errno = EINVAL;
+    return -1;
+}
+
+static hFILE *hopen_range(const char *filename, const char *mode)
+{
+    off_t offset, length;
+    const char *url;
+
+    if (parse_range(filename, &offset, &length, &url) < 0) return NULL;
+    return hfile_view_open(url, offset, length, mode);
+}
+
+static int range_isremote(const char *filename)
+{
+    off_t offset, length;
+    const char *url;
+
+    if (parse_range(filename, &offset, &length, &url) < 0) return 0;
+    return hisremote(url);
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_range, range_isremote, "range", 50 };
+
+    self->name = "range";
+    hfile_add_scheme_handler("range", &handler);
+    return 0;
+}
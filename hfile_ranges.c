@@ -0,0 +1,192 @@
+/*  hfile_ranges.c -- Vectored reads shared by several backends.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hfile_env.h"
+#include "hfile_ranges.h"
+
+// Merged reads are limited to this size, bounding the temporary buffers.
+#define MAX_SPAN (16 * 1024 * 1024)
+
+// A single read covering COUNT ranges, starting at RANGE in sorted order.
+typedef struct {
+    off_t offset;
+    size_t length;
+    hfile_range **range;
+    size_t count;
+} span;
+
+typedef struct {
+    hfile_ext_request *req;
+    hfile_ranges_read_fn *read_at;
+    void *fp;
+    span *spans;
+    size_t nspans, next;
+    int error;
+    pthread_mutex_t lock;       // Protects next and error
+    pthread_mutex_t done_lock;  // Serialises calls to req->done
+} batch;
+
+static int cmp_offset(const void *av, const void *bv)
+{
+    const hfile_range *a = *(hfile_range * const *) av;
+    const hfile_range *b = *(hfile_range * const *) bv;
+    return (a->offset < b->offset)? -1 : (a->offset > b->offset)? 1 : 0;
+}
+
+static void fetch_span(batch *b, span *s)
+{
+    char *buffer;
+    ssize_t n;
+    int err = 0;
+    size_t i;
+
+    // A span of a single range is read straight into the caller's buffer.
+    if (s->count == 1) buffer = s->range[0]->buffer;
+    else buffer = malloc(s->length);
+
+    if (buffer == NULL) n = -1;
+    else n = b->read_at(b->fp, s->offset, buffer, s->length);
+    if (n < 0) err = errno;
+
+    for (i = 0; i < s->count; i++) {
+        hfile_range *r = s->range[i];
+        size_t skip = r->offset - s->offset;
+        if (n < 0) { r->result = -1; r->error = err; continue; }
+
+        size_t avail = ((size_t) n > skip)? n - skip : 0;
+        r->result = (r->length < avail)? r->length : avail;
+        r->error = 0;
+        if (s->count > 1) memcpy(r->buffer, &buffer[skip], r->result);
+    }
+
+    if (s->count > 1) free(buffer);
+
+    pthread_mutex_lock(&b->lock);
+    if (err && ! b->error) b->error = err;
+    pthread_mutex_unlock(&b->lock);
+
+    if (b->req->done) {
+        pthread_mutex_lock(&b->done_lock);
+        for (i = 0; i < s->count; i++) b->req->done(s->range[i], b->req->data);
+        pthread_mutex_unlock(&b->done_lock);
+    }
+}
+
+static void *worker(void *bv)
+{
+    batch *b = (batch *) bv;
+
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        size_t i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->nspans) break;
+        fetch_span(b, &b->spans[i]);
+    }
+
+    return NULL;
+}
+
+int hfile_ranges_read(hfile_ext_request *req, hfile_ranges_read_fn *read_at,
+                      void *fp, unsigned nthreads, size_t max_gap)
+{
+    hfile_range **sorted = NULL;
+    pthread_t *threads = NULL;
+    unsigned nstarted = 0;
+    batch b;
+    size_t i;
+
+    if (req->nranges == 0) return 0;
+
+    b.req = req;
+    b.read_at = read_at;
+    b.fp = fp;
+    b.nspans = b.next = 0;
+    b.error = 0;
+
+    sorted = malloc(req->nranges * sizeof (hfile_range *));
+    b.spans = malloc(req->nranges * sizeof (span));
+    if (sorted == NULL || b.spans == NULL) goto error;
+
+    for (i = 0; i < req->nranges; i++) {
+        sorted[i] = &req->ranges[i];
+        if (sorted[i]->offset < 0) { errno = EINVAL; goto error; }
+    }
+    qsort(sorted, req->nranges, sizeof (hfile_range *), cmp_offset);
+
+    max_gap = hfile_env_size("HTS_RANGES_GAP", max_gap);
+
+    for (i = 0; i < req->nranges; i++) {
+        hfile_range *r = sorted[i];
+        span *s = b.nspans? &b.spans[b.nspans-1] : NULL;
+        off_t end = r->offset + r->length;
+
+        if (s && r->offset <= s->offset + (off_t) (s->length + max_gap) &&
+            end - s->offset <= MAX_SPAN) {
+            if (end > s->offset + (off_t) s->length)
+                s->length = end - s->offset;
+            s->count++;
+        }
+        else {
+            s = &b.spans[b.nspans++];
+            s->offset = r->offset;
+            s->length = r->length;
+            s->range = &sorted[i];
+            s->count = 1;
+        }
+    }
+
+    if (nthreads > b.nspans) nthreads = b.nspans;
+    if (nthreads > 1) {
+        threads = malloc((nthreads - 1) * sizeof (pthread_t));
+        if (threads == NULL) goto error;
+    }
+
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_mutex_init(&b.done_lock, NULL);
+
+    // The calling thread works through the spans alongside the others.
+    for (nstarted = 0; nstarted + 1 < nthreads; nstarted++)
+        if (pthread_create(&threads[nstarted], NULL, worker, &b) != 0) break;
+    worker(&b);
+    for (i = 0; i < nstarted; i++) pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&b.done_lock);
+    pthread_mutex_destroy(&b.lock);
+    free(threads);
+    free(b.spans);
+    free(sorted);
+
+    if (b.error) { errno = b.error; return -1; }
+    return 0;
+
+error:
+    free(b.spans);
+    free(sorted);
+    return -1;
+}
@@ -0,0 +1,52 @@
+/*  hfile_ranges.h -- Vectored reads shared by several backends.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#ifndef HFILE_RANGES_H
+#define HFILE_RANGES_H
+
+#include <sys/types.h>
+
+#include "hfile_ext.h"
+
+/* hfile_ranges.o is linked into each plugin that uses it, so its symbols
+   are hidden to avoid clashes between plugins loaded with RTLD_GLOBAL.  */
+#if defined __GNUC__ && !defined _WIN32 && !defined __CYGWIN__
+#define HFILE_RANGES_HIDDEN __attribute__ ((visibility ("hidden")))
+#else
+#define HFILE_RANGES_HIDDEN
+#endif
+
+/* A backend's positional read, which reads fewer than LENGTH bytes only at
+   end of file, and may be called from several threads at once.  */
+typedef ssize_t hfile_ranges_read_fn(void *fp, off_t offset, void *buffer,
+                                     size_t length);
+
+/* Carries out an HFILE_EXT_READ_RANGES request with READ_AT on FP.  Ranges
+   separated by at most MAX_GAP bytes ($HTS_RANGES_GAP, if set) are merged
+   into one read, and up to NTHREADS reads are in flight at once.  Returns 0
+   if all ranges were read successfully, or -1 with errno set otherwise.  */
+int hfile_ranges_read(hfile_ext_request *req, hfile_ranges_read_fn *read_at,
+                      void *fp, unsigned nthreads, size_t max_gap)
+    HFILE_RANGES_HIDDEN;
+
+#endif
@@ -0,0 +1,1344 @@
+/*  hfile_regions.c -- Prefetching of the parts of files covering regions.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_ext.h"
+
+// Ranges extend this far beyond the last offset an index entry gives, to
+// take in the rest of a BGZF block (at most 64KiB) or a CRAM container header.
+#define TAIL 65536
+
+/* Growable buffers and little-endian decoding.  */
+
+typedef struct {
+    unsigned char *data;
+    size_t length, capacity;
+} buffer;
+
+static int grow(buffer *b, size_t extra)
+{
+    if (b->length + extra > b->capacity) {
+        size_t capacity = b->capacity? b->capacity : 65536;
+        while (capacity < b->length + extra) capacity *= 2;
+        unsigned char *data = realloc(b->data, capacity);
+        if (data == NULL) return -1;
+        b->data = data;
+        b->capacity = capacity;
+    }
+    return 0;
+}
+
+static inline uint32_t le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t le64(const unsigned char *p)
+{
+    return le32(p) | ((uint64_t) le32(p + 4) << 32);
+}
+
+/* Sequential reading of a stream that may be gzipped or BGZF-compressed
+   (i.e., consist of several gzip members), or not compressed at all.  */
+
+typedef struct {
+    hFILE *fp;
+    z_stream zs;
+    int gzipped, eof;
+    unsigned char in[65536];
+    buffer out;   // Decompressed data, of which the first pos bytes are used
+    size_t pos;
+} gz_reader;
+
+static int gz_open(gz_reader *gz, hFILE *fp)
+{
+    unsigned char magic[2];
+    ssize_t n = hpeek(fp, magic, 2);
+    if (n < 0) return -1;
+
+    memset(gz, 0, sizeof (gz_reader));
+    gz->fp = fp;
+    gz->gzipped = (n == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+    if (gz->gzipped && inflateInit2(&gz->zs, 16 + MAX_WBITS) != Z_OK)
+        { errno = ENOMEM; return -1; }
+    return 0;
+}
+
+static void gz_close(gz_reader *gz)
+{
+    if (gz->gzipped) inflateEnd(&gz->zs);
+    free(gz->out.data);
+}
+
+// Ensures that at least N unused bytes are available, unless the end of
+// the stream is reached first.  Returns the number available, or -1.
+static ssize_t gz_fill(gz_reader *gz, size_t n)
+{
+    if (gz->pos > 0 && gz->pos >= gz->out.length / 2) {
+        memmove(gz->out.data, &gz->out.data[gz->pos], gz->out.length - gz->pos);
+        gz->out.length -= gz->pos;
+        gz->pos = 0;
+    }
+
+    while (gz->out.length - gz->pos < n && ! gz->eof) {
+        if (grow(&gz->out, 65536) < 0) return -1;
+        unsigned char *out = &gz->out.data[gz->out.length];
+        size_t space = gz->out.capacity - gz->out.length;
+
+        if (! gz->gzipped) {
+            ssize_t got = hread(gz->fp, out, space);
+            if (got < 0) return -1;
+            else if (got == 0) gz->eof = 1;
+            gz->out.length += got;
+            continue;
+        }
+
+        if (gz->zs.avail_in == 0) {
+            ssize_t got = hread(gz->fp, gz->in, sizeof gz->in);
+            if (got < 0) return -1;
+            else if (got == 0) { gz->eof = 1; break; }
+            gz->zs.next_in = gz->in;
+            gz->zs.avail_in = got;
+        }
+
+        gz->zs.next_out = out;
+        gz->zs.avail_out = space;
+        int ret = inflate(&gz->zs, Z_NO_FLUSH);
+        gz->out.length += space - gz->zs.avail_out;
+
+        // Further gzip members (e.g., BGZF blocks) may follow.
+        if (ret == Z_STREAM_END) inflateReset(&gz->zs);
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+            { errno = EINVAL; return -1; }
+    }
+
+    return gz->out.length - gz->pos;
+}
+
+// Returns a pointer to the next N bytes, or NULL on error or premature EOF.
+static const unsigned char *gz_next(gz_reader *gz, size_t n)
+{
+    ssize_t avail = gz_fill(gz, n);
+    if (avail < 0) return NULL;
+    if ((size_t) avail < n) { errno = EINVAL; return NULL; }
+
+    const unsigned char *p = &gz->out.data[gz->pos];
+    gz->pos += n;
+    return p;
+}
+
+static int gz_skip(gz_reader *gz, size_t n)
+{
+    while (n > 0) {
+        size_t chunk = (n < 65536)? n : 65536;
+        if (gz_next(gz, chunk) == NULL) return -1;
+        n -= chunk;
+    }
+    return 0;
+}
+
+// Returns the next line (without its newline, and NUL-terminated in place),
+// or NULL at EOF or on error (distinguished by errno being set to 0 at EOF).
+static char *gz_getline(gz_reader *gz)
+{
+    size_t scanned = 0;
+
+    for (;;) {
+        char *line = (char *) &gz->out.data[gz->pos];
+        size_t avail = gz->out.length - gz->pos;
+        char *nl = (avail > scanned)
+            ? memchr(line + scanned, '\n', avail - scanned) : NULL;
+        if (nl) {
+            *nl = '\0';
+            gz->pos += nl + 1 - line;
+            return line;
+        }
+
+        scanned = avail;
+        ssize_t now = gz_fill(gz, avail + 1);
+        if (now < 0) return NULL;
+        if ((size_t) now == avail) {
+            // Final line with no newline
+            if (avail == 0 || grow(&gz->out, 1) < 0) { errno = 0; return NULL; }
+            line = (char *) &gz->out.data[gz->pos];
+            line[avail] = '\0';
+            gz->pos += avail;
+            return line;
+        }
+        scanned = 0;  // The data may have been moved
+    }
+}
+
+/* Reference sequence names, from the BAM or CRAM header.  */
+
+typedef struct {
+    char *name;
+    int tid;
+} ref_name;
+
+typedef struct {
+    ref_name *names;
+    int nref, capacity;
+} ref_names;
+
+static int add_name(ref_names *refs, const char *name, size_t length)
+{
+    if (refs->nref == refs->capacity) {
+        int capacity = refs->capacity? 2 * refs->capacity : 256;
+        ref_name *names = realloc(refs->names, capacity * sizeof (ref_name));
+        if (names == NULL) return -1;
+        refs->names = names;
+        refs->capacity = capacity;
+    }
+
+    char *copy = malloc(length + 1);
+    if (copy == NULL) return -1;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    refs->names[refs->nref].name = copy;
+    refs->names[refs->nref].tid = refs->nref;
+    refs->nref++;
+    return 0;
+}
+
+static int compare_names(const void *av, const void *bv)
+{
+    const ref_name *a = (const ref_name *) av, *b = (const ref_name *) bv;
+    return strcmp(a->name, b->name);
+}
+
+static int find_tid(const ref_names *refs, const char *name)
+{
+    ref_name key = { (char *) name, 0 };
+    const ref_name *r = bsearch(&key, refs->names, refs->nref,
+                                sizeof (ref_name), compare_names);
+    return r? r->tid : -1;
+}
+
+static void free_names(ref_names *refs)
+{
+    int i;
+    for (i = 0; i < refs->nref; i++) free(refs->names[i].name);
+    free(refs->names);
+}
+
+static int read_bam_names(hFILE *fp, ref_names *refs)
+{
+    const unsigned char *p;
+    gz_reader gz;
+    uint32_t i, n;
+
+    if (gz_open(&gz, fp) < 0) return -1;
+
+    if ((p = gz_next(&gz, 8)) == NULL) goto error;
+    if (memcmp(p, "BAM\1", 4) != 0) { errno = EINVAL; goto error; }
+    if (gz_skip(&gz, le32(p + 4)) < 0) goto error;
+
+    if ((p = gz_next(&gz, 4)) == NULL) goto error;
+    n = le32(p);
+    for (i = 0; i < n; i++) {
+        if ((p = gz_next(&gz, 4)) == NULL) goto error;
+        uint32_t length = le32(p);
+        if (length == 0 || (p = gz_next(&gz, length + 4)) == NULL) goto error;
+        if (add_name(refs, (const char *) p, length - 1) < 0) goto error;
+    }
+
+    gz_close(&gz);
+    return 0;
+
+error:
+    gz_close(&gz);
+    return -1;
+}
+
+// Decodes a CRAM ITF-8 integer from P, returning the number of bytes used.
+static int itf8(const unsigned char *p, int32_t *value)
+{
+    if (p[0] < 0x80) { *value = p[0]; return 1; }
+    else if (p[0] < 0xc0) { *value = ((p[0] & 0x3f) << 8) | p[1]; return 2; }
+    else if (p[0] < 0xe0)
+        { *value = ((p[0] & 0x1f) << 16) | (p[1] << 8) | p[2]; return 3; }
+    else if (p[0] < 0xf0) {
+        *value = ((p[0] & 0x0f) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        return 4;
+    }
+    *value = ((uint32_t) (p[0] & 0x0f) << 28) | (p[1] << 20) | (p[2] << 12)
+           | (p[3] << 4) | (p[4] & 0x0f);
+    return 5;
+}
+
+// Returns the length of the CRAM LTF-8 integer at P.
+static int ltf8_length(const unsigned char *p)
+{
+    int n = 1;
+    unsigned char c;
+    for (c = p[0]; n < 9 && (c & 0x80); c <<= 1) n++;
+    return n;
+}
+
+static int parse_sam_names(const char *text, size_t length, ref_names *refs)
+{
+    const char *line = text, *end = text + length;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) eol = end;
+
+        if (eol - line > 4 && memcmp(line, "@SQ\t", 4) == 0) {
+            const char *field = line + 3;
+            while (field && field < eol) {
+                if (eol - field > 4 && memcmp(field, "\tSN:", 4) == 0) {
+                    const char *name = field + 4, *nameend = name;
+                    while (nameend < eol && *nameend != '\t') nameend++;
+                    if (add_name(refs, name, nameend - name) < 0) return -1;
+                    break;
+                }
+                field = memchr(field + 1, '\t', eol - (field + 1));
+            }
+        }
+
+        line = eol + 1;
+    }
+
+    return 0;
+}
+
+// Reads the SAM header text from the first container of a CRAM 2.x or 3.x
+// file, which is in a raw or gzip-compressed block.
+static int read_cram_names(hFILE *fp, ref_names *refs)
+{
+    unsigned char header[1024];
+    unsigned char *data = NULL, *text = NULL;
+    int32_t nblocks, nlandmarks, value, method, size, rawsize;
+    int i, major;
+    ssize_t n;
+    size_t pos;
+
+    n = hread(fp, header, sizeof header);
+    if (n < 0) return -1;
+    if (n < 100 || memcmp(header, "CRAM", 4) != 0) goto invalid;
+
+    major = header[4];
+    if (major != 2 && major != 3) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_regions] unsupported CRAM version %d\n",
+                    major);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    // Skip the file definition, then the container header's length,
+    // reference id, start, span, record count, record counter, and bases.
+    pos = 26 + 4;
+    for (i = 0; i < 4; i++) pos += itf8(&header[pos], &value);
+    if (major >= 3) pos += ltf8_length(&header[pos]);
+    else pos += itf8(&header[pos], &value);
+    pos += ltf8_length(&header[pos]);
+
+    pos += itf8(&header[pos], &nblocks);
+    pos += itf8(&header[pos], &nlandmarks);
+    if (nlandmarks < 0 || nlandmarks > 100) goto invalid;
+    for (i = 0; i < nlandmarks; i++) pos += itf8(&header[pos], &value);
+    if (major >= 3) pos += 4;  // CRC32
+
+    // Block header: compression method, content type, content id, sizes.
+    if (pos + 20 > (size_t) n) goto invalid;
+    method = header[pos];
+    pos += 2;
+    pos += itf8(&header[pos], &value);
+    pos += itf8(&header[pos], &size);
+    pos += itf8(&header[pos], &rawsize);
+    if (size < 4 || rawsize < 4) goto invalid;
+
+    data = malloc(size);
+    if (data == NULL) goto error;
+    if ((size_t) n >= pos + size) memcpy(data, &header[pos], size);
+    else if (hseek(fp, pos, SEEK_SET) < 0 || hread(fp, data, size) != size)
+        goto invalid;
+
+    if (method == 0) { text = data; data = NULL; rawsize = size; }
+    else if (method == 1) {
+        z_stream zs;
+        memset(&zs, 0, sizeof zs);
+        text = malloc(rawsize);
+        if (text == NULL) goto error;
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) goto invalid;
+        zs.next_in = data;
+        zs.avail_in = size;
+        zs.next_out = text;
+        zs.avail_out = rawsize;
+        int ret = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+        if (ret != Z_STREAM_END) goto invalid;
+    }
+    else {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_regions] unsupported compression "
+                    "method %d for CRAM header\n", method);
+        errno = ENOTSUP;
+        goto error;
+    }
+
+    size_t length = le32(text);
+    if (length > (size_t) rawsize - 4) goto invalid;
+    if (parse_sam_names((const char *) text + 4, length, refs) < 0) goto error;
+
+    free(data);
+    free(text);
+    return 0;
+
+invalid:
+    errno = EINVAL;
+error:
+    free(data);
+    free(text);
+    return -1;
+}
+
+/* Regions, from the BED file.  */
+
+typedef struct {
+    int tid;
+    int64_t beg, end;
+} region;
+
+typedef struct {
+    region *regions;
+    size_t n, capacity;
+} region_list;
+
+static int read_bed(const char *url, const ref_names *refs, region_list *list)
+{
+    hFILE *fp = hopen(url, "r");
+    size_t lineno = 0, unknown = 0;
+    gz_reader gz;
+    char *line;
+    int save;
+
+    if (fp == NULL) return -1;
+    if (gz_open(&gz, fp) < 0) { hclose_abruptly(fp); return -1; }
+
+    errno = 0;
+    while ((line = gz_getline(&gz)) != NULL) {
+        char chrom[1024];
+        long long beg, end;
+
+        lineno++;
+        if (*line == '\0' || *line == '#' || strncmp(line, "track", 5) == 0
+            || strncmp(line, "browser", 7) == 0) continue;
+
+        if (sscanf(line, "%1023s %lld %lld", chrom, &beg, &end) < 3
+            || beg < 0 || end < beg) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_regions] invalid BED line %zu "
+                        "in \"%s\"\n", lineno, url);
+            errno = EINVAL;
+            goto error;
+        }
+
+        int tid = find_tid(refs, chrom);
+        if (tid < 0) { unknown++; continue; }
+
+        if (list->n == list->capacity) {
+            size_t capacity = list->capacity? 2 * list->capacity : 1024;
+            region *regions = realloc(list->regions,
+                                      capacity * sizeof (region));
+            if (regions == NULL) goto error;
+            list->regions = regions;
+            list->capacity = capacity;
+        }
+
+        region *r = &list->regions[list->n++];
+        r->tid = tid;
+        r->beg = beg;
+        r->end = end;
+    }
+    if (errno != 0) goto error;
+
+    if (unknown > 0 && hts_verbose >= 2)
+        fprintf(stderr, "[W::hfile_regions] ignored %zu regions in \"%s\" "
+                "on sequences not in the file's header\n", unknown, url);
+
+    gz_close(&gz);
+    return hclose(fp);
+
+error:
+    save = errno;
+    gz_close(&gz);
+    hclose_abruptly(fp);
+    errno = save;
+    return -1;
+}
+
+/* Byte ranges to be prefetched.  */
+
+typedef struct {
+    off_t begin, end;
+} byte_range;
+
+typedef struct {
+    byte_range *ranges;
+    size_t n, capacity;
+} range_list;
+
+static int add_range(range_list *list, off_t begin, off_t end)
+{
+    if (list->n == list->capacity) {
+        size_t capacity = list->capacity? 2 * list->capacity : 1024;
+        byte_range *ranges = realloc(list->ranges,
+                                     capacity * sizeof (byte_range));
+        if (ranges == NULL) return -1;
+        list->ranges = ranges;
+        list->capacity = capacity;
+    }
+
+    list->ranges[list->n].begin = begin;
+    list->ranges[list->n].end = end;
+    list->n++;
+    return 0;
+}
+
+/* BAI and CSI indexes.  Only the references named in the regions are kept,
+   with their bins sorted so that they can be looked up.  */
+
+typedef struct {
+    uint32_t bin;
+    uint64_t loffset;
+    uint32_t nchunks;
+    uint64_t *chunks;  // Pairs of begin and end virtual offsets
+} bin_entry;
+
+typedef struct {
+    bin_entry *bins;
+    uint32_t nbins, nintervals;
+    uint64_t *intervals;  // BAI linear index
+} ref_bins;
+
+typedef struct {
+    int min_shift, depth, csi;
+    int nref;
+    ref_bins *refs;
+} bin_index;
+
+static int compare_bins(const void *av, const void *bv)
+{
+    const bin_entry *a = (const bin_entry *) av, *b = (const bin_entry *) bv;
+    return (a->bin < b->bin)? -1 : (a->bin > b->bin)? 1 : 0;
+}
+
+static void free_bin_index(bin_index *idx)
+{
+    int i;
+    uint32_t j;
+
+    for (i = 0; i < idx->nref; i++) {
+        for (j = 0; j < idx->refs[i].nbins; j++)
+            free(idx->refs[i].bins[j].chunks);
+        free(idx->refs[i].bins);
+        free(idx->refs[i].intervals);
+    }
+    free(idx->refs);
+}
+
+// Reads a BAI (if CSI is 0) or CSI index, keeping references in WANTED.
+static int read_bin_index(gz_reader *gz, int csi, const char *wanted,
+                          int nwanted, bin_index *idx)
+{
+    const unsigned char *p;
+    uint32_t i, j;
+    int tid;
+
+    idx->csi = csi;
+    idx->min_shift = 14;
+    idx->depth = 5;
+    if (csi) {
+        if ((p = gz_next(gz, 12)) == NULL) return -1;
+        idx->min_shift = le32(p);
+        idx->depth = le32(p + 4);
+        if (gz_skip(gz, le32(p + 8)) < 0) return -1;
+        if (idx->min_shift < 0 || idx->min_shift > 32 ||
+            idx->depth < 0 || idx->depth > 10) { errno = EINVAL; return -1; }
+    }
+
+    if ((p = gz_next(gz, 4)) == NULL) return -1;
+    int nref = le32(p);
+    if (nref < 0) { errno = EINVAL; return -1; }
+    idx->refs = calloc(nref? nref : 1, sizeof (ref_bins));
+    if (idx->refs == NULL) return -1;
+    idx->nref = nref;
+
+    for (tid = 0; tid < idx->nref; tid++) {
+        ref_bins *ref = &idx->refs[tid];
+        int keep = (tid < nwanted && wanted[tid]);
+        uint32_t nbins;
+
+        if ((p = gz_next(gz, 4)) == NULL) return -1;
+        nbins = le32(p);
+        if (keep) {
+            ref->bins = calloc(nbins? nbins : 1, sizeof (bin_entry));
+            if (ref->bins == NULL) return -1;
+        }
+
+        for (i = 0; i < nbins; i++) {
+            uint32_t bin, nchunks;
+            uint64_t loffset = 0;
+
+            if ((p = gz_next(gz, csi? 16 : 8)) == NULL) return -1;
+            bin = le32(p);
+            if (csi) { loffset = le64(p + 4); nchunks = le32(p + 12); }
+            else nchunks = le32(p + 4);
+
+            if (! keep) {
+                if (gz_skip(gz, 16 * (size_t) nchunks) < 0) return -1;
+                continue;
+            }
+
+            bin_entry *b = &ref->bins[ref->nbins++];
+            b->bin = bin;
+            b->loffset = loffset;
+            b->nchunks = nchunks;
+            b->chunks = malloc(16 * (size_t) (nchunks? nchunks : 1));
+            if (b->chunks == NULL) return -1;
+            for (j = 0; j < 2 * nchunks; j++) {
+                if ((p = gz_next(gz, 8)) == NULL) return -1;
+                b->chunks[j] = le64(p);
+            }
+        }
+
+        if (keep)
+            qsort(ref->bins, ref->nbins, sizeof (bin_entry), compare_bins);
+
+        if (! csi) {
+            if ((p = gz_next(gz, 4)) == NULL) return -1;
+            uint32_t nintervals = le32(p);
+            if (! keep) {
+                if (gz_skip(gz, 8 * (size_t) nintervals) < 0) return -1;
+                continue;
+            }
+
+            ref->intervals = malloc(8 * (size_t) (nintervals? nintervals : 1));
+            if (ref->intervals == NULL) return -1;
+            for (j = 0; j < nintervals; j++) {
+                if ((p = gz_next(gz, 8)) == NULL) return -1;
+                ref->intervals[j] = le64(p);
+            }
+            ref->nintervals = nintervals;
+        }
+    }
+
+    return 0;
+}
+
+static const bin_entry *find_bin(const ref_bins *ref, uint32_t bin)
+{
+    bin_entry key;
+    key.bin = bin;
+    return bsearch(&key, ref->bins, ref->nbins, sizeof (bin_entry),
+                   compare_bins);
+}
+
+static inline uint32_t bin_first(int level)
+{
+    return ((1U << (3 * level)) - 1) / 7;
+}
+
+// Adds the byte ranges of the chunks overlapping R, as in HTSlib's
+// hts_itr_query(), including its use of the linear index or bin loffsets
+// to skip chunks that end before any alignment overlapping R.
+static int query_bins(const bin_index *idx, const region *r, range_list *out)
+{
+    const ref_bins *ref;
+    uint64_t min_off = 0;
+    int64_t beg = r->beg, end = r->end;
+    int level, shift;
+
+    if (r->tid >= idx->nref) return 0;
+    ref = &idx->refs[r->tid];
+    if (ref->nbins == 0 || beg >= end) return 0;
+
+    shift = idx->min_shift + 3 * idx->depth;
+    if (end > (int64_t) 1 << shift) end = (int64_t) 1 << shift;
+    if (beg >= end) return 0;
+
+    if (! idx->csi) {
+        if (ref->nintervals > 0) {
+            uint64_t i = beg >> idx->min_shift;
+            if (i >= ref->nintervals) i = ref->nintervals - 1;
+            min_off = ref->intervals[i];
+        }
+    }
+    else {
+        uint32_t bin = bin_first(idx->depth) + (beg >> idx->min_shift);
+        const bin_entry *b = NULL;
+        for (;;) {
+            if ((b = find_bin(ref, bin)) != NULL || bin == 0) break;
+            bin = (bin - 1) >> 3;
+        }
+        if (b) min_off = b->loffset;
+    }
+
+    for (level = 0; level <= idx->depth; level++, shift -= 3) {
+        uint32_t t = bin_first(level), bin;
+        for (bin = t + (beg >> shift); bin <= t + ((end - 1) >> shift); bin++) {
+            const bin_entry *b = find_bin(ref, bin);
+            uint32_t i;
+            if (b == NULL) continue;
+
+            for (i = 0; i < b->nchunks; i++) {
+                uint64_t cbeg = b->chunks[2*i], cend = b->chunks[2*i+1];
+                if (cend <= min_off) continue;
+                if (cbeg < min_off) cbeg = min_off;
+                if (add_range(out, cbeg >> 16, (cend >> 16) + TAIL) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* CRAI indexes, which are gzipped text.  */
+
+typedef struct {
+    int tid;
+    int64_t start, span;  // Alignment start is 1-based
+    off_t container, end;
+} crai_entry;
+
+typedef struct {
+    crai_entry *entries;
+    size_t n;
+} crai_index;
+
+static int compare_crai(const void *av, const void *bv)
+{
+    const crai_entry *a = (const crai_entry *) av, *b = (const crai_entry *) bv;
+    if (a->tid != b->tid) return (a->tid < b->tid)? -1 : 1;
+    return (a->start < b->start)? -1 : (a->start > b->start)? 1 : 0;
+}
+
+static int read_crai(gz_reader *gz, crai_index *idx)
+{
+    size_t capacity = 0;
+    char *line;
+
+    errno = 0;
+    while ((line = gz_getline(gz)) != NULL) {
+        long long tid, start, span, container, slice, size;
+        if (*line == '\0') continue;
+        if (sscanf(line, "%lld %lld %lld %lld %lld %lld", &tid, &start, &span,
+                   &container, &slice, &size) != 6)
+            { errno = EINVAL; return -1; }
+        if (tid < 0) continue;
+
+        if (idx->n == capacity) {
+            capacity = capacity? 2 * capacity : 1024;
+            crai_entry *entries = realloc(idx->entries,
+                                          capacity * sizeof (crai_entry));
+            if (entries == NULL) return -1;
+            idx->entries = entries;
+        }
+
+        crai_entry *e = &idx->entries[idx->n++];
+        e->tid = tid;
+        e->start = start;
+        e->span = span;
+        e->container = container;
+        e->end = container + TAIL + slice + size;
+    }
+    if (errno != 0) return -1;
+
+    qsort(idx->entries, idx->n, sizeof (crai_entry), compare_crai);
+    return 0;
+}
+
+static int query_crai(const crai_index *idx, const region *r, range_list *out)
+{
+    size_t lo = 0, hi = idx->n, i;
+
+    // Find the first entry for this reference.
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].tid < r->tid) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (i = lo; i < idx->n && idx->entries[i].tid == r->tid; i++) {
+        const crai_entry *e = &idx->entries[i];
+        if (e->start > r->end) break;
+        if (e->start + e->span > r->beg + 1)
+            if (add_range(out, e->container, e->end) < 0) return -1;
+    }
+
+    return 0;
+}
+
+/* The stream itself.  Its ranges are divided into units of at most
+   $HTS_REGIONS_BLOCK_SIZE bytes, which the worker fetches in order while
+   their total size stays within $HTS_REGIONS_MEMORY.  Units before the one
+   being read are discarded.  Reads outside the units, or of units that have
+   been discarded, go directly to the inner stream.  */
+
+enum unit_state { PENDING, FETCHING, READY, FAILED, DISCARDED };
+
+typedef struct {
+    off_t offset;
+    size_t length;
+    char *data;
+    enum unit_state state;
+} unit;
+
+typedef struct {
+    hFILE base;
+    hFILE *rawfp;
+    int raw_read_at;   // Whether rawfp supports hfile_read_at()
+    off_t pos, size;
+    unit *units;
+    size_t nunits;
+
+    // The following are shared with the worker thread and protected by lock.
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t raw_lock;  // Serialises seek+read pairs on rawfp
+    size_t next, consumed, memory, memory_limit;
+    int stop;
+    size_t hits, misses;
+} hFILE_regions;
+
+static ssize_t raw_read(hFILE_regions *fp, off_t offset, char *buffer,
+                        size_t nbytes)
+{
+    ssize_t n;
+
+    if (fp->raw_read_at)
+        return hfile_read_at(fp->rawfp, offset, buffer, nbytes);
+
+    pthread_mutex_lock(&fp->raw_lock);
+    if (hseek(fp->rawfp, offset, SEEK_SET) < 0) n = -1;
+    else n = hread(fp->rawfp, buffer, nbytes);
+    pthread_mutex_unlock(&fp->raw_lock);
+    return n;
+}
+
+static void *worker(void *fpv)
+{
+    hFILE_regions *fp = (hFILE_regions *) fpv;
+
+    pthread_mutex_lock(&fp->lock);
+    while (! fp->stop) {
+        while (fp->next < fp->nunits && fp->units[fp->next].state != PENDING)
+            fp->next++;
+
+        if (fp->next >= fp->nunits ||
+            (fp->memory > 0 &&
+             fp->memory + fp->units[fp->next].length > fp->memory_limit)) {
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        size_t i = fp->next++;
+        unit *u = &fp->units[i];
+        u->state = FETCHING;
+        fp->memory += u->length;
+        pthread_mutex_unlock(&fp->lock);
+
+        char *data = malloc(u->length);
+        ssize_t n = data? raw_read(fp, u->offset, data, u->length) : -1;
+
+        pthread_mutex_lock(&fp->lock);
+        if (n == (ssize_t) u->length && i >= fp->consumed) {
+            u->data = data;
+            u->state = READY;
+        }
+        else {
+            // The reader has moved past this unit, or it can't be fetched,
+            // in which case the reader will retry and see any error.
+            free(data);
+            fp->memory -= u->length;
+            u->state = (i < fp->consumed)? DISCARDED : FAILED;
+        }
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+static void discard(hFILE_regions *fp, unit *u, enum unit_state state)
+{
+    if (u->state == READY) {
+        free(u->data);
+        u->data = NULL;
+        fp->memory -= u->length;
+    }
+    u->state = state;
+}
+
+// Returns the index of the unit containing OFFSET, or the one after it
+// (possibly nunits) if there is none, setting *FOUND accordingly.
+static size_t find_unit(const hFILE_regions *fp, off_t offset, int *found)
+{
+    size_t lo = 0, hi = fp->nunits;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (fp->units[mid].offset + (off_t) fp->units[mid].length <= offset)
+            lo = mid + 1;
+        else hi = mid;
+    }
+    *found = (lo < fp->nunits && fp->units[lo].offset <= offset);
+    return lo;
+}
+
+static ssize_t regions_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_regions *fp = (hFILE_regions *) fpv;
+    size_t i, k;
+    int found;
+
+    if (fp->pos >= fp->size) return 0;
+
+    pthread_mutex_lock(&fp->lock);
+    k = find_unit(fp, fp->pos, &found);
+
+    if (! found) {
+        // Read directly, up to the start of the next unit.
+        if (k < fp->nunits && fp->units[k].offset - fp->pos < (off_t) nbytes)
+            nbytes = fp->units[k].offset - fp->pos;
+        fp->misses++;
+        pthread_mutex_unlock(&fp->lock);
+        goto direct;
+    }
+
+    unit *u = &fp->units[k];
+
+    // The reader has moved on from the units before this one.
+    if (k > fp->consumed) {
+        for (i = fp->consumed; i < k; i++)
+            if (fp->units[i].state != FETCHING)
+                discard(fp, &fp->units[i], DISCARDED);
+        fp->consumed = k;
+        if (fp->next < k) fp->next = k;
+        pthread_cond_broadcast(&fp->cond);
+    }
+
+    while (u->state == PENDING || u->state == FETCHING) {
+        if (u->state == PENDING) {
+            // Make room by discarding units read ahead beyond this one, and
+            // have the worker fetch this one next.
+            for (i = fp->nunits; i-- > k + 1 &&
+                 fp->memory > 0 && fp->memory + u->length > fp->memory_limit; )
+                if (fp->units[i].state == READY)
+                    discard(fp, &fp->units[i], PENDING);
+            fp->next = k;
+            pthread_cond_broadcast(&fp->cond);
+        }
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+
+    size_t skip = fp->pos - u->offset;
+    size_t avail = u->length - skip;
+    if (nbytes > avail) nbytes = avail;
+
+    if (u->state != READY) {
+        fp->misses++;
+        pthread_mutex_unlock(&fp->lock);
+        goto direct;
+    }
+
+    // The worker never frees a READY unit, so it can be copied unlocked.
+    fp->hits++;
+    pthread_mutex_unlock(&fp->lock);
+    memcpy(buffer, u->data + skip, nbytes);
+    fp->pos += nbytes;
+    return nbytes;
+
+direct:
+    {
+        ssize_t n = raw_read(fp, fp->pos, buffer, nbytes);
+        if (n > 0) fp->pos += n;
+        return n;
+    }
+}
+
+static ssize_t regions_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    errno = EBADF;
+    return -1;
+}
+
+static off_t regions_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_regions *fp = (hFILE_regions *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->size; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > fp->size - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void destroy_units(hFILE_regions *fp)
+{
+    size_t i;
+    for (i = 0; i < fp->nunits; i++) free(fp->units[i].data);
+    free(fp->units);
+}
+
+static int regions_close(hFILE *fpv)
+{
+    hFILE_regions *fp = (hFILE_regions *) fpv;
+    int err = 0;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    pthread_join(fp->worker, NULL);
+
+    if (hts_verbose >= 4)
+        fprintf(stderr, "[M::hfile_regions] %zu reads from prefetched data, "
+                "%zu direct\n", fp->hits, fp->misses);
+
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    pthread_mutex_destroy(&fp->raw_lock);
+    destroy_units(fp);
+
+    if (hclose(fp->rawfp) < 0) err = errno;
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend regions_backend =
+{
+    regions_read, regions_write, regions_seek, NULL, regions_close
+};
+
+static int compare_ranges(const void *av, const void *bv)
+{
+    const byte_range *a = (const byte_range *) av, *b = (const byte_range *) bv;
+    return (a->begin < b->begin)? -1 : (a->begin > b->begin)? 1 : 0;
+}
+
+// Sorts and merges RANGES, and divides them into units for FP.
+static int make_units(hFILE_regions *fp, range_list *ranges, size_t blksize)
+{
+    size_t i, n = 0, nunits = 0;
+
+    qsort(ranges->ranges, ranges->n, sizeof (byte_range), compare_ranges);
+    for (i = 0; i < ranges->n; i++) {
+        byte_range *r = &ranges->ranges[i];
+        if (r->end > fp->size) r->end = fp->size;
+        if (r->begin >= r->end) continue;
+
+        if (n > 0 && r->begin <= ranges->ranges[n-1].end) {
+            if (r->end > ranges->ranges[n-1].end)
+                ranges->ranges[n-1].end = r->end;
+        }
+        else ranges->ranges[n++] = *r;
+    }
+    ranges->n = n;
+
+    for (i = 0; i < n; i++) {
+        off_t length = ranges->ranges[i].end - ranges->ranges[i].begin;
+        nunits += (length + blksize - 1) / blksize;
+    }
+
+    fp->units = calloc(nunits? nunits : 1, sizeof (unit));
+    if (fp->units == NULL) return -1;
+
+    for (i = 0; i < n; i++) {
+        off_t offset;
+        for (offset = ranges->ranges[i].begin; offset < ranges->ranges[i].end;
+             offset += blksize) {
+            unit *u = &fp->units[fp->nunits++];
+            off_t remaining = ranges->ranges[i].end - offset;
+            u->offset = offset;
+            u->length = (remaining < (off_t) blksize)? remaining : blksize;
+            u->data = NULL;
+            u->state = PENDING;
+        }
+    }
+
+    return 0;
+}
+
+// Opens URL (given, or found alongside DATAURL) and adds the byte ranges
+// of REGIONS to RANGES.
+static int resolve_ranges(const char *url, const char *dataurl, int cram,
+                          const ref_names *refs, const region_list *regions,
+                          range_list *ranges)
+{
+    static const char *const bam_suffixes[] = { ".csi", ".bai", NULL };
+    static const char *const cram_suffixes[] = { ".crai", NULL };
+    const char *const *suffix = cram? cram_suffixes : bam_suffixes;
+    char *name = NULL, *wanted = NULL;
+    hFILE *fp = NULL;
+    gz_reader gz;
+    int opened = 0, ret = -1, save;
+    size_t i;
+
+    bin_index bins;
+    crai_index crai;
+    memset(&bins, 0, sizeof bins);
+    memset(&crai, 0, sizeof crai);
+
+    if (url) fp = hopen(url, "r");
+    else {
+        size_t length = strlen(dataurl);
+        name = malloc(length + 6);
+        if (name == NULL) goto error;
+
+        for (; *suffix && fp == NULL; suffix++) {
+            sprintf(name, "%s%s", dataurl, *suffix);
+            fp = hopen(name, "r");
+        }
+
+        // Also try replacing a ".bam" extension, as in "file.bai".
+        if (fp == NULL && ! cram && length > 4 &&
+            strcmp(&dataurl[length - 4], ".bam") == 0) {
+            sprintf(name, "%.*s.bai", (int) (length - 4), dataurl);
+            fp = hopen(name, "r");
+        }
+        url = name;
+    }
+    if (fp == NULL) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_regions] can't open index for \"%s\"\n",
+                    dataurl);
+        goto error;
+    }
+
+    if (gz_open(&gz, fp) < 0) goto error;
+    opened = 1;
+
+    const unsigned char *magic = NULL;
+    if (gz_fill(&gz, 4) >= 4) magic = &gz.out.data[gz.pos];
+
+    if (magic && (memcmp(magic, "BAI\1", 4) == 0 ||
+                  memcmp(magic, "CSI\1", 4) == 0)) {
+        int csi = (magic[0] == 'C');
+        wanted = calloc(refs->nref? refs->nref : 1, 1);
+        if (wanted == NULL) goto error;
+        for (i = 0; i < regions->n; i++) wanted[regions->regions[i].tid] = 1;
+
+        gz.pos += 4;
+        if (read_bin_index(&gz, csi, wanted, refs->nref, &bins) < 0)
+            goto error;
+        for (i = 0; i < regions->n; i++)
+            if (query_bins(&bins, &regions->regions[i], ranges) < 0)
+                goto error;
+    }
+    else {
+        if (read_crai(&gz, &crai) < 0) goto error;
+        for (i = 0; i < regions->n; i++)
+            if (query_crai(&crai, &regions->regions[i], ranges) < 0)
+                goto error;
+    }
+
+    ret = 0;
+
+error:
+    save = errno;
+    if (ret < 0 && errno == EINVAL && hts_verbose >= 2)
+        fprintf(stderr, "[E::hfile_regions] invalid index \"%s\"\n", url);
+    if (opened) gz_close(&gz);
+    if (fp && hclose(fp) < 0 && ret == 0) { save = errno; ret = -1; }
+    free_bin_index(&bins);
+    free(crai.entries);
+    free(wanted);
+    free(name);
+    errno = save;
+    return ret;
+}
+
+static char *field_string(const char *field, size_t length)
+{
+    char *s = malloc(length + 1);
+    if (s == NULL) return NULL;
+    memcpy(s, field, length);
+    s[length] = '\0';
+    return s;
+}
+
+static hFILE *hopen_regions(const char *filename, const char *mode)
+{
+    hFILE_regions *fp = NULL;
+    char *url = NULL, *bedurl = NULL, *indexurl = NULL;
+    ref_names refs = { NULL, 0, 0 };
+    region_list regions = { NULL, 0, 0 };
+    range_list ranges = { NULL, 0, 0 };
+    unsigned char magic[4];
+    int cram, save, ret;
+
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_RDONLY)
+        { errno = EINVAL; goto error; }
+
+    // regions:URL#BED[#INDEX]
+    const char *spec = filename + 8;  // Skip "regions:"
+    const char *hash = strchr(spec, '#');
+    if (hash == NULL) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_regions] no BED file specified in "
+                    "\"%s\"\n", filename);
+        errno = EINVAL;
+        goto error;
+    }
+    const char *hash2 = strchr(hash + 1, '#');
+
+    url = field_string(spec, hash - spec);
+    bedurl = hash2? field_string(hash + 1, hash2 - (hash + 1))
+                  : strdup(hash + 1);
+    indexurl = hash2? strdup(hash2 + 1) : NULL;
+    if (url == NULL || bedurl == NULL || (hash2 && indexurl == NULL))
+        goto error;
+
+    fp = (hFILE_regions *) hfile_init(sizeof (hFILE_regions), mode, 0);
+    if (fp == NULL) goto error;
+
+    fp->units = NULL;
+    fp->nunits = 0;
+    fp->rawfp = hopen(url, mode);
+    if (fp->rawfp == NULL) goto error;
+
+    fp->size = hseek(fp->rawfp, 0, SEEK_END);
+    if (fp->size < 0 || hseek(fp->rawfp, 0, SEEK_SET) < 0) goto error;
+
+    if (hpeek(fp->rawfp, magic, 4) != 4) { errno = EINVAL; goto error; }
+    cram = (memcmp(magic, "CRAM", 4) == 0);
+    if (cram) ret = read_cram_names(fp->rawfp, &refs);
+    else ret = read_bam_names(fp->rawfp, &refs);
+    if (ret < 0) {
+        if (errno == EINVAL && hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_regions] \"%s\" is not a valid BAM or "
+                    "CRAM file\n", url);
+        goto error;
+    }
+    qsort(refs.names, refs.nref, sizeof (ref_name), compare_names);
+
+    if (read_bed(bedurl, &refs, &regions) < 0) goto error;
+    if (resolve_ranges(indexurl, url, cram, &refs, &regions, &ranges) < 0)
+        goto error;
+
+    if (make_units(fp, &ranges,
+                   hfile_env_size("HTS_REGIONS_BLOCK_SIZE", 1048576)) < 0)
+        goto error;
+
+    if (hts_verbose >= 4) {
+        off_t total = 0;
+        size_t i;
+        for (i = 0; i < ranges.n; i++)
+            total += ranges.ranges[i].end - ranges.ranges[i].begin;
+        fprintf(stderr, "[M::hfile_regions] %zu regions from \"%s\" resolved "
+                "to %zu ranges totalling %lld bytes\n", regions.n, bedurl,
+                ranges.n, (long long) total);
+    }
+
+    fp->raw_read_at = (hfile_read_at(fp->rawfp, 0, NULL, 0) == 0);
+    fp->memory_limit = hfile_env_size("HTS_REGIONS_MEMORY", 64 * 1048576);
+    fp->pos = 0;
+    fp->next = fp->consumed = fp->memory = 0;
+    fp->hits = fp->misses = 0;
+    fp->stop = 0;
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+    pthread_mutex_init(&fp->raw_lock, NULL);
+    ret = pthread_create(&fp->worker, NULL, worker, fp);
+    if (ret != 0) {
+        pthread_mutex_destroy(&fp->lock);
+        pthread_cond_destroy(&fp->cond);
+        pthread_mutex_destroy(&fp->raw_lock);
+        errno = ret;
+        goto error;
+    }
+
+    free_names(&refs);
+    free(regions.regions);
+    free(ranges.ranges);
+    free(url);
+    free(bedurl);
+    free(indexurl);
+    fp->base.backend = &regions_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp) {
+        if (fp->rawfp) hclose_abruptly(fp->rawfp);
+        destroy_units(fp);
+        hfile_destroy((hFILE *) fp);
+    }
+    free_names(&refs);
+    free(regions.regions);
+    free(ranges.ranges);
+    free(url);
+    free(bedurl);
+    free(indexurl);
+    errno = save;
+    return NULL;
+}
+
+static int regions_isremote(const char *filename)
+{
+    const char *spec = filename + 8;  // Skip "regions:"
+    const char *hash = strchr(spec, '#');
+    char *url = field_string(spec, hash? hash - spec : strlen(spec));
+    int ret = url? hisremote(url) : 0;
+    free(url);
+    return ret;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_regions, regions_isremote, "regions", 50 };
+
+    self->name = "regions";
+    hfile_add_scheme_handler("regions", &handler);
+    return 0;
+}
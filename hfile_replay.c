@@ -0,0 +1,458 @@
+/*  hfile_replay.c -- Replay I/O traces recorded by hfile_trace.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "htslib/hfile.h"
+#include "hfile_trace.h"
+
+typedef struct {
+    hts_trace_record rec;
+    const char *url;  // For HTS_TRACE_OPEN records
+    size_t index;
+} event;
+
+typedef struct {
+    uint64_t count, errors, bytes;
+    uint64_t *latency;
+    size_t nlatency, maxlatency;
+} op_stats;
+
+static const char *op_name[] =
+    { "", "open", "read", "write", "seek", "flush", "close" };
+
+#define NOPS (sizeof op_name / sizeof op_name[0])
+
+static struct {
+    const char *url;
+    char **from, **to;
+    int nrewrite;
+    int think, writes;
+    double scale;
+} opt;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t target)
+{
+    uint64_t t = now();
+    if (t < target) {
+        struct timespec ts;
+        ts.tv_sec  = (target - t) / 1000000000;
+        ts.tv_nsec = (target - t) % 1000000000;
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+    }
+}
+
+static int cmp_event(const void *av, const void *bv)
+{
+    const event *a = (const event *) av, *b = (const event *) bv;
+    if (a->rec.time != b->rec.time) return (a->rec.time < b->rec.time)? -1 : 1;
+    return (a->index < b->index)? -1 : (a->index > b->index);
+}
+
+static int cmp_u64(const void *av, const void *bv)
+{
+    uint64_t a = *(const uint64_t *) av, b = *(const uint64_t *) bv;
+    return (a < b)? -1 : (a > b);
+}
+
+static char *read_file(const char *fname, size_t *lenp)
+{
+    FILE *f = fopen(fname, "rb");
+    char *data = NULL;
+    size_t len = 0, size = 0, n;
+    if (f == NULL) return NULL;
+
+    do {
+        if (len == size) {
+            char *newdata = realloc(data, size = size? 2 * size : 1048576);
+            if (newdata == NULL) { free(data); fclose(f); return NULL; }
+            data = newdata;
+        }
+        n = fread(&data[len], 1, size - len, f);
+        len += n;
+    } while (n > 0);
+
+    if (ferror(f)) { free(data); fclose(f); return NULL; }
+    fclose(f);
+    *lenp = len;
+    return data;
+}
+
+// Parses the trace into EVENTS, sorted into time order.
+static event *parse_trace(char *data, size_t len, size_t *neventsp)
+{
+    hts_trace_header hdr;
+    event *events = NULL;
+    size_t nevents = 0, maxevents = 0, pos;
+
+    if (len < sizeof hdr) goto invalid;
+    memcpy(&hdr, data, sizeof hdr);
+    if (memcmp(hdr.magic, HTS_TRACE_MAGIC, sizeof hdr.magic) != 0 ||
+        hdr.version != HTS_TRACE_VERSION ||
+        hdr.record_size < sizeof (hts_trace_record)) goto invalid;
+
+    for (pos = sizeof hdr; pos + hdr.record_size <= len; ) {
+        if (nevents == maxevents) {
+            maxevents = maxevents? 2 * maxevents : 4096;
+            event *newevents = realloc(events, maxevents * sizeof (event));
+            if (newevents == NULL) { free(events); return NULL; }
+            events = newevents;
+        }
+
+        event *e = &events[nevents];
+        memcpy(&e->rec, &data[pos], sizeof e->rec);
+        e->index = nevents;
+        e->url = NULL;
+        pos += hdr.record_size;
+        if (e->rec.op == 0 || e->rec.op >= NOPS) goto invalid;
+
+        if (e->rec.op == HTS_TRACE_OPEN) {
+            size_t padded = (e->rec.length + 7) & ~(uint64_t) 7;
+            if (e->rec.length > len - pos || padded > len - pos) goto invalid;
+            // Reuse the padding (or the following byte) as a terminator.
+            if (padded == e->rec.length) {
+                memmove(&data[pos - 1], &data[pos], e->rec.length);
+                data[pos - 1 + e->rec.length] = '\0';
+                e->url = &data[pos - 1];
+            }
+            else {
+                data[pos + e->rec.length] = '\0';
+                e->url = &data[pos];
+            }
+            pos += padded;
+        }
+
+        nevents++;
+    }
+
+    qsort(events, nevents, sizeof (event), cmp_event);
+    *neventsp = nevents;
+    return events;
+
+invalid:
+    fprintf(stderr, "hfile_replay: invalid or corrupt trace file\n");
+    free(events);
+    errno = EINVAL;
+    return NULL;
+}
+
+static char *rewrite_url(const char *url)
+{
+    int i;
+    if (opt.url) return strdup(opt.url);
+
+    for (i = 0; i < opt.nrewrite; i++) {
+        size_t fromlen = strlen(opt.from[i]);
+        if (strncmp(url, opt.from[i], fromlen) == 0) {
+            char *s = malloc(strlen(opt.to[i]) + strlen(url) - fromlen + 1);
+            if (s) sprintf(s, "%s%s", opt.to[i], &url[fromlen]);
+            return s;
+        }
+    }
+
+    return strdup(url);
+}
+
+static const char *open_mode(int64_t flags)
+{
+    switch (flags & O_ACCMODE) {
+    case O_RDONLY: return "r";
+    case O_WRONLY: return (flags & O_APPEND)? "a" : "w";
+    default:       return "r+";
+    }
+}
+
+static int record(op_stats *s, uint64_t latency, int64_t bytes, int failed)
+{
+    if (s->nlatency == s->maxlatency) {
+        size_t n = s->maxlatency? 2 * s->maxlatency : 1024;
+        uint64_t *latency = realloc(s->latency, n * sizeof (uint64_t));
+        if (latency == NULL) return -1;
+        s->latency = latency;
+        s->maxlatency = n;
+    }
+
+    s->latency[s->nlatency++] = latency;
+    s->count++;
+    if (failed) s->errors++;
+    else if (bytes > 0) s->bytes += bytes;
+    return 0;
+}
+
+// Reports the number of read and write system calls made so far, where the
+// platform provides them.
+static void syscall_counts(long long *reads, long long *writes)
+{
+    FILE *f = fopen("/proc/self/io", "r");
+    char line[256];
+
+    *reads = *writes = -1;
+    if (f == NULL) return;
+    while (fgets(line, sizeof line, f)) {
+        sscanf(line, "syscr: %lld", reads);
+        sscanf(line, "syscw: %lld", writes);
+    }
+    fclose(f);
+}
+
+static void report(op_stats *stats, uint64_t elapsed, long long sysr,
+                   long long sysw, uint64_t skipped)
+{
+    double seconds = elapsed / 1e9;
+    unsigned i;
+
+    printf("elapsed_s\t%.6f\n", seconds);
+    printf("read_bytes\t%llu\n", (unsigned long long) stats[HTS_TRACE_READ].bytes);
+    printf("read_MBps\t%.3f\n", (seconds > 0)? stats[HTS_TRACE_READ].bytes / seconds / 1e6 : 0.0);
+    printf("write_bytes\t%llu\n", (unsigned long long) stats[HTS_TRACE_WRITE].bytes);
+    printf("write_MBps\t%.3f\n", (seconds > 0)? stats[HTS_TRACE_WRITE].bytes / seconds / 1e6 : 0.0);
+    if (sysr >= 0) printf("read_syscalls\t%lld\n", sysr);
+    if (sysw >= 0) printf("write_syscalls\t%lld\n", sysw);
+    printf("skipped\t%llu\n", (unsigned long long) skipped);
+
+    printf("op\tcount\terrors\tbytes\tmean_us\tp50_us\tp90_us\tp99_us\tp999_us\tmax_us\n");
+    for (i = 1; i < NOPS; i++) {
+        op_stats *s = &stats[i];
+        static const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+        double sum = 0;
+        size_t j;
+
+        if (s->count == 0) continue;
+        qsort(s->latency, s->nlatency, sizeof (uint64_t), cmp_u64);
+        for (j = 0; j < s->nlatency; j++) sum += s->latency[j];
+
+        printf("%s\t%llu\t%llu\t%llu\t%.1f", op_name[i],
+               (unsigned long long) s->count, (unsigned long long) s->errors,
+               (unsigned long long) s->bytes, sum / s->nlatency / 1e3);
+        for (j = 0; j < sizeof q / sizeof q[0]; j++) {
+            size_t k = q[j] * s->nlatency;
+            if (k >= s->nlatency) k = s->nlatency - 1;
+            printf("\t%.1f", s->latency[k] / 1e3);
+        }
+        printf("\t%.1f\n", s->latency[s->nlatency - 1] / 1e3);
+    }
+}
+
+static int replay(event *events, size_t nevents)
+{
+    op_stats stats[NOPS];
+    hFILE **handles = NULL;
+    size_t nhandles = 0, i;
+    char *buffer = NULL;
+    size_t buflen = 0;
+    uint64_t skipped = 0, start, prev_end;
+    long long sysr0, sysw0, sysr1, sysw1;
+    int ret = EXIT_SUCCESS;
+
+    memset(stats, 0, sizeof stats);
+
+    for (i = 0; i < nevents; i++) {
+        if (events[i].rec.handle >= nhandles) nhandles = events[i].rec.handle + 1;
+        if ((events[i].rec.op == HTS_TRACE_READ ||
+             events[i].rec.op == HTS_TRACE_WRITE) && events[i].rec.length > buflen)
+            buflen = events[i].rec.length;
+    }
+
+    handles = calloc(nhandles? nhandles : 1, sizeof (hFILE *));
+    buffer = calloc(buflen? buflen : 1, 1);
+    if (handles == NULL || buffer == NULL) {
+        fprintf(stderr, "hfile_replay: out of memory\n");
+        free(handles);
+        free(buffer);
+        return EXIT_FAILURE;
+    }
+
+    syscall_counts(&sysr0, &sysw0);
+    start = prev_end = now();
+
+    for (i = 0; i < nevents; i++) {
+        const hts_trace_record *r = &events[i].rec;
+        hFILE **fpp = &handles[r->handle];
+        uint64_t t0, t1;
+        int64_t result = 0;
+        int failed = 0;
+
+        // Only the recorded gap between the previous operation's completion
+        // and this one's start is reproduced, timed from when the previous
+        // operation completed here, so that the backend's own latency sets
+        // the pace.  Operations that overlapped in the trace have no gap.
+        if (opt.think && i > 0) {
+            const hts_trace_record *prev = &events[i-1].rec;
+            uint64_t prev_done = prev->time + prev->latency;
+            if (r->time > prev_done)
+                sleep_until(prev_end + (r->time - prev_done) / opt.scale);
+        }
+
+        if (r->op == HTS_TRACE_OPEN) {
+            const char *mode = open_mode(r->result);
+            char *url;
+            if (r->result < 0 || *fpp || (mode[0] != 'r' && !opt.writes)) {
+                skipped++;
+                prev_end = now();
+                continue;
+            }
+
+            url = rewrite_url(events[i].url);
+            if (url == NULL) { ret = EXIT_FAILURE; break; }
+            t0 = now();
+            *fpp = hopen(url, mode);
+            if (*fpp == NULL) {
+                fprintf(stderr, "hfile_replay: can't open \"%s\": %s\n",
+                        url, strerror(errno));
+                failed = 1;
+            }
+            free(url);
+        }
+        else if (*fpp == NULL || (r->op == HTS_TRACE_WRITE && !opt.writes)) {
+            skipped++;
+            prev_end = now();
+            continue;
+        }
+        else {
+            t0 = now();
+            switch (r->op) {
+            case HTS_TRACE_READ:
+                result = hread(*fpp, buffer, r->length);
+                break;
+            case HTS_TRACE_WRITE:
+                result = hwrite(*fpp, buffer, r->length);
+                break;
+            case HTS_TRACE_SEEK:
+                result = hseek(*fpp, r->offset, r->length);
+                break;
+            case HTS_TRACE_FLUSH:
+                result = hflush(*fpp);
+                break;
+            case HTS_TRACE_CLOSE:
+                result = hclose(*fpp);
+                *fpp = NULL;
+                break;
+            }
+            failed = (result < 0);
+        }
+
+        if (r->op != HTS_TRACE_READ && r->op != HTS_TRACE_WRITE) result = 0;
+        t1 = now();
+        prev_end = t1;
+        if (record(&stats[r->op], t1 - t0, result, failed) < 0) {
+            fprintf(stderr, "hfile_replay: out of memory\n");
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    for (i = 0; i < nhandles; i++)
+        if (handles[i] && hclose(handles[i]) < 0) ret = EXIT_FAILURE;
+
+    uint64_t elapsed = now() - start;
+    syscall_counts(&sysr1, &sysw1);
+    report(stats, elapsed, (sysr0 >= 0)? sysr1 - sysr0 : -1,
+           (sysw0 >= 0)? sysw1 - sysw0 : -1, skipped);
+
+    for (i = 0; i < NOPS; i++) free(stats[i].latency);
+    free(handles);
+    free(buffer);
+    return ret;
+}
+
+static void usage(FILE *fp)
+{
+    fprintf(fp,
+"Usage: hfile_replay [OPTION]... TRACE\n"
+"Replay the I/O operations recorded by hfile_trace in TRACE.\n"
+"\n"
+"  -r FROM=TO  Open URLs starting with FROM with TO instead (may be repeated)\n"
+"  -s FACTOR   With -t, divide the recorded think time by FACTOR [1]\n"
+"  -t          Wait for the recorded think time (the gap between one\n"
+"              operation completing and the next starting) before each\n"
+"              operation; by default, operations are issued back to back\n"
+"  -u URL      Open URL in place of each traced URL\n"
+"  -w          Also replay writes (overwriting the opened files)\n");
+}
+
+int main(int argc, char **argv)
+{
+    char *data;
+    event *events;
+    size_t len, nevents;
+    int c, ret;
+
+    opt.scale = 1.0;
+    while ((c = getopt(argc, argv, "r:s:tu:wh")) >= 0)
+        switch (c) {
+        case 'r': {
+            char *eq = strchr(optarg, '=');
+            if (eq == NULL) { usage(stderr); return EXIT_FAILURE; }
+            *eq = '\0';
+            opt.from = realloc(opt.from, (opt.nrewrite + 1) * sizeof (char *));
+            opt.to = realloc(opt.to, (opt.nrewrite + 1) * sizeof (char *));
+            if (opt.from == NULL || opt.to == NULL) return EXIT_FAILURE;
+            opt.from[opt.nrewrite] = optarg;
+            opt.to[opt.nrewrite] = eq + 1;
+            opt.nrewrite++;
+            break;
+            }
+        case 's':
+            opt.scale = strtod(optarg, NULL);
+            if (opt.scale <= 0) { usage(stderr); return EXIT_FAILURE; }
+            break;
+        case 't': opt.think = 1; break;
+        case 'u': opt.url = optarg; break;
+        case 'w': opt.writes = 1; break;
+        case 'h': usage(stdout); return EXIT_SUCCESS;
+        default:  usage(stderr); return EXIT_FAILURE;
+        }
+
+    if (argc - optind != 1) { usage(stderr); return EXIT_FAILURE; }
+
+    data = read_file(argv[optind], &len);
+    if (data == NULL) {
+        fprintf(stderr, "hfile_replay: can't read \"%s\": %s\n",
+                argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    events = parse_trace(data, len, &nevents);
+    if (events == NULL) { free(data); return EXIT_FAILURE; }
+
+    ret = (nevents > 0)? replay(events, nevents) : EXIT_SUCCESS;
+
+    free(events);
+    free(data);
+    free(opt.from);
+    free(opt.to);
+    return ret;
+}
@@ -0,0 +1,496 @@
+/*  hfile_shm.c -- Shared-memory cached local file backend for low-level
+    file streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_layout.h"
+
+// Each cached file is held in a segment consisting of a header page followed
+// by the file's contents.  Segments are listed in a per-user index segment,
+// which records their sizes and recency of use for LRU eviction.
+
+#define SEGMENT_MAGIC 0x4d48534d53544801ULL
+#define INDEX_MAGIC   0x584449534d544801ULL
+#define HEADER_SIZE   4096
+#define INDEX_ENTRIES 1024
+#define NAME_LENGTH   48
+
+typedef struct {
+    uint64_t magic;
+    uint64_t size;
+    uint32_t ready;
+} shm_header;
+
+typedef struct {
+    char name[NAME_LENGTH];
+    uint64_t bytes, last_used;
+    int32_t loader;
+} shm_index_entry;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t total, clock;
+    shm_index_entry entry[INDEX_ENTRIES];
+} shm_index;
+
+typedef struct {
+    hFILE base;
+    char *mapping, *data;
+    size_t maplen, length, pos;
+} hFILE_shm;
+
+static ssize_t shm_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_shm *fp = (hFILE_shm *) fpv;
+    size_t avail = fp->length - fp->pos;
+    if (nbytes > avail) nbytes = avail;
+    memcpy(buffer, fp->data + fp->pos, nbytes);
+    fp->pos += nbytes;
+    return nbytes;
+}
+
+static ssize_t shm_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    errno = EROFS;
+    return -1;
+}
+
+static off_t shm_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_shm *fp = (hFILE_shm *) fpv;
+    size_t absoffset = (offset >= 0)? offset : -offset;
+    size_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->length; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if ((offset  < 0 && absoffset > origin) ||
+        (offset >= 0 && absoffset > fp->length - origin)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static int shm_close(hFILE *fpv)
+{
+    hFILE_shm *fp = (hFILE_shm *) fpv;
+    if (fp->mapping && munmap(fp->mapping, fp->maplen) < 0) return -1;
+    return 0;
+}
+
+static const struct hFILE_backend shm_backend =
+{
+    shm_read, shm_write, shm_seek, NULL, shm_close
+};
+
+// Segments are POSIX shared memory objects, or files in a hugetlbfs
+// directory if $HTS_SHM_HUGETLBFS is set.
+
+static int segment_open(const char *name, int flags)
+{
+    const char *dir = getenv("HTS_SHM_HUGETLBFS");
+    if (dir && *dir) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s%s", dir, name);
+        return open(path, flags, 0600);
+    }
+    else return shm_open(name, flags, 0600);
+}
+
+static void segment_unlink(const char *name)
+{
+    const char *dir = getenv("HTS_SHM_HUGETLBFS");
+    if (dir && *dir) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s%s", dir, name);
+        (void) unlink(path);
+    }
+    else (void) shm_unlink(name);
+}
+
+// Returns the size of a segment holding SIZE bytes of data, rounded up
+// to a multiple of the hugetlbfs page size where applicable.
+static size_t segment_size(size_t size)
+{
+    const char *dir = getenv("HTS_SHM_HUGETLBFS");
+    size_t total = HEADER_SIZE + size, page = HEADER_SIZE;
+    struct statvfs fs;
+
+    if (dir && *dir && statvfs(dir, &fs) == 0 && fs.f_bsize > page)
+        page = fs.f_bsize;
+    return (total + page - 1) / page * page;
+}
+
+static void segment_name(char *name, size_t namelen,
+                         const char *filename, const struct stat *st)
+{
+    char path[PATH_MAX];
+    uint64_t key[5], hash = 0xcbf29ce484222325ULL;  // FNV-1a
+    const unsigned char *s;
+    size_t i;
+
+    if (realpath(filename, path) == NULL) snprintf(path, sizeof path, "%s", filename);
+    for (s = (const unsigned char *) path; *s; s++)
+        hash = (hash ^ *s) * 0x100000001b3ULL;
+
+    key[0] = st->st_dev;
+    key[1] = st->st_ino;
+    key[2] = st->st_size;
+    key[3] = st->st_mtime;
+#if defined __APPLE__
+    key[4] = st->st_mtimespec.tv_nsec;
+#else
+    key[4] = st->st_mtim.tv_nsec;
+#endif
+    for (s = (const unsigned char *) key, i = 0; i < sizeof key; i++)
+        hash = (hash ^ s[i]) * 0x100000001b3ULL;
+
+    snprintf(name, namelen, "/hts-shm-%lu-%016llx",
+             (unsigned long) geteuid(), (unsigned long long) hash);
+}
+
+// Opens, creating if necessary, and locks this user's index.
+static shm_index *index_lock(int *fdp)
+{
+    char name[64];
+    shm_index *idx;
+    struct stat st;
+    int fd;
+
+    snprintf(name, sizeof name, "/hts-shm-%lu-index", (unsigned long) geteuid());
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return NULL;
+    if (flock(fd, LOCK_EX) < 0) goto error;
+    if (fstat(fd, &st) < 0) goto error;
+    if (st.st_size < (off_t) sizeof (shm_index) &&
+        ftruncate(fd, sizeof (shm_index)) < 0) goto error;
+
+    idx = mmap(NULL, sizeof (shm_index), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (idx == MAP_FAILED) goto error;
+
+    if (idx->magic != INDEX_MAGIC) {
+        memset(idx, 0, sizeof (shm_index));
+        idx->magic = INDEX_MAGIC;
+    }
+
+    *fdp = fd;
+    return idx;
+
+error:
+    (void) close(fd);
+    return NULL;
+}
+
+static void index_unlock(shm_index *idx, int fd)
+{
+    (void) munmap(idx, sizeof (shm_index));
+    (void) close(fd);  // Also releases the lock
+}
+
+static shm_index_entry *index_find(shm_index *idx, const char *name)
+{
+    int i;
+    for (i = 0; i < INDEX_ENTRIES; i++)
+        if (strcmp(idx->entry[i].name, name) == 0) return &idx->entry[i];
+    return NULL;
+}
+
+// Returns whether the entry's segment is being loaded by a live process.
+static int loading(const shm_index_entry *e)
+{
+    return e->loader > 0 && (kill(e->loader, 0) == 0 || errno != ESRCH);
+}
+
+static void index_remove(shm_index *idx, shm_index_entry *e)
+{
+    segment_unlink(e->name);
+    idx->total -= e->bytes;
+    memset(e, 0, sizeof *e);
+}
+
+// Evicts least recently used segments until BYTES more will fit within the
+// budget, and returns an unused entry.  Processes that have already mapped
+// an evicted segment continue to use it until they unmap it.  Segments that
+// are still being loaded are not evicted.
+static shm_index_entry *index_make_room(shm_index *idx, uint64_t bytes,
+                                        uint64_t budget)
+{
+    for (;;) {
+        shm_index_entry *lru = NULL, *unused = NULL;
+        int i;
+        for (i = 0; i < INDEX_ENTRIES; i++) {
+            shm_index_entry *e = &idx->entry[i];
+            if (e->name[0] == '\0') { if (! unused) unused = e; }
+            else if (loading(e)) continue;
+            else if (! lru || e->last_used < lru->last_used) lru = e;
+        }
+
+        if (unused && idx->total + bytes <= budget) return unused;
+        if (lru == NULL) return NULL;
+
+        if (hts_verbose >= 5)
+            fprintf(stderr, "[M::hfile_shm] evicting %s (%llu bytes)\n",
+                    lru->name, (unsigned long long) lru->bytes);
+        index_remove(idx, lru);
+    }
+}
+
+// Maps an existing segment read-only.  Returns 1 if it is ready for use,
+// 0 if it is still being loaded, or -1 if it is unusable.
+static int map_segment(const char *name, size_t size,
+                       char **mappingp, size_t *maplenp)
+{
+    size_t maplen = segment_size(size);
+    struct stat st;
+    int fd = segment_open(name, O_RDONLY);
+    if (fd < 0) return -1;
+
+    // Only trust segments created by this user at the expected size.
+    if (fstat(fd, &st) < 0 || st.st_uid != geteuid() ||
+        st.st_size != (off_t) maplen) { (void) close(fd); return -1; }
+
+    char *mapping = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (mapping == MAP_FAILED) return -1;
+
+    const shm_header *hdr = (const shm_header *) mapping;
+    if (hdr->magic != SEGMENT_MAGIC || hdr->size != size ||
+        ! __atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE)) {
+        int loading = (hdr->magic == SEGMENT_MAGIC && hdr->size == size);
+        (void) munmap(mapping, maplen);
+        return loading? 0 : -1;
+    }
+
+    *mappingp = mapping;
+    *maplenp = maplen;
+    return 1;
+}
+
+// Creates a segment and loads the file's contents into it.
+static int load_segment(const char *name, int filefd, size_t size,
+                        const hfile_layout *layout,
+                        char **mappingp, size_t *maplenp)
+{
+    size_t maplen = segment_size(size);
+    char *mapping = MAP_FAILED;
+    int fd;
+
+    // The caller has registered this segment in the index, so no other
+    // process is loading it and any existing one is stale.
+    fd = segment_open(name, O_RDWR | O_CREAT | O_EXCL);
+    if (fd < 0 && errno == EEXIST) {
+        // Left over from an index that has since been reset.
+        segment_unlink(name);
+        fd = segment_open(name, O_RDWR | O_CREAT | O_EXCL);
+    }
+    if (fd < 0) return -1;
+
+    if (ftruncate(fd, maplen) < 0) goto error;
+    mapping = mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) goto error;
+
+    // Identify the segment at once, so that other processes see that it is
+    // being loaded; only the ready flag is published once it is complete.
+    shm_header *hdr = (shm_header *) mapping;
+    hdr->size = size;
+    hdr->magic = SEGMENT_MAGIC;
+
+    // Read with pread() rather than copying from a mapping of the file,
+    // as hugetlbfs segments can only be filled via memory.  Striped files
+    // are read from all their servers at once.
+    ssize_t n = hfile_layout_pread(filefd, mapping + HEADER_SIZE, size, 0,
+                                   layout);
+    if (n < 0) goto error;
+    else if ((size_t) n < size) { errno = EIO; goto error; }
+
+    __atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+    if (mprotect(mapping, maplen, PROT_READ) < 0) goto error;
+
+    (void) close(fd);
+    *mappingp = mapping;
+    *maplenp = maplen;
+    return 0;
+
+error:
+    if (mapping != MAP_FAILED) (void) munmap(mapping, maplen);
+    (void) close(fd);
+    segment_unlink(name);
+    return -1;
+}
+
+// Attaches to (or creates) the segment caching the given file.
+// Returns 0 on success, or -1 if the file should be accessed directly.
+static int attach(const char *filename, int filefd, const struct stat *st,
+                  char **mappingp, size_t *maplenp)
+{
+    uint64_t budget = hfile_env_size("HTS_SHM_BUDGET", (size_t) 4 << 30);
+    size_t size = st->st_size;
+    char name[NAME_LENGTH];
+    shm_index *idx;
+    shm_index_entry *e;
+    hfile_layout layout;
+    int idxfd, ret;
+
+    segment_name(name, sizeof name, filename, st);
+
+    idx = index_lock(&idxfd);
+    if (idx == NULL) return -1;
+
+    e = index_find(idx, name);
+    if (e) {
+        ret = map_segment(name, size, mappingp, maplenp);
+        if (ret > 0) {
+            e->last_used = ++idx->clock;
+            index_unlock(idx, idxfd);
+            return 0;
+        }
+        else if (loading(e)) {
+            // Another process is loading it; don't wait, just bypass.
+            index_unlock(idx, idxfd);
+            return -1;
+        }
+
+        // Missing, or abandoned by a process that died while loading it.
+        index_remove(idx, e);
+    }
+
+    uint64_t bytes = segment_size(size);
+    if (bytes > budget || (e = index_make_room(idx, bytes, budget)) == NULL) {
+        index_unlock(idx, idxfd);
+        return -1;
+    }
+
+    // Register the segment before loading it (without holding the lock),
+    // so that other processes know not to load it too.
+    snprintf(e->name, sizeof e->name, "%s", name);
+    e->bytes = bytes;
+    e->last_used = ++idx->clock;
+    e->loader = getpid();
+    idx->total += bytes;
+    index_unlock(idx, idxfd);
+
+    if (hts_verbose >= 5)
+        fprintf(stderr, "[M::hfile_shm] loading \"%s\" into %s\n",
+                filename, name);
+
+    hfile_layout_get(filefd, filename, &layout);
+    ret = load_segment(name, filefd, size, &layout, mappingp, maplenp);
+
+    idx = index_lock(&idxfd);
+    if (idx) {
+        // Leave the entry alone if it has since been replaced.
+        e = index_find(idx, name);
+        if (e && e->loader == getpid()) {
+            if (ret < 0) index_remove(idx, e);
+            else e->loader = 0;
+        }
+        index_unlock(idx, idxfd);
+    }
+
+    if (ret < 0 && hts_verbose >= 4)
+        fprintf(stderr, "[W::hfile_shm] can't cache \"%s\": %s\n",
+                filename, strerror(errno));
+    return ret;
+}
+
+static hFILE *hopen_shm(const char *filename, const char *modestr)
+{
+    struct stat st;
+    int fd = -1;
+    hFILE_shm *fp = NULL;
+    char *mapping = NULL;
+    size_t maplen = 0, offset = 0;
+    int save;
+
+    if (strncmp(filename, "shm://localhost/", 16) == 0) filename += 15;
+    else if (strncmp(filename, "shm:///", 7) == 0) filename += 6;
+    else if (strncmp(filename, "shm:", 4) == 0) filename += 4;
+
+    if ((hfile_oflags(modestr) & O_ACCMODE) != O_RDONLY) { errno = EROFS; goto error; }
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) goto error;
+    if (fstat(fd, &st) < 0) goto error;
+
+    if (st.st_size > 0) {
+        if (S_ISREG(st.st_mode) && attach(filename, fd, &st, &mapping, &maplen) == 0)
+            offset = HEADER_SIZE;
+        else {
+            // Fall back to mapping the file itself.
+            maplen = st.st_size;
+            mapping = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) { mapping = NULL; goto error; }
+        }
+    }
+
+    fp = (hFILE_shm *) hfile_init(sizeof (hFILE_shm), modestr, st.st_blksize);
+    if (fp == NULL) goto error;
+
+    (void) close(fd);
+    fp->mapping = mapping;
+    fp->maplen = maplen;
+    fp->data = mapping? mapping + offset : NULL;
+    fp->length = st.st_size;
+    fp->pos = 0;
+    fp->base.backend = &shm_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (mapping) (void) munmap(mapping, maplen);
+    if (fd >= 0) (void) close(fd);
+    errno = save;
+    return NULL;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_shm, hfile_always_local, "shm", 10 };
+
+    self->name = "shm";
+    hfile_add_scheme_handler("shm", &handler);
+    return 0;
+}
@@ -0,0 +1,381 @@
+/*  hfile_shmring.c -- Shared-memory ring buffers between processes.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+/* shmring:NAME connects one process writing to one process reading via a
+   single-producer single-consumer ring buffer in a POSIX shared memory
+   segment, which whichever opens first creates.  Data is copied directly
+   into and out of the ring, and a process blocks (on a futex) only when the
+   ring is empty or full, so most reads and writes make no system calls.  */
+
+#define RING_MAGIC  0x474e4952534d4801ULL
+#define HEADER_SIZE 4096
+
+// The header occupies the first page, with the counters written by each side
+// on separate cache lines.  head and tail are the total bytes written and
+// read; data_seq and space_seq are incremented when they advance, and are
+// the futex words the reader and writer wait on respectively.
+typedef struct {
+    uint64_t magic, capacity;
+    uint32_t ready;
+    char pad0[44];
+
+    uint64_t head;
+    uint32_t data_seq, reader_waiting;
+    int32_t writer_pid;
+    uint32_t writer_closed;
+    char pad1[40];
+
+    uint64_t tail;
+    uint32_t space_seq, writer_waiting;
+    int32_t reader_pid;
+    uint32_t reader_closed;
+} ring_header;
+
+typedef struct {
+    hFILE base;
+    ring_header *hdr;
+    char *data;
+    size_t maplen;
+    uint64_t capacity;
+    int writing;
+    char name[NAME_MAX];
+} hFILE_shmring;
+
+static int futex_wait(uint32_t *addr, uint32_t value)
+{
+    // Time out periodically, so that the peer's exit is noticed.
+    struct timespec timeout = { 0, 200000000 };
+    return syscall(SYS_futex, addr, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline uint64_t load(uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+// Returns true if process PID has exited, including if it is a zombie.
+static int exited(pid_t pid)
+{
+    char path[64], stat[256], *s;
+    ssize_t n;
+    int fd, save = errno;
+
+    if (kill(pid, 0) < 0) { n = (errno == ESRCH); errno = save; return n; }
+
+    snprintf(path, sizeof path, "/proc/%ld/stat", (long) pid);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) { errno = save; return 0; }
+    n = read(fd, stat, sizeof stat - 1);
+    close(fd);
+    errno = save;
+    if (n <= 0) return 0;
+    stat[n] = '\0';
+
+    s = strrchr(stat, ')');  // The state follows the parenthesised name
+    return s && (s[2] == 'Z' || s[2] == 'X');
+}
+
+// Returns true if the peer has closed its end, or has exited without doing so.
+static int peer_gone(uint32_t *closed, int32_t *pid)
+{
+    if (__atomic_load_n(closed, __ATOMIC_ACQUIRE)) return 1;
+    pid_t p = __atomic_load_n(pid, __ATOMIC_ACQUIRE);
+    return p > 0 && exited(p);
+}
+
+static ssize_t shmring_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_shmring *fp = (hFILE_shmring *) fpv;
+    ring_header *hdr = fp->hdr;
+    uint64_t tail = hdr->tail, head;
+
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&hdr->data_seq, __ATOMIC_ACQUIRE);
+        head = load(&hdr->head);
+        if (head != tail) break;
+
+        if (peer_gone(&hdr->writer_closed, &hdr->writer_pid)) {
+            // Check again, as the writer may have written before closing.
+            if (load(&hdr->head) != tail) continue;
+            return 0;
+        }
+
+        __atomic_store_n(&hdr->reader_waiting, 1, __ATOMIC_SEQ_CST);
+        if (load(&hdr->head) == tail) futex_wait(&hdr->data_seq, seq);
+        __atomic_store_n(&hdr->reader_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    size_t avail = head - tail;
+    size_t offset = tail % fp->capacity;
+    if (nbytes > avail) nbytes = avail;
+    if (nbytes > fp->capacity - offset) nbytes = fp->capacity - offset;
+    memcpy(buffer, fp->data + offset, nbytes);
+
+    __atomic_store_n(&hdr->tail, tail + nbytes, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&hdr->space_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->writer_waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&hdr->space_seq);
+
+    return nbytes;
+}
+
+static ssize_t shmring_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    hFILE_shmring *fp = (hFILE_shmring *) fpv;
+    ring_header *hdr = fp->hdr;
+    uint64_t head = hdr->head, tail;
+
+    for (;;) {
+        if (peer_gone(&hdr->reader_closed, &hdr->reader_pid)) {
+            errno = EPIPE;
+            return -1;
+        }
+
+        uint32_t seq = __atomic_load_n(&hdr->space_seq, __ATOMIC_ACQUIRE);
+        tail = load(&hdr->tail);
+        if (head - tail < fp->capacity) break;
+
+        __atomic_store_n(&hdr->writer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (head - load(&hdr->tail) == fp->capacity)
+            futex_wait(&hdr->space_seq, seq);
+        __atomic_store_n(&hdr->writer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    size_t space = fp->capacity - (head - tail);
+    size_t offset = head % fp->capacity;
+    if (nbytes > space) nbytes = space;
+    if (nbytes > fp->capacity - offset) nbytes = fp->capacity - offset;
+    memcpy(fp->data + offset, buffer, nbytes);
+
+    __atomic_store_n(&hdr->head, head + nbytes, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&hdr->data_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->reader_waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&hdr->data_seq);
+
+    return nbytes;
+}
+
+static off_t shmring_seek(hFILE *fpv, off_t offset, int whence)
+{
+    errno = ESPIPE;
+    return -1;
+}
+
+static int shmring_close(hFILE *fpv)
+{
+    hFILE_shmring *fp = (hFILE_shmring *) fpv;
+    ring_header *hdr = fp->hdr;
+    int ret = 0;
+
+    if (fp->writing) {
+        __atomic_store_n(&hdr->writer_closed, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&hdr->data_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&hdr->data_seq);
+    }
+    else {
+        __atomic_store_n(&hdr->reader_closed, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&hdr->space_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&hdr->space_seq);
+    }
+
+    // The reader removes the segment.  (If the writer closes before the
+    // reader has opened it, the data written remains for the reader.)
+    if (! fp->writing) (void) shm_unlink(fp->name);
+
+    if (munmap(fp->hdr, fp->maplen) < 0) ret = -1;
+    return ret;
+}
+
+static const struct hFILE_backend shmring_backend =
+{
+    shmring_read, shmring_write, shmring_seek, NULL, shmring_close
+};
+
+// Maps the ring NAME, creating it if necessary.  Returns NULL on error.
+static ring_header *attach(const char *name, uint64_t capacity, size_t *maplen)
+{
+    ring_header *hdr;
+    struct stat st;
+    int fd, created = 0, tries;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        created = 1;
+        if (ftruncate(fd, HEADER_SIZE + capacity) < 0) goto error;
+    }
+    else if (errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) return NULL;
+
+        // Wait for the creator to set the size.
+        for (tries = 0; ; tries++) {
+            if (fstat(fd, &st) < 0) goto error;
+            if (st.st_size > HEADER_SIZE) break;
+            if (tries == 1000) { errno = ETIMEDOUT; goto error; }
+            usleep(1000);
+        }
+        capacity = st.st_size - HEADER_SIZE;
+    }
+    else return NULL;
+
+    *maplen = HEADER_SIZE + capacity;
+    hdr = mmap(NULL, *maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) goto error;
+    close(fd);
+
+    if (created) {
+        hdr->magic = RING_MAGIC;
+        hdr->capacity = capacity;
+        __atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+    }
+    else {
+        for (tries = 0; ! __atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE); tries++) {
+            if (tries == 1000) { errno = ETIMEDOUT; goto unmap; }
+            usleep(1000);
+        }
+        if (hdr->magic != RING_MAGIC || hdr->capacity != capacity) {
+            errno = EINVAL;
+            goto unmap;
+        }
+    }
+
+    return hdr;
+
+unmap:
+    munmap(hdr, *maplen);
+    return NULL;
+
+error:
+    {
+        int save = errno;
+        close(fd);
+        if (created) shm_unlink(name);
+        errno = save;
+    }
+    return NULL;
+}
+
+static hFILE *hopen_shmring(const char *filename, const char *mode)
+{
+    hFILE_shmring *fp = NULL;
+    int flags = hfile_oflags(mode), save, tries;
+    const char *name = filename + 8;  // Skip "shmring:"
+    uint64_t capacity;
+    size_t i, bufsize;
+
+    if ((flags & O_ACCMODE) == O_RDWR || *name == '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    capacity = hfile_env_size("HTS_SHMRING_SIZE", 67108864);
+    capacity = (capacity + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+    if (capacity < 65536) capacity = 65536;
+
+    // Transfers through the ring are in units of the hFILE buffer size.
+    bufsize = hfile_env_size("HTS_SHMRING_BLOCK_SIZE", 1048576);
+    if (bufsize > capacity / 4) bufsize = capacity / 4;
+
+    fp = (hFILE_shmring *) hfile_init(sizeof (hFILE_shmring), mode, bufsize);
+    if (fp == NULL) return NULL;
+
+    // Segment names are per-user, and may not contain further slashes.
+    snprintf(fp->name, sizeof fp->name, "/hts-shmring-%lu-%s",
+             (unsigned long) geteuid(), name);
+    for (i = 1; fp->name[i]; i++) if (fp->name[i] == '/') fp->name[i] = '_';
+
+    fp->writing = ((flags & O_ACCMODE) == O_WRONLY);
+
+    for (tries = 0; ; tries++) {
+        fp->hdr = attach(fp->name, capacity, &fp->maplen);
+        if (fp->hdr == NULL) goto error;
+
+        // Register as this end's process, unless another already has.
+        ring_header *hdr = fp->hdr;
+        int32_t *pid = fp->writing? &hdr->writer_pid : &hdr->reader_pid;
+        uint32_t *closed = fp->writing? &hdr->writer_closed
+                                      : &hdr->reader_closed;
+        int32_t none = 0;
+        if (__atomic_compare_exchange_n(pid, &none, (int32_t) getpid(), 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            break;
+
+        // If the previous process at this end has finished with the ring
+        // (or exited without closing it), it is stale, so replace it.
+        int stale = peer_gone(closed, pid);
+        munmap(fp->hdr, fp->maplen);
+        if (stale && tries == 0) { (void) shm_unlink(fp->name); continue; }
+
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_shmring] \"%s\" already has a %s\n",
+                    name, fp->writing? "writer" : "reader");
+        errno = EBUSY;
+        goto error;
+    }
+
+    fp->data = (char *) fp->hdr + HEADER_SIZE;
+    fp->capacity = fp->hdr->capacity;
+
+    fp->base.backend = &shmring_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_shmring, hfile_always_local, "shmring", 10 };
+
+    self->name = "shmring";
+    hfile_add_scheme_handler("shmring", &handler);
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*  hfile_slow.c -- Latency and bandwidth injecting wrapper backend for
+    emulating slow storage.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_ext.h"
+
+enum jitter_distribution { UNIFORM, NORMAL, EXPONENTIAL, PARETO };
+
+typedef struct {
+    double latency, jitter;  // in nanoseconds
+    double bandwidth;        // in bytes per second, or 0 for unlimited
+    enum jitter_distribution distribution;
+} slow_params;
+
+typedef struct {
+    hFILE base;
+    hFILE *rawfp;
+    slow_params params;
+    uint64_t state;  // Random number generator state
+} hFILE_slow;
+
+// Starting points for emulating typical storage; individual parameters
+// may be overridden by the environment.
+static const struct { const char *name; slow_params params; } profiles[] = {
+    { "nfs",   { 500e3, 200e3, 110e6, EXPONENTIAL } },
+    { "irods", { 5e6,   2e6,   50e6,  EXPONENTIAL } },
+    { "s3",    { 30e6,  20e6,  80e6,  PARETO } },
+    { "none",  { 0, 0, 0, UNIFORM } }
+};
+
+static const char *distributions[] =
+    { "uniform", "normal", "exponential", "pareto" };
+
+static uint64_t seed_counter;
+
+// Returns a uniform random number in (0,1), via xorshift64*.
+static double uniform(hFILE_slow *fp)
+{
+    fp->state ^= fp->state >> 12;
+    fp->state ^= fp->state << 25;
+    fp->state ^= fp->state >> 27;
+    return ((fp->state * 2685821657736338717ULL >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// Returns a jitter sample, with mean fp->params.jitter (or for the normal
+// distribution, mean 0 and that standard deviation).
+static double jitter(hFILE_slow *fp)
+{
+    double j = fp->params.jitter;
+    if (j <= 0) return 0;
+
+    switch (fp->params.distribution) {
+    case UNIFORM:
+        return 2 * j * uniform(fp);
+    case NORMAL:
+        // Box-Muller; may be negative, reducing the base latency
+        return j * sqrt(-2 * log(uniform(fp))) * cos(2 * M_PI * uniform(fp));
+    case EXPONENTIAL:
+        return -j * log(uniform(fp));
+    case PARETO:
+        // Lomax with shape 1.5, so with a heavy tail but a finite mean
+        return j / 2 * (pow(uniform(fp), -1 / 1.5) - 1);
+    }
+
+    return 0;
+}
+
+static void delay(hFILE_slow *fp, size_t nbytes)
+{
+    double ns = fp->params.latency + jitter(fp);
+    if (fp->params.bandwidth > 0) ns += nbytes * 1e9 / fp->params.bandwidth;
+
+    if (ns >= 1) {
+        struct timespec ts;
+        ts.tv_sec  = ns / 1e9;
+        ts.tv_nsec = ns - ts.tv_sec * 1e9;
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+    }
+}
+
+static ssize_t slow_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_slow *fp = (hFILE_slow *) fpv;
+    ssize_t n = hread(fp->rawfp, buffer, nbytes);
+    int save = errno;
+    delay(fp, (n > 0)? n : 0);
+    errno = save;
+    return n;
+}
+
+static ssize_t slow_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    hFILE_slow *fp = (hFILE_slow *) fpv;
+    delay(fp, nbytes);
+    return hwrite(fp->rawfp, buffer, nbytes);
+}
+
+static off_t slow_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_slow *fp = (hFILE_slow *) fpv;
+
+    // Positional and vectored reads are declined, so that callers fall back
+    // to seeking and reading, which are delayed as usual.
+    if (whence == HFILE_EXT_WHENCE) { errno = EINVAL; return -1; }
+
+    delay(fp, 0);
+    return hseek(fp->rawfp, offset, whence);
+}
+
+static int slow_flush(hFILE *fpv)
+{
+    hFILE_slow *fp = (hFILE_slow *) fpv;
+    return hflush(fp->rawfp);
+}
+
+static int slow_close(hFILE *fpv)
+{
+    hFILE_slow *fp = (hFILE_slow *) fpv;
+    return hclose(fp->rawfp);
+}
+
+static const struct hFILE_backend slow_backend =
+{
+    slow_read, slow_write, slow_seek, slow_flush, slow_close
+};
+
+static void get_params(slow_params *params)
+{
+    const char *text;
+    size_t bandwidth;
+    unsigned i;
+
+    *params = profiles[sizeof profiles / sizeof profiles[0] - 1].params;
+    if ((text = getenv("HTS_SLOW_PROFILE")) != NULL && *text) {
+        for (i = 0; i < sizeof profiles / sizeof profiles[0]; i++)
+            if (strcmp(text, profiles[i].name) == 0) {
+                *params = profiles[i].params;
+                break;
+            }
+        if (i == sizeof profiles / sizeof profiles[0] && hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_slow] ignoring unknown HTS_SLOW_PROFILE "
+                    "\"%s\"\n", text);
+    }
+
+    params->latency = hfile_env_duration("HTS_SLOW_LATENCY", params->latency);
+    params->jitter = hfile_env_duration("HTS_SLOW_JITTER", params->jitter);
+    bandwidth = hfile_env_size("HTS_SLOW_BANDWIDTH", params->bandwidth);
+    params->bandwidth = bandwidth;
+
+    if ((text = getenv("HTS_SLOW_DISTRIBUTION")) != NULL && *text) {
+        for (i = 0; i < sizeof distributions / sizeof distributions[0]; i++)
+            if (strcmp(text, distributions[i]) == 0) {
+                params->distribution = i;
+                break;
+            }
+        if (i == sizeof distributions / sizeof distributions[0] && hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_slow] ignoring unknown "
+                    "HTS_SLOW_DISTRIBUTION \"%s\"\n", text);
+    }
+}
+
+static const char *strip_slow_scheme(const char *filename)
+{
+    if (strncmp(filename, "slow:", 5) == 0) filename += 5;
+    return filename;
+}
+
+static hFILE *hopen_slow(const char *filename, const char *mode)
+{
+    hFILE_slow *fp = NULL;
+    const char *seed;
+    int save;
+
+    fp = (hFILE_slow *) hfile_init(sizeof (hFILE_slow), mode, 0);
+    if (fp == NULL) goto error;
+
+    get_params(&fp->params);
+
+    // Streams opened in the same order get the same delays, for a given seed.
+    seed = getenv("HTS_SLOW_SEED");
+    fp->state = (seed && *seed)? strtoull(seed, NULL, 0) : 1;
+    fp->state += 0x9E3779B97F4A7C15ULL *
+                 __atomic_add_fetch(&seed_counter, 1, __ATOMIC_RELAXED);
+    if (fp->state == 0) fp->state = 1;
+
+    delay(fp, 0);
+    fp->rawfp = hopen(strip_slow_scheme(filename), mode);
+    if (fp->rawfp == NULL) goto error;
+
+    fp->base.backend = &slow_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp) hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+static int slow_isremote(const char *filename)
+{
+    return hisremote(strip_slow_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_slow, slow_isremote, "slow", 50 };
+
+    self->name = "slow";
+    hfile_add_scheme_handler("slow", &handler);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*  hfile_stats.c -- I/O statistics shared by several backends.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_stats.h"
+
+int hfile_stats_enabled = 0;
+
+static char stats_path[4096];
+
+void hfile_stats_setup(void)
+{
+    const char *pattern = getenv("HTS_STATS_FILE");
+    size_t i = 0;
+
+    if (pattern == NULL || *pattern == '\0') return;
+
+    // "%p" is replaced by the process ID.
+    for (; *pattern && i < sizeof stats_path - 24; pattern++)
+        if (pattern[0] == '%' && pattern[1] == 'p') {
+            i += sprintf(&stats_path[i], "%ld", (long) getpid());
+            pattern++;
+        }
+        else stats_path[i++] = *pattern;
+    stats_path[i] = '\0';
+
+    hfile_stats_enabled = 1;
+}
+
+void hfile_stats_open(hfile_stats *st, const char *scheme, const char *url)
+{
+    memset(st, 0, sizeof (hfile_stats));
+    st->scheme = scheme;
+    st->handles = 1;
+    if (hfile_stats_enabled) st->url = strdup(url);
+}
+
+static void json_string(char *out, size_t size, const char *s)
+{
+    size_t i = 0;
+    if (size < 8) { *out = '\0'; return; }
+
+    out[i++] = '"';
+    for (; *s && i < size - 8; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') { out[i++] = '\\'; out[i++] = c; }
+        else if (c < 0x20) i += sprintf(&out[i], "\\u%04x", c);
+        else out[i++] = c;
+    }
+    out[i++] = '"';
+    out[i] = '\0';
+}
+
+// Appends ST as a single line with a single write, so lines from different
+// plugins and processes sharing the file are not interleaved.
+static void write_json(const hfile_stats *st, const char *type)
+{
+    char url[4200], line[5000];
+    int fd, save = errno;
+
+    if (st->url) json_string(url, sizeof url, st->url);
+    else strcpy(url, "null");
+
+    int n = snprintf(line, sizeof line,
+        "{\"type\":\"%s\",\"pid\":%ld,\"scheme\":\"%s\",\"url\":%s,"
+        "\"handles\":%llu,\"reads\":%llu,\"writes\":%llu,\"seeks\":%llu,"
+        "\"flushes\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+        "\"backend_ns\":%llu,\"max_latency_ns\":%llu}\n",
+        type, (long) getpid(), st->scheme, url,
+        (unsigned long long) st->handles, (unsigned long long) st->reads,
+        (unsigned long long) st->writes, (unsigned long long) st->seeks,
+        (unsigned long long) st->flushes, (unsigned long long) st->bytes_read,
+        (unsigned long long) st->bytes_written,
+        (unsigned long long) st->backend_ns, (unsigned long long) st->max_ns);
+    if (n < 0 || n >= (int) sizeof line) goto done;
+
+    fd = open(stats_path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd < 0 || write(fd, line, n) != n) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[W::hfile_stats] can't write to \"%s\": %s\n",
+                    stats_path, strerror(errno));
+    }
+    if (fd >= 0) close(fd);
+
+done:
+    errno = save;
+}
+
+void hfile_stats_close(hfile_stats *st, hfile_stats *total)
+{
+    uint64_t max;
+
+    if (! hfile_stats_enabled) return;
+
+    write_json(st, "stream");
+
+    __atomic_add_fetch(&total->handles, st->handles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->reads, st->reads, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->writes, st->writes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->seeks, st->seeks, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->flushes, st->flushes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->bytes_read, st->bytes_read, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->bytes_written, st->bytes_written, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->backend_ns, st->backend_ns, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&total->max_ns, __ATOMIC_RELAXED);
+    while (st->max_ns > max &&
+           ! __atomic_compare_exchange_n(&total->max_ns, &max, st->max_ns, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+
+    free(st->url);
+    st->url = NULL;
+}
+
+void hfile_stats_exit(hfile_stats *total)
+{
+    if (hfile_stats_enabled && total->handles > 0) write_json(total, "scheme");
+}
@@ -0,0 +1,115 @@
+/*  hfile_stats.h -- I/O statistics shared by several backends.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#ifndef HFILE_STATS_H
+#define HFILE_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* hfile_stats.o is linked into each plugin that uses it, so its symbols
+   are hidden to avoid clashes between plugins loaded with RTLD_GLOBAL.  */
+#if defined __GNUC__ && !defined _WIN32 && !defined __CYGWIN__
+#define HFILE_STATS_HIDDEN __attribute__ ((visibility ("hidden")))
+#else
+#define HFILE_STATS_HIDDEN
+#endif
+
+/* Counters for one stream, or the totals for a scheme.  They are updated
+   with relaxed atomic operations so that they can be read at any time.  */
+typedef struct {
+    const char *scheme;
+    char *url;  // Per-stream counters only
+    uint64_t handles, reads, writes, seeks, flushes;
+    uint64_t bytes_read, bytes_written;
+    uint64_t backend_ns, max_ns;
+} hfile_stats;
+
+enum hfile_stats_op {
+    HFILE_STATS_READ, HFILE_STATS_WRITE, HFILE_STATS_SEEK, HFILE_STATS_FLUSH
+};
+
+extern int hfile_stats_enabled HFILE_STATS_HIDDEN;
+
+/* Enables statistics if $HTS_STATS_FILE is set.  Called by plugin_init.  */
+void hfile_stats_setup(void) HFILE_STATS_HIDDEN;
+
+/* Resets ST, for a stream opened as URL with counters for SCHEME.  */
+void hfile_stats_open(hfile_stats *st, const char *scheme, const char *url)
+    HFILE_STATS_HIDDEN;
+
+/* Writes ST's counters as a JSON line and adds them to TOTAL.  */
+void hfile_stats_close(hfile_stats *st, hfile_stats *total) HFILE_STATS_HIDDEN;
+
+/* Writes TOTAL's counters as a JSON line.  Called by the plugin's destroy.  */
+void hfile_stats_exit(hfile_stats *total) HFILE_STATS_HIDDEN;
+
+/* Returns a timestamp for hfile_stats_end(), or 0 if statistics are not
+   being collected.  */
+static inline uint64_t hfile_stats_start(void)
+{
+    struct timespec ts;
+    if (! hfile_stats_enabled) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+}
+
+/* Records a call of type OP that began at START and returned RESULT.  */
+static inline void
+hfile_stats_end(hfile_stats *st, enum hfile_stats_op op, uint64_t start,
+                ssize_t result)
+{
+    struct timespec ts;
+    uint64_t ns, max;
+    if (start == 0) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + 1 - start;
+
+    switch (op) {
+    case HFILE_STATS_READ:
+        __atomic_add_fetch(&st->reads, 1, __ATOMIC_RELAXED);
+        if (result > 0)
+            __atomic_add_fetch(&st->bytes_read, result, __ATOMIC_RELAXED);
+        break;
+    case HFILE_STATS_WRITE:
+        __atomic_add_fetch(&st->writes, 1, __ATOMIC_RELAXED);
+        if (result > 0)
+            __atomic_add_fetch(&st->bytes_written, result, __ATOMIC_RELAXED);
+        break;
+    case HFILE_STATS_SEEK:
+        __atomic_add_fetch(&st->seeks, 1, __ATOMIC_RELAXED);
+        break;
+    case HFILE_STATS_FLUSH:
+        __atomic_add_fetch(&st->flushes, 1, __ATOMIC_RELAXED);
+        break;
+    }
+
+    __atomic_add_fetch(&st->backend_ns, ns, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           ! __atomic_compare_exchange_n(&st->max_ns, &max, ns, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+#endif
@@ -0,0 +1,624 @@
+/*  hfile_stripe.c -- Streams striped across several underlying files.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+/* Writing stripe:FILE spreads the data in stripes of $HTS_STRIPE_SIZE bytes
+   round-robin across files in each of the colon-separated $HTS_STRIPE_DIRS
+   directories, and on closing writes FILE as a manifest of the form
+
+     hfile_stripe 1
+     stripe_size SIZE
+     length LENGTH
+     STRIPE-FILE-URL  (one per line, in order)
+
+   Reading stripe:FILE reassembles the data from the stripe files listed.
+   Each stripe file has a thread of its own, writing behind or reading ahead,
+   so that the underlying devices are used in parallel.  */
+
+enum slot_state { EMPTY, QUEUED, BUSY, DONE, FAILED };
+
+// Stripe k is held in slots[k % nslots], and is in file k % nfiles.  As
+// nslots is a multiple of nfiles, each slot is used by one file's thread.
+typedef struct {
+    off_t stripe;
+    enum slot_state state;
+    char *data;
+    size_t length;
+    int error;
+} stripe_slot;
+
+struct stripe_worker;
+
+typedef struct {
+    hFILE base;
+    char *manifest;
+    int writing;
+    size_t stripe_size;
+    off_t length, pos;
+    unsigned nfiles, nslots;
+    char **urls;
+    hFILE **files;
+    struct stripe_worker *workers;
+    stripe_slot *slots;
+
+    // The following are shared with the worker threads and protected by lock.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    off_t current, filling, written;
+    int stop, error;
+} hFILE_stripe;
+
+typedef struct stripe_worker {
+    hFILE_stripe *fp;
+    unsigned index;
+    int started;
+    pthread_t thread;
+} stripe_worker;
+
+static inline stripe_slot *slot_for(hFILE_stripe *fp, off_t stripe)
+{
+    return &fp->slots[stripe % fp->nslots];
+}
+
+static void write_stripes(hFILE_stripe *fp, unsigned index)
+{
+    hFILE *file = fp->files[index];
+    off_t stripe = index;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        stripe_slot *s = slot_for(fp, stripe);
+        if (! (s->stripe == stripe && s->state == QUEUED)) {
+            if (fp->stop) break;
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        s->state = BUSY;
+        pthread_mutex_unlock(&fp->lock);
+
+        int err = 0;
+        if (hwrite(file, s->data, s->length) != (ssize_t) s->length)
+            err = errno;
+
+        pthread_mutex_lock(&fp->lock);
+        if (err && fp->error == 0) fp->error = err;
+        s->state = EMPTY;
+        s->stripe = -1;
+        fp->written++;
+        stripe += fp->nfiles;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+}
+
+static void read_stripes(hFILE_stripe *fp, unsigned index)
+{
+    hFILE *file = fp->files[index];
+    off_t nstripes = (fp->length + fp->stripe_size - 1) / fp->stripe_size;
+    off_t filepos = 0;
+
+    pthread_mutex_lock(&fp->lock);
+    while (! fp->stop) {
+        // Find this file's first stripe within the read-ahead window that
+        // has not yet been read.
+        off_t stripe = fp->current +
+            (index + fp->nfiles - fp->current % fp->nfiles) % fp->nfiles;
+        stripe_slot *s = NULL;
+        for (; stripe < fp->current + fp->nslots && stripe < nstripes;
+             stripe += fp->nfiles)
+            if (slot_for(fp, stripe)->stripe != stripe) {
+                s = slot_for(fp, stripe);
+                break;
+            }
+
+        if (s == NULL) {
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+
+        s->stripe = stripe;
+        s->state = BUSY;
+        pthread_mutex_unlock(&fp->lock);
+
+        off_t offset = (stripe / fp->nfiles) * fp->stripe_size;
+        size_t length = fp->stripe_size;
+        if (length > fp->length - stripe * fp->stripe_size)
+            length = fp->length - stripe * fp->stripe_size;
+
+        ssize_t n = 0;
+        if (filepos != offset) {
+            if (hseek(file, offset, SEEK_SET) < 0) n = -1;
+            else filepos = offset;
+        }
+        while (n >= 0 && (size_t) n < length) {
+            ssize_t got = hread(file, s->data + n, length - n);
+            if (got < 0) n = -1;
+            else if (got == 0) { errno = EIO; n = -1; }
+            else { n += got; filepos += got; }
+        }
+        int err = errno;
+
+        pthread_mutex_lock(&fp->lock);
+        if (n < 0) {
+            s->state = FAILED;
+            s->error = err;
+            filepos = -1;
+        }
+        else {
+            s->state = DONE;
+            s->length = n;
+        }
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+}
+
+static void *worker(void *wv)
+{
+    stripe_worker *w = (stripe_worker *) wv;
+    if (w->fp->writing) write_stripes(w->fp, w->index);
+    else read_stripes(w->fp, w->index);
+    return NULL;
+}
+
+static ssize_t stripe_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_stripe *fp = (hFILE_stripe *) fpv;
+    off_t stripe = fp->pos / fp->stripe_size;
+    stripe_slot *s = slot_for(fp, stripe);
+
+    if (fp->pos >= fp->length) return 0;
+
+    pthread_mutex_lock(&fp->lock);
+    if (fp->current != stripe) {
+        fp->current = stripe;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    while (! (s->stripe == stripe && (s->state == DONE || s->state == FAILED)))
+        pthread_cond_wait(&fp->cond, &fp->lock);
+
+    if (s->state == FAILED) {
+        errno = s->error;
+        s->stripe = -1;  // Retry on the next read
+        s->state = EMPTY;
+        pthread_cond_broadcast(&fp->cond);
+        pthread_mutex_unlock(&fp->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    // Workers do not reuse the current stripe's slot.
+    size_t skip = fp->pos - stripe * fp->stripe_size;
+    if (nbytes > s->length - skip) nbytes = s->length - skip;
+    memcpy(buffer, s->data + skip, nbytes);
+    fp->pos += nbytes;
+    return nbytes;
+}
+
+// Waits for the slot for stripe fp->filling to be free.  Called with
+// fp->lock held.
+static stripe_slot *filling_slot(hFILE_stripe *fp)
+{
+    stripe_slot *s = slot_for(fp, fp->filling);
+    while (s->state != EMPTY) pthread_cond_wait(&fp->cond, &fp->lock);
+
+    if (s->stripe != fp->filling) {
+        s->stripe = fp->filling;
+        s->length = 0;
+    }
+    return s;
+}
+
+static ssize_t stripe_write(hFILE *fpv, const void *bufferv, size_t nbytes)
+{
+    hFILE_stripe *fp = (hFILE_stripe *) fpv;
+    const char *buffer = (const char *) bufferv;
+    size_t total = 0;
+
+    pthread_mutex_lock(&fp->lock);
+    while (total < nbytes) {
+        if (fp->error) { errno = fp->error; break; }
+
+        stripe_slot *s = filling_slot(fp);
+        size_t n = fp->stripe_size - s->length;
+        if (n > nbytes - total) n = nbytes - total;
+
+        pthread_mutex_unlock(&fp->lock);
+        memcpy(&s->data[s->length], &buffer[total], n);
+        s->length += n;
+        total += n;
+        pthread_mutex_lock(&fp->lock);
+
+        if (s->length == fp->stripe_size) {
+            s->state = QUEUED;
+            fp->filling++;
+            pthread_cond_broadcast(&fp->cond);
+        }
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    fp->length += total;
+    return (total > 0 || nbytes == 0)? (ssize_t) total : -1;
+}
+
+// Waits for all queued stripes to be written.  Called with fp->lock held.
+static int wait_written(hFILE_stripe *fp)
+{
+    while (fp->written < fp->filling && fp->error == 0)
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    if (fp->error) { errno = fp->error; return -1; }
+    return 0;
+}
+
+// As stripes must be complete for the layout to be regular, a final partial
+// stripe is not written until the stream is closed.
+static int stripe_flush(hFILE *fpv)
+{
+    hFILE_stripe *fp = (hFILE_stripe *) fpv;
+    unsigned i;
+    int ret;
+
+    if (! fp->writing) return 0;
+
+    pthread_mutex_lock(&fp->lock);
+    ret = wait_written(fp);
+    pthread_mutex_unlock(&fp->lock);
+
+    for (i = 0; i < fp->nfiles && ret == 0; i++)
+        if (hflush(fp->files[i]) < 0) ret = -1;
+    return ret;
+}
+
+static off_t stripe_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_stripe *fp = (hFILE_stripe *) fpv;
+    off_t origin;
+
+    if (fp->writing) { errno = ESPIPE; return -1; }
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->length; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > fp->length - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // stripe_read() moves the read-ahead window as necessary.
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static void stop_workers(hFILE_stripe *fp)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+
+    for (i = 0; i < fp->nfiles; i++)
+        if (fp->workers[i].started) pthread_join(fp->workers[i].thread, NULL);
+}
+
+static int write_manifest(hFILE_stripe *fp)
+{
+    hFILE *mf = hopen(fp->manifest, "w");
+    char line[64];
+    unsigned i;
+    int len;
+
+    if (mf == NULL) return -1;
+
+    len = sprintf(line, "hfile_stripe 1\nstripe_size %zu\nlength %lld\n",
+                  fp->stripe_size, (long long) fp->length);
+    if (hwrite(mf, line, len) != len) goto error;
+    for (i = 0; i < fp->nfiles; i++) {
+        len = strlen(fp->urls[i]);
+        if (hwrite(mf, fp->urls[i], len) != len || hputc('\n', mf) == EOF)
+            goto error;
+    }
+
+    return hclose(mf);
+
+error:
+    hclose_abruptly(mf);
+    return -1;
+}
+
+static void destroy(hFILE_stripe *fp)
+{
+    unsigned i;
+
+    if (fp->slots)
+        for (i = 0; i < fp->nslots; i++) free(fp->slots[i].data);
+    if (fp->urls)
+        for (i = 0; i < fp->nfiles; i++) free(fp->urls[i]);
+    free(fp->slots);
+    free(fp->urls);
+    free(fp->files);
+    free(fp->workers);
+    free(fp->manifest);
+}
+
+static int stripe_close(hFILE *fpv)
+{
+    hFILE_stripe *fp = (hFILE_stripe *) fpv;
+    int err = 0;
+    unsigned i;
+
+    if (fp->writing) {
+        pthread_mutex_lock(&fp->lock);
+        stripe_slot *s = filling_slot(fp);
+        if (s->length > 0) {
+            s->state = QUEUED;
+            fp->filling++;
+            pthread_cond_broadcast(&fp->cond);
+        }
+        if (wait_written(fp) < 0) err = errno;
+        pthread_mutex_unlock(&fp->lock);
+    }
+
+    stop_workers(fp);
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+
+    for (i = 0; i < fp->nfiles; i++)
+        if (hclose(fp->files[i]) < 0 && ! err) err = errno;
+
+    if (fp->writing && ! err && write_manifest(fp) < 0) err = errno;
+    destroy(fp);
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend stripe_backend =
+{
+    stripe_read, stripe_write, stripe_seek, stripe_flush, stripe_close
+};
+
+static int add_url(hFILE_stripe *fp, char *url)
+{
+    char **urls = realloc(fp->urls, (fp->nfiles + 1) * sizeof (char *));
+    if (urls == NULL) { free(url); return -1; }
+    fp->urls = urls;
+    fp->urls[fp->nfiles++] = url;
+    return 0;
+}
+
+static int invalid_manifest(const char *manifest)
+{
+    if (hts_verbose >= 2)
+        fprintf(stderr, "[E::hfile_stripe] invalid manifest \"%s\"\n",
+                manifest);
+    errno = EINVAL;
+    return -1;
+}
+
+static int read_manifest(hFILE_stripe *fp)
+{
+    hFILE *mf = hopen(fp->manifest, "r");
+    char line[8192];
+    unsigned long long size;
+    long long length;
+    int version;
+    ssize_t n;
+
+    if (mf == NULL) return -1;
+
+    if (hgetln(line, sizeof line, mf) <= 0 ||
+        sscanf(line, "hfile_stripe %d", &version) != 1 || version != 1 ||
+        hgetln(line, sizeof line, mf) <= 0 ||
+        sscanf(line, "stripe_size %llu", &size) != 1 || size == 0 ||
+        hgetln(line, sizeof line, mf) <= 0 ||
+        sscanf(line, "length %lld", &length) != 1 || length < 0) goto invalid;
+
+    fp->stripe_size = size;
+    fp->length = length;
+
+    while ((n = hgetln(line, sizeof line, mf)) > 0) {
+        while (n > 0 && (line[n-1] == '\n' || line[n-1] == '\r')) line[--n] = '\0';
+        if (n == 0) continue;
+
+        char *url = strdup(line);
+        if (url == NULL || add_url(fp, url) < 0) goto error;
+    }
+    if (n < 0) goto error;
+    if (fp->nfiles == 0) goto invalid;
+
+    return hclose(mf);
+
+invalid:
+    hclose_abruptly(mf);
+    return invalid_manifest(fp->manifest);
+
+error:
+    hclose_abruptly(mf);
+    return -1;
+}
+
+// Sets the stripe file URLs for writing, from $HTS_STRIPE_DIRS.  The names
+// include the process ID and a tag based on the time as well as the
+// manifest's basename, so that outputs with the same basename in different
+// directories don't overwrite each other's stripe files.
+static int choose_files(hFILE_stripe *fp)
+{
+    const char *dirs = getenv("HTS_STRIPE_DIRS"), *dir, *end;
+    const char *base = strrchr(fp->manifest, '/');
+    struct timespec ts;
+    unsigned long tag;
+
+    base = base? base + 1 : fp->manifest;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tag = ((unsigned long) ts.tv_sec * 1000000007UL + ts.tv_nsec) ^
+          (unsigned long) (uintptr_t) fp;
+
+    if (dirs == NULL || *dirs == '\0') {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_stripe] $HTS_STRIPE_DIRS is not set\n");
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (dir = dirs; *dir; dir = (*end)? end + 1 : end) {
+        end = strchr(dir, ':');
+        if (end == NULL) end = dir + strlen(dir);
+        if (end == dir) continue;
+
+        char *url = malloc((end - dir) + strlen(base) + 64);
+        if (url == NULL) return -1;
+        sprintf(url, "%.*s/%s.%ld-%08lx.stripe%u", (int) (end - dir), dir,
+                base, (long) getpid(), tag & 0xffffffffUL, fp->nfiles);
+        if (add_url(fp, url) < 0) return -1;
+    }
+
+    if (fp->nfiles == 0) { errno = EINVAL; return -1; }
+    return 0;
+}
+
+static const char *strip_stripe_scheme(const char *filename)
+{
+    if (strncmp(filename, "stripe:", 7) == 0) filename += 7;
+    return filename;
+}
+
+static hFILE *hopen_stripe(const char *filename, const char *mode)
+{
+    hFILE_stripe *fp = NULL;
+    int flags = hfile_oflags(mode), save, ret;
+    unsigned i;
+
+    if ((flags & O_ACCMODE) == O_RDWR || (flags & O_APPEND)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fp = (hFILE_stripe *) hfile_init(sizeof (hFILE_stripe), mode, 0);
+    if (fp == NULL) return NULL;
+
+    fp->writing = ((flags & O_ACCMODE) == O_WRONLY);
+    fp->nfiles = fp->nslots = 0;
+    fp->urls = NULL;
+    fp->files = NULL;
+    fp->workers = NULL;
+    fp->slots = NULL;
+    fp->length = fp->pos = 0;
+    fp->current = fp->filling = fp->written = 0;
+    fp->stop = fp->error = 0;
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+
+    fp->manifest = strdup(strip_stripe_scheme(filename));
+    if (fp->manifest == NULL) goto error;
+
+    if (fp->writing) {
+        fp->stripe_size = hfile_env_size("HTS_STRIPE_SIZE", 4194304);
+        if (fp->stripe_size < 4096) fp->stripe_size = 4096;
+        if (choose_files(fp) < 0) goto error;
+    }
+    else if (read_manifest(fp) < 0) goto error;
+
+    fp->nslots = 2 * fp->nfiles;
+    fp->files = calloc(fp->nfiles, sizeof (hFILE *));
+    fp->workers = calloc(fp->nfiles, sizeof (stripe_worker));
+    fp->slots = calloc(fp->nslots, sizeof (stripe_slot));
+    if (fp->files == NULL || fp->workers == NULL || fp->slots == NULL)
+        goto error;
+
+    for (i = 0; i < fp->nslots; i++) {
+        fp->slots[i].stripe = -1;
+        fp->slots[i].state = EMPTY;
+        fp->slots[i].data = malloc(fp->stripe_size);
+        if (fp->slots[i].data == NULL) goto error;
+    }
+
+    for (i = 0; i < fp->nfiles; i++) {
+        fp->files[i] = hopen(fp->urls[i], mode);
+        if (fp->files[i] == NULL) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_stripe] can't open \"%s\": %s\n",
+                        fp->urls[i], strerror(errno));
+            goto error;
+        }
+    }
+
+    for (i = 0; i < fp->nfiles; i++) {
+        stripe_worker *w = &fp->workers[i];
+        w->fp = fp;
+        w->index = i;
+        ret = pthread_create(&w->thread, NULL, worker, w);
+        if (ret != 0) { errno = ret; goto error; }
+        w->started = 1;
+    }
+
+    fp->base.backend = &stripe_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp->workers) stop_workers(fp);
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    if (fp->files)
+        for (i = 0; i < fp->nfiles; i++)
+            if (fp->files[i]) hclose_abruptly(fp->files[i]);
+    destroy(fp);
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+static int stripe_isremote(const char *filename)
+{
+    return hisremote(strip_stripe_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_stripe, stripe_isremote, "stripe", 50 };
+
+    self->name = "stripe";
+    hfile_add_scheme_handler("stripe", &handler);
+    return 0;
+}
@@ -0,0 +1,518 @@
+/*  hfile_tar.c -- Access to members of tar archives.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_view.h"
+
+/* tar:ARCHIVE#MEMBER presents MEMBER of the uncompressed tar archive ARCHIVE
+   as a read-only seekable stream over the archive's bytes.  The archive's
+   headers are scanned once per process, and for local archives the member
+   index is also saved in ARCHIVE.tarindex for use by later processes.  */
+
+#define BLOCKSIZE 512
+
+typedef struct {
+    char *name;
+    off_t offset, size;
+} tar_member;
+
+typedef struct tar_index {
+    struct tar_index *next;
+    char *url;
+    long long size, mtime;  // Of local archives, to detect modification
+    size_t nmembers;
+    tar_member *members;
+} tar_index;
+
+static struct {
+    pthread_mutex_t lock;
+    tar_index *indexes;
+} tar = { PTHREAD_MUTEX_INITIALIZER };
+
+static void free_index(tar_index *idx)
+{
+    size_t i;
+    if (idx == NULL) return;
+    for (i = 0; i < idx->nmembers; i++) free(idx->members[i].name);
+    free(idx->members);
+    free(idx->url);
+    free(idx);
+}
+
+static int add_member(tar_index *idx, size_t *capacity,
+                      char *name, off_t offset, off_t size)
+{
+    if (idx->nmembers == *capacity) {
+        size_t n = *capacity? 2 * *capacity : 64;
+        tar_member *members = realloc(idx->members, n * sizeof (tar_member));
+        if (members == NULL) { free(name); return -1; }
+        idx->members = members;
+        *capacity = n;
+    }
+
+    tar_member *m = &idx->members[idx->nmembers++];
+    m->name = name;
+    m->offset = offset;
+    m->size = size;
+    return 0;
+}
+
+static int compare_members(const void *av, const void *bv)
+{
+    const tar_member *a = (const tar_member *) av;
+    const tar_member *b = (const tar_member *) bv;
+    return strcmp(a->name, b->name);
+}
+
+// Sorts the members by name.  If a name appears more than once, the last
+// one in the archive takes precedence, as when extracting.
+static void sort_members(tar_index *idx)
+{
+    size_t i, j;
+
+    qsort(idx->members, idx->nmembers, sizeof (tar_member), compare_members);
+    for (i = j = 0; i < idx->nmembers; i++) {
+        tar_member *m = &idx->members[i];
+        if (j > 0 && strcmp(m->name, idx->members[j-1].name) == 0) {
+            if (m->offset > idx->members[j-1].offset) {
+                free(idx->members[j-1].name);
+                idx->members[j-1] = *m;
+            }
+            else free(m->name);
+        }
+        else idx->members[j++] = *m;
+    }
+    idx->nmembers = j;
+}
+
+static const tar_member *find_member(const tar_index *idx, const char *name)
+{
+    tar_member key;
+    key.name = (char *) name;
+    return bsearch(&key, idx->members, idx->nmembers, sizeof (tar_member),
+                   compare_members);
+}
+
+// Parses a numeric header field, which is either octal text or (a GNU
+// extension for large values) big-endian base-256 flagged by the top bit.
+static long long parse_number(const char *field, size_t length)
+{
+    const unsigned char *s = (const unsigned char *) field;
+    long long value = 0;
+    size_t i;
+
+    if (s[0] & 0x80) {
+        value = s[0] & 0x3f;
+        for (i = 1; i < length; i++) value = (value << 8) | s[i];
+        return value;
+    }
+
+    for (i = 0; i < length && s[i] == ' '; i++) ;
+    for (; i < length && s[i] >= '0' && s[i] <= '7'; i++)
+        value = value * 8 + (s[i] - '0');
+    return value;
+}
+
+static int valid_checksum(const unsigned char *header)
+{
+    long long sum = 0;
+    int i;
+
+    for (i = 0; i < BLOCKSIZE; i++)
+        sum += (i >= 148 && i < 156)? ' ' : header[i];
+    return sum == parse_number((const char *) &header[148], 8);
+}
+
+static char *field_string(const char *field, size_t length)
+{
+    size_t n = strnlen(field, length);
+    char *s = malloc(n + 1);
+    if (s) { memcpy(s, field, n); s[n] = '\0'; }
+    return s;
+}
+
+// Extracts the path and size records from a pax extended header.
+static void parse_pax(const char *data, size_t length,
+                      char **path, long long *size)
+{
+    const char *end = data + length;
+
+    while (data < end) {
+        char *keyword;
+        long reclen = strtol(data, &keyword, 10);
+        if (reclen <= 0 || reclen > end - data || *keyword != ' ') break;
+
+        const char *value, *recend = data + reclen - 1;  // At the newline
+        keyword++;
+        value = memchr(keyword, '=', recend - keyword);
+        if (value) {
+            value++;
+            if (strncmp(keyword, "path=", 5) == 0) {
+                free(*path);
+                *path = field_string(value, recend - value);
+            }
+            else if (strncmp(keyword, "size=", 5) == 0)
+                *size = strtoll(value, NULL, 10);
+        }
+
+        data += reclen;
+    }
+}
+
+static int skip_bytes(hFILE *fp, off_t nbytes)
+{
+    char buffer[BLOCKSIZE];
+
+    if (hseek(fp, nbytes, SEEK_CUR) >= 0) return 0;
+    else if (errno != ESPIPE) return -1;
+
+    hclearerr(fp);
+    while (nbytes > 0) {
+        ssize_t n = hread(fp, buffer, (nbytes < BLOCKSIZE)? nbytes : BLOCKSIZE);
+        if (n <= 0) { if (n == 0) errno = EIO; return -1; }
+        nbytes -= n;
+    }
+    return 0;
+}
+
+static tar_index *scan_archive(const char *url)
+{
+    unsigned char header[BLOCKSIZE];
+    tar_index *idx = NULL;
+    hFILE *fp = NULL;
+    char *data = NULL, *longname = NULL, *paxpath = NULL;
+    long long paxsize = -1;
+    size_t capacity = 0;
+    off_t offset = 0;
+    int save;
+
+    idx = calloc(1, sizeof (tar_index));
+    if (idx == NULL) goto error;
+
+    fp = hopen(url, "r");
+    if (fp == NULL) goto error;
+
+    for (;;) {
+        ssize_t n = hread(fp, header, BLOCKSIZE);
+        if (n < 0) goto error;
+        else if (n == 0) break;  // Archive without end-of-archive blocks
+        else if (n < BLOCKSIZE) goto invalid;
+        offset += BLOCKSIZE;
+
+        if (header[0] == '\0') break;  // End-of-archive
+        if (! valid_checksum(header)) goto invalid;
+
+        long long size = parse_number((const char *) &header[124], 12);
+        off_t padded = (size + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+        char type = header[156];
+
+        if (type == 'L' || type == 'x') {
+            // GNU long name, or pax extended header: these apply to the
+            // following member.
+            if (size > 1048576) goto invalid;
+            data = malloc(padded + 1);
+            if (data == NULL) goto error;
+            if (hread(fp, data, padded) != padded) goto invalid;
+            data[size] = '\0';
+            offset += padded;
+
+            if (type == 'L') {
+                free(longname);
+                longname = field_string(data, size);
+            }
+            else parse_pax(data, size, &paxpath, &paxsize);
+
+            free(data);
+            data = NULL;
+            continue;
+        }
+
+        if (paxsize >= 0) {
+            size = paxsize;
+            padded = (size + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+        }
+
+        if (type == '0' || type == '\0' || type == '7') {
+            char *name;
+            if (paxpath) { name = paxpath; paxpath = NULL; }
+            else if (longname) { name = longname; longname = NULL; }
+            else if (memcmp(&header[257], "ustar", 5) == 0 && header[345]) {
+                // Prefix, a slash, and name
+                char *prefix = field_string((const char *) &header[345], 155);
+                char *base = field_string((const char *) header, 100);
+                name = (prefix && base)?
+                    malloc(strlen(prefix) + strlen(base) + 2) : NULL;
+                if (name) sprintf(name, "%s/%s", prefix, base);
+                free(prefix);
+                free(base);
+            }
+            else name = field_string((const char *) header, 100);
+
+            if (name == NULL) goto error;
+            if (add_member(idx, &capacity, name, offset, size) < 0)
+                goto error;
+        }
+
+        free(longname);
+        longname = NULL;
+        free(paxpath);
+        paxpath = NULL;
+        paxsize = -1;
+
+        if (padded > 0 && skip_bytes(fp, padded) < 0) goto error;
+        offset += padded;
+    }
+
+    if (hclose(fp) < 0) { fp = NULL; goto error; }
+    free(longname);
+    free(paxpath);
+    sort_members(idx);
+    return idx;
+
+invalid:
+    if (hts_verbose >= 2)
+        fprintf(stderr, "[E::hfile_tar] \"%s\" is not a valid tar archive\n",
+                url);
+    errno = EINVAL;
+
+error:
+    save = errno;
+    if (fp) hclose_abruptly(fp);
+    free(data);
+    free(longname);
+    free(paxpath);
+    free_index(idx);
+    errno = save;
+    return NULL;
+}
+
+/* Index files consist of a header line, "hfile_tar SIZE MTIME", followed by
+   "OFFSET SIZE NAME" for each member, all separated by tabs.  */
+
+static char *index_filename(const char *path)
+{
+    char *filename = malloc(strlen(path) + 10);
+    if (filename) sprintf(filename, "%s.tarindex", path);
+    return filename;
+}
+
+static tar_index *load_index_file(const char *path, const struct stat *st)
+{
+    char *filename = index_filename(path), line[8192];
+    tar_index *idx = NULL;
+    size_t capacity = 0;
+    long long size, mtime;
+    FILE *f = NULL;
+
+    if (filename == NULL) return NULL;
+    f = fopen(filename, "r");
+    if (f == NULL) goto fail;
+
+    if (fgets(line, sizeof line, f) == NULL ||
+        sscanf(line, "hfile_tar\t%lld\t%lld", &size, &mtime) != 2 ||
+        size != (long long) st->st_size || mtime != (long long) st->st_mtime)
+        goto fail;
+
+    idx = calloc(1, sizeof (tar_index));
+    if (idx == NULL) goto fail;
+
+    while (fgets(line, sizeof line, f)) {
+        long long offset, msize;
+        int n;
+        size_t len = strlen(line);
+        if (len == 0 || line[len-1] != '\n') goto fail;
+        line[len-1] = '\0';
+
+        if (sscanf(line, "%lld\t%lld\t%n", &offset, &msize, &n) < 2)
+            goto fail;
+        char *name = strdup(&line[n]);
+        if (name == NULL || add_member(idx, &capacity, name, offset, msize) < 0)
+            goto fail;
+    }
+
+    fclose(f);
+    free(filename);
+    return idx;
+
+fail:
+    if (f) fclose(f);
+    free(filename);
+    free_index(idx);
+    return NULL;
+}
+
+// Saves the index for later processes.  Failure, for example due to the
+// archive's directory not being writable, is not an error.
+static void save_index_file(const char *path, const struct stat *st,
+                            const tar_index *idx)
+{
+    char *filename = index_filename(path), *tmpname = NULL;
+    FILE *f = NULL;
+    size_t i;
+
+    if (filename == NULL) return;
+    for (i = 0; i < idx->nmembers; i++)
+        if (strlen(idx->members[i].name) > 4000 ||
+            strchr(idx->members[i].name, '\n')) goto done;
+
+    tmpname = malloc(strlen(filename) + 24);
+    if (tmpname == NULL) goto done;
+    sprintf(tmpname, "%s.%ld", filename, (long) getpid());
+
+    f = fopen(tmpname, "w");
+    if (f == NULL) goto done;
+
+    fprintf(f, "hfile_tar\t%lld\t%lld\n",
+            (long long) st->st_size, (long long) st->st_mtime);
+    for (i = 0; i < idx->nmembers; i++)
+        fprintf(f, "%lld\t%lld\t%s\n", (long long) idx->members[i].offset,
+                (long long) idx->members[i].size, idx->members[i].name);
+
+    if (fclose(f) != 0 || rename(tmpname, filename) < 0) remove(tmpname);
+
+done:
+    free(tmpname);
+    free(filename);
+}
+
+// Returns the index for the archive URL, which remains valid until exit.
+static const tar_index *get_index(const char *url)
+{
+    const char *path = hfile_view_local_path(url);
+    const char *use_files = getenv("HTS_TAR_INDEX");
+    struct stat st;
+    tar_index *idx;
+    long long size = -1, mtime = -1;
+
+    if (path) {
+        if (stat(path, &st) < 0) return NULL;
+        size = st.st_size;
+        mtime = st.st_mtime;
+    }
+
+    pthread_mutex_lock(&tar.lock);
+
+    for (idx = tar.indexes; idx; idx = idx->next)
+        if (strcmp(idx->url, url) == 0 &&
+            idx->size == size && idx->mtime == mtime) goto done;
+
+    if (use_files && strcmp(use_files, "0") == 0) path = NULL;
+
+    idx = path? load_index_file(path, &st) : NULL;
+    if (idx == NULL) {
+        idx = scan_archive(url);
+        if (idx == NULL) goto done;
+        if (path) save_index_file(path, &st, idx);
+    }
+    else sort_members(idx);
+
+    idx->url = strdup(url);
+    if (idx->url == NULL) { free_index(idx); idx = NULL; goto done; }
+    idx->size = size;
+    idx->mtime = mtime;
+    idx->next = tar.indexes;
+    tar.indexes = idx;
+
+done:
+    pthread_mutex_unlock(&tar.lock);
+    return idx;
+}
+
+static hFILE *hopen_tar(const char *filename, const char *mode)
+{
+    const tar_index *idx;
+    const tar_member *m;
+    char *url;
+    hFILE *fp = NULL;
+
+    const char *hash = strchr(filename, '#');
+    if (hash == NULL) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_tar] no member specified in \"%s\"\n",
+                    filename);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    url = field_string(filename + 4, hash - (filename + 4));  // Skip "tar:"
+    if (url == NULL) return NULL;
+
+    idx = get_index(url);
+    if (idx == NULL) goto done;
+
+    // Archives created from "." have members named "./PATH".
+    m = find_member(idx, hash + 1);
+    if (m == NULL && strlen(hash + 1) < 4000) {
+        char dotname[4096];
+        sprintf(dotname, "./%s", hash + 1);
+        m = find_member(idx, dotname);
+    }
+    if (m == NULL) { errno = ENOENT; goto done; }
+
+    fp = hfile_view_open(url, m->offset, m->size, mode);
+
+done:
+    free(url);
+    return fp;
+}
+
+static int tar_isremote(const char *filename)
+{
+    const char *hash = strchr(filename, '#');
+    char *url = field_string(filename + 4, hash? hash - (filename + 4)
+                                                : strlen(filename + 4));
+    int ret = url? hisremote(url) : 0;
+    free(url);
+    return ret;
+}
+
+static void tar_exit(void)
+{
+    tar_index *idx, *next;
+
+    for (idx = tar.indexes; idx; idx = next) {
+        next = idx->next;
+        free_index(idx);
+    }
+    tar.indexes = NULL;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_tar, tar_isremote, "tar", 50 };
+
+    self->name = "tar";
+    self->destroy = tar_exit;
+    hfile_add_scheme_handler("tar", &handler);
+    return 0;
+}
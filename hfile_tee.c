@@ -0,0 +1,363 @@
+/*  hfile_tee.c -- Output duplicated to several destinations.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+/* tee:URL1|URL2|... writes the same data to each of the URLs.  Each write
+   is queued once, and written to each destination by a thread of its own,
+   so that a slow destination delays the others only when the queue, of at
+   most $HTS_TEE_QUEUE_SIZE bytes, is full.  */
+
+// Chunks are freed once written to every destination, which as each
+// destination writes them in order is always the oldest chunk.
+typedef struct tee_chunk {
+    struct tee_chunk *next;
+    size_t length;
+    unsigned pending;
+    char data[];
+} tee_chunk;
+
+struct hFILE_tee;
+
+typedef struct {
+    struct hFILE_tee *fp;
+    char *url;
+    hFILE *out;
+    tee_chunk *next;  // The next chunk to be written, or NULL
+    int error, started;
+    pthread_t thread;
+} tee_dest;
+
+typedef struct hFILE_tee {
+    hFILE base;
+    tee_dest *dests;
+    unsigned ndests;
+    size_t limit;
+
+    // The following are shared with the worker threads and protected by lock.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    tee_chunk *head, *tail;
+    size_t queued;
+    int stop;
+} hFILE_tee;
+
+static void *worker(void *dv)
+{
+    tee_dest *d = (tee_dest *) dv;
+    hFILE_tee *fp = d->fp;
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        tee_chunk *c = d->next;
+        if (c == NULL) {
+            if (fp->stop) break;
+            pthread_cond_wait(&fp->cond, &fp->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&fp->lock);
+
+        // After an error, data continues to be discarded so that the other
+        // destinations are not held up.
+        int err = 0;
+        if (! d->error && hwrite(d->out, c->data, c->length) != (ssize_t) c->length)
+            err = errno;
+
+        pthread_mutex_lock(&fp->lock);
+        if (err) d->error = err;
+        d->next = c->next;
+        if (--c->pending == 0) {
+            fp->head = c->next;
+            if (fp->head == NULL) fp->tail = NULL;
+            fp->queued -= c->length;
+            free(c);
+        }
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return NULL;
+}
+
+// Returns the error of the first failed destination, or 0.  Called with
+// fp->lock held.
+static int dest_error(hFILE_tee *fp)
+{
+    unsigned i;
+    for (i = 0; i < fp->ndests; i++)
+        if (fp->dests[i].error) return fp->dests[i].error;
+    return 0;
+}
+
+static ssize_t tee_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    hFILE_tee *fp = (hFILE_tee *) fpv;
+    tee_chunk *c;
+    unsigned i;
+    int err;
+
+    c = malloc(sizeof (tee_chunk) + nbytes);
+    if (c == NULL) return -1;
+    c->next = NULL;
+    c->length = nbytes;
+    c->pending = fp->ndests;
+    memcpy(c->data, buffer, nbytes);
+
+    pthread_mutex_lock(&fp->lock);
+    while (fp->queued > 0 && fp->queued + nbytes > fp->limit &&
+           dest_error(fp) == 0)
+        pthread_cond_wait(&fp->cond, &fp->lock);
+
+    err = dest_error(fp);
+    if (err) {
+        pthread_mutex_unlock(&fp->lock);
+        free(c);
+        errno = err;
+        return -1;
+    }
+
+    if (fp->tail) fp->tail->next = c;
+    else fp->head = c;
+    fp->tail = c;
+    fp->queued += nbytes;
+    for (i = 0; i < fp->ndests; i++)
+        if (fp->dests[i].next == NULL) fp->dests[i].next = c;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+
+    return nbytes;
+}
+
+// Waits for all queued data to be written.
+static int drain(hFILE_tee *fp)
+{
+    int err;
+
+    pthread_mutex_lock(&fp->lock);
+    while (fp->head) pthread_cond_wait(&fp->cond, &fp->lock);
+    err = dest_error(fp);
+    pthread_mutex_unlock(&fp->lock);
+
+    if (err) { errno = err; return -1; }
+    return 0;
+}
+
+static int tee_flush(hFILE *fpv)
+{
+    hFILE_tee *fp = (hFILE_tee *) fpv;
+    unsigned i;
+    int ret = drain(fp);
+
+    // The workers are idle, so the destinations can be used directly.
+    for (i = 0; i < fp->ndests && ret == 0; i++)
+        if (hflush(fp->dests[i].out) < 0) ret = -1;
+    return ret;
+}
+
+static off_t tee_seek(hFILE *fpv, off_t offset, int whence)
+{
+    errno = ESPIPE;
+    return -1;
+}
+
+static void stop_workers(hFILE_tee *fp)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+
+    for (i = 0; i < fp->ndests; i++)
+        if (fp->dests[i].started) pthread_join(fp->dests[i].thread, NULL);
+}
+
+static void destroy(hFILE_tee *fp)
+{
+    unsigned i;
+    tee_chunk *c, *next;
+
+    for (c = fp->head; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    for (i = 0; i < fp->ndests; i++) free(fp->dests[i].url);
+    free(fp->dests);
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+}
+
+// Succeeds only if all data was written to, and then successfully closed,
+// every destination.
+static int tee_close(hFILE *fpv)
+{
+    hFILE_tee *fp = (hFILE_tee *) fpv;
+    int err = 0;
+    unsigned i;
+
+    (void) drain(fp);
+    stop_workers(fp);
+
+    for (i = 0; i < fp->ndests; i++) {
+        tee_dest *d = &fp->dests[i];
+        if (! d->error && hclose(d->out) < 0) d->error = errno;
+        else if (d->error) hclose_abruptly(d->out);
+
+        if (d->error) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_tee] writing to \"%s\" failed: "
+                        "%s\n", d->url, strerror(d->error));
+            if (! err) err = d->error;
+        }
+    }
+
+    destroy(fp);
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend tee_backend =
+{
+    NULL, tee_write, tee_seek, tee_flush, tee_close
+};
+
+static const char *strip_tee_scheme(const char *filename)
+{
+    if (strncmp(filename, "tee:", 4) == 0) filename += 4;
+    return filename;
+}
+
+static hFILE *hopen_tee(const char *filename, const char *mode)
+{
+    hFILE_tee *fp = NULL;
+    const char *url, *end;
+    unsigned i, n;
+    int save, ret;
+
+    if ((hfile_oflags(mode) & O_ACCMODE) != O_WRONLY) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fp = (hFILE_tee *) hfile_init(sizeof (hFILE_tee), mode, 0);
+    if (fp == NULL) return NULL;
+
+    fp->head = fp->tail = NULL;
+    fp->queued = 0;
+    fp->stop = 0;
+    fp->limit = hfile_env_size("HTS_TEE_QUEUE_SIZE", 16777216);
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+
+    url = strip_tee_scheme(filename);
+    for (n = 1, end = url; (end = strchr(end, '|')) != NULL; end++) n++;
+    fp->ndests = 0;
+    fp->dests = calloc(n, sizeof (tee_dest));
+    if (fp->dests == NULL) goto error;
+
+    for (; *url; url = (*end)? end + 1 : end) {
+        end = strchr(url, '|');
+        if (end == NULL) end = url + strlen(url);
+        if (end == url) continue;
+
+        tee_dest *d = &fp->dests[fp->ndests];
+        d->fp = fp;
+        d->url = malloc(end - url + 1);
+        if (d->url == NULL) goto error;
+        memcpy(d->url, url, end - url);
+        d->url[end - url] = '\0';
+        fp->ndests++;
+
+        d->out = hopen(d->url, mode);
+        if (d->out == NULL) {
+            if (hts_verbose >= 2)
+                fprintf(stderr, "[E::hfile_tee] can't open \"%s\": %s\n",
+                        d->url, strerror(errno));
+            goto error;
+        }
+    }
+
+    if (fp->ndests == 0) { errno = EINVAL; goto error; }
+
+    for (i = 0; i < fp->ndests; i++) {
+        tee_dest *d = &fp->dests[i];
+        ret = pthread_create(&d->thread, NULL, worker, d);
+        if (ret != 0) { errno = ret; goto error; }
+        d->started = 1;
+    }
+
+    fp->base.backend = &tee_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp->dests) {
+        stop_workers(fp);
+        for (i = 0; i < fp->ndests; i++)
+            if (fp->dests[i].out) hclose_abruptly(fp->dests[i].out);
+    }
+    destroy(fp);
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+// Remote if any of the destinations is.
+static int tee_isremote(const char *filename)
+{
+    const char *url = strip_tee_scheme(filename), *end;
+    char buffer[4096];
+    int remote = 0;
+
+    for (; *url && ! remote; url = (*end)? end + 1 : end) {
+        end = strchr(url, '|');
+        if (end == NULL) end = url + strlen(url);
+        if (end == url || end - url >= (ptrdiff_t) sizeof buffer) continue;
+        memcpy(buffer, url, end - url);
+        buffer[end - url] = '\0';
+        remote = hisremote(buffer);
+    }
+    return remote;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_tee, tee_isremote, "tee", 50 };
+
+    self->name = "tee";
+    hfile_add_scheme_handler("tee", &handler);
+    return 0;
+}
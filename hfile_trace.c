@@ -0,0 +1,369 @@
+/*  hfile_trace.c -- I/O tracing wrapper backend for low-level file streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_ext.h"
+#include "hfile_trace.h"
+
+typedef struct {
+    hFILE base;
+    hFILE *rawfp;
+    off_t pos;
+    uint32_t handle;
+} hFILE_trace;
+
+// Records are accumulated in a buffer per thread, and written to the trace
+// file when the buffer fills, the thread exits, or a traced stream closes.
+// Each buffer has its own lock, which is normally uncontended.
+
+#define TRACE_BUFSIZE 65536
+
+typedef struct trace_buffer {
+    struct trace_buffer *next;
+    pthread_mutex_t lock;
+    uint32_t thread;
+    size_t used;
+    char data[TRACE_BUFSIZE];
+} trace_buffer;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_key_t key;
+    trace_buffer *buffers;
+    uint32_t nhandles, nthreads;
+    int fd;
+} trace = { PTHREAD_MUTEX_INITIALIZER };
+
+static inline uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void write_all(const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = write(trace.fd, data, length);
+        if (n < 0 && errno == EINTR) continue;
+        else if (n <= 0) break;
+        data += n;
+        length -= n;
+    }
+}
+
+// Called with b->lock held.
+static void flush_buffer(trace_buffer *b)
+{
+    int save = errno;
+    write_all(b->data, b->used);
+    b->used = 0;
+    errno = save;
+}
+
+static void release_buffer(void *bv)
+{
+    trace_buffer *b = (trace_buffer *) bv, **bp;
+
+    pthread_mutex_lock(&trace.lock);
+    for (bp = &trace.buffers; *bp; bp = &(*bp)->next)
+        if (*bp == b) { *bp = b->next; break; }
+    pthread_mutex_unlock(&trace.lock);
+
+    pthread_mutex_lock(&b->lock);
+    flush_buffer(b);
+    pthread_mutex_unlock(&b->lock);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
+
+static trace_buffer *get_buffer(void)
+{
+    trace_buffer *b = pthread_getspecific(trace.key);
+    if (b) return b;
+
+    b = malloc(sizeof (trace_buffer));
+    if (b == NULL) return NULL;
+    pthread_mutex_init(&b->lock, NULL);
+    b->used = 0;
+#if defined __linux__ && defined SYS_gettid
+    b->thread = syscall(SYS_gettid);
+#else
+    b->thread = __atomic_add_fetch(&trace.nthreads, 1, __ATOMIC_RELAXED);
+#endif
+
+    pthread_mutex_lock(&trace.lock);
+    b->next = trace.buffers;
+    trace.buffers = b;
+    pthread_mutex_unlock(&trace.lock);
+
+    pthread_setspecific(trace.key, b);
+    return b;
+}
+
+static void emit(hFILE_trace *fp, enum hts_trace_op op, uint64_t start,
+                 int64_t offset, uint64_t length, int64_t result,
+                 const char *extra, size_t extralen)
+{
+    static const char padding[8] = { 0 };
+    hts_trace_record rec;
+    size_t padlen = (8 - extralen % 8) % 8;
+    size_t total = sizeof rec + extralen + padlen;
+    trace_buffer *b = get_buffer();
+    if (b == NULL) return;
+
+    memset(&rec, 0, sizeof rec);
+    rec.time = start;
+    rec.latency = now() - start;
+    rec.offset = offset;
+    rec.result = result;
+    rec.length = length;
+    rec.handle = fp->handle;
+    rec.thread = b->thread;
+    rec.op = op;
+
+    pthread_mutex_lock(&b->lock);
+    if (b->used + total > TRACE_BUFSIZE) flush_buffer(b);
+    if (total > TRACE_BUFSIZE) {
+        // Only possible for an extraordinarily long URL.
+        write_all((const char *) &rec, sizeof rec);
+        write_all(extra, extralen);
+        write_all(padding, padlen);
+    }
+    else {
+        memcpy(&b->data[b->used], &rec, sizeof rec);
+        memcpy(&b->data[b->used + sizeof rec], extra, extralen);
+        memcpy(&b->data[b->used + sizeof rec + extralen], padding, padlen);
+        b->used += total;
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void flush_this_thread(void)
+{
+    trace_buffer *b = pthread_getspecific(trace.key);
+    if (b) {
+        pthread_mutex_lock(&b->lock);
+        flush_buffer(b);
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+static ssize_t trace_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_trace *fp = (hFILE_trace *) fpv;
+    uint64_t start = now();
+    ssize_t ret = hread(fp->rawfp, buffer, nbytes);
+    emit(fp, HTS_TRACE_READ, start, fp->pos, nbytes, ret, NULL, 0);
+    if (ret > 0) fp->pos += ret;
+    return ret;
+}
+
+static ssize_t trace_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    hFILE_trace *fp = (hFILE_trace *) fpv;
+    uint64_t start = now();
+    ssize_t ret = hwrite(fp->rawfp, buffer, nbytes);
+    emit(fp, HTS_TRACE_WRITE, start, fp->pos, nbytes, ret, NULL, 0);
+    if (ret > 0) fp->pos += ret;
+    return ret;
+}
+
+static off_t trace_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_trace *fp = (hFILE_trace *) fpv;
+
+    // Positional and vectored reads are passed through untraced, as they
+    // leave the position alone and the trace format has no record of them.
+    if (whence == HFILE_EXT_WHENCE) {
+        hfile_ext_request *req = (hfile_ext_request *) (intptr_t) offset;
+        return hfile_ext_call(fp->rawfp, req);
+    }
+
+    uint64_t start = now();
+    off_t ret = hseek(fp->rawfp, offset, whence);
+    emit(fp, HTS_TRACE_SEEK, start, offset, whence, ret, NULL, 0);
+    if (ret >= 0) fp->pos = ret;
+    return ret;
+}
+
+static int trace_flush(hFILE *fpv)
+{
+    hFILE_trace *fp = (hFILE_trace *) fpv;
+    uint64_t start = now();
+    int ret = hflush(fp->rawfp);
+    emit(fp, HTS_TRACE_FLUSH, start, fp->pos, 0, ret, NULL, 0);
+    return ret;
+}
+
+static int trace_close(hFILE *fpv)
+{
+    hFILE_trace *fp = (hFILE_trace *) fpv;
+    uint64_t start = now();
+    int ret = hclose(fp->rawfp);
+    emit(fp, HTS_TRACE_CLOSE, start, fp->pos, 0, ret, NULL, 0);
+    flush_this_thread();
+    return ret;
+}
+
+static const struct hFILE_backend trace_backend =
+{
+    trace_read, trace_write, trace_seek, trace_flush, trace_close
+};
+
+// Opens the trace file named by $HTS_TRACE_FILE, in which "%p" is replaced
+// by the process ID, when the first stream is opened.
+static int trace_init(void)
+{
+    const char *pattern = getenv("HTS_TRACE_FILE");
+    char path[PATH_MAX];
+    size_t i = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&trace.lock);
+    if (trace.fd >= 0) goto done;
+
+    if (pattern == NULL || *pattern == '\0') pattern = "hts-trace.%p.bin";
+    for (; *pattern && i < sizeof path - 24; pattern++)
+        if (pattern[0] == '%' && pattern[1] == 'p') {
+            i += sprintf(&path[i], "%ld", (long) getpid());
+            pattern++;
+        }
+        else path[i++] = *pattern;
+    path[i] = '\0';
+
+    trace.fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0666);
+    if (trace.fd >= 0) {
+        hts_trace_header hdr;
+        memcpy(hdr.magic, HTS_TRACE_MAGIC, sizeof hdr.magic);
+        hdr.version = HTS_TRACE_VERSION;
+        hdr.record_size = sizeof (hts_trace_record);
+        write_all((const char *) &hdr, sizeof hdr);
+    }
+    else if (errno == EEXIST)
+        trace.fd = open(path, O_WRONLY | O_APPEND);
+
+    if (trace.fd < 0) {
+        if (hts_verbose >= 2)
+            fprintf(stderr, "[E::hfile_trace] can't open trace file \"%s\": %s\n",
+                    path, strerror(errno));
+        ret = -1;
+    }
+    else (void) fcntl(trace.fd, F_SETFD, FD_CLOEXEC);
+
+done:
+    pthread_mutex_unlock(&trace.lock);
+    return ret;
+}
+
+static void trace_exit(void)
+{
+    trace_buffer *b, *next;
+
+    // Flush and free all threads' buffers, including those of threads
+    // that are still running.
+    pthread_mutex_lock(&trace.lock);
+    for (b = trace.buffers; b; b = next) {
+        next = b->next;
+        pthread_mutex_lock(&b->lock);
+        flush_buffer(b);
+        pthread_mutex_unlock(&b->lock);
+        pthread_mutex_destroy(&b->lock);
+        free(b);
+    }
+    trace.buffers = NULL;
+    pthread_mutex_unlock(&trace.lock);
+
+    pthread_key_delete(trace.key);
+    if (trace.fd >= 0) (void) close(trace.fd);
+    trace.fd = -1;
+}
+
+static const char *strip_trace_scheme(const char *filename)
+{
+    if (strncmp(filename, "trace:", 6) == 0) filename += 6;
+    return filename;
+}
+
+static hFILE *hopen_trace(const char *filename, const char *mode)
+{
+    const char *url = strip_trace_scheme(filename);
+    hFILE_trace *fp = NULL;
+    int save;
+
+    if (trace_init() < 0) return NULL;
+
+    fp = (hFILE_trace *) hfile_init(sizeof (hFILE_trace), mode, 0);
+    if (fp == NULL) return NULL;
+
+    fp->handle = __atomic_add_fetch(&trace.nhandles, 1, __ATOMIC_RELAXED);
+    fp->pos = 0;
+
+    uint64_t start = now();
+    fp->rawfp = hopen(url, mode);
+    emit(fp, HTS_TRACE_OPEN, start, 0, strlen(url),
+         fp->rawfp? hfile_oflags(mode) : -1, url, strlen(url));
+    if (fp->rawfp == NULL) goto error;
+
+    fp->base.backend = &trace_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+static int trace_isremote(const char *filename)
+{
+    return hisremote(strip_trace_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_trace, trace_isremote, "trace", 50 };
+
+    if (pthread_key_create(&trace.key, release_buffer) != 0) return -1;
+    trace.fd = -1;
+
+    self->name = "trace";
+    self->destroy = trace_exit;
+    hfile_add_scheme_handler("trace", &handler);
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*  hfile_trace.h -- binary format of traces written by hfile_trace.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#ifndef HFILE_TRACE_H
+#define HFILE_TRACE_H
+
+#include <stdint.h>
+
+/* A trace file consists of this header followed by records, in native
+   byte order.  Records from different threads are written in batches, so
+   they are ordered by time only within each thread.  */
+
+#define HTS_TRACE_MAGIC "HTSTRACE"
+#define HTS_TRACE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} hts_trace_header;
+
+enum hts_trace_op {
+    HTS_TRACE_OPEN = 1, HTS_TRACE_READ, HTS_TRACE_WRITE, HTS_TRACE_SEEK,
+    HTS_TRACE_FLUSH, HTS_TRACE_CLOSE
+};
+
+typedef struct {
+    uint64_t time;      // Start of the call, in ns since an arbitrary epoch
+    uint64_t latency;   // Duration of the call, in ns
+    int64_t  offset;    // Stream position before the call, or seek's offset
+    int64_t  result;    // Return value of the call
+    uint64_t length;    // Bytes requested, seek's whence, or open's URL length
+    uint32_t handle;    // Identifies the stream within the process
+    uint32_t thread;    // Operating system thread ID, where available
+    uint8_t  op;        // An hts_trace_op value
+    uint8_t  reserved[7];
+} hts_trace_record;
+
+/* HTS_TRACE_OPEN records are immediately followed by the URL (without the
+   "trace:" prefix) as LENGTH bytes, not NUL-terminated, and padded with
+   NULs to a multiple of 8 bytes.  Their RESULT is the open(2)-style
+   flags of the stream's mode.  */
+
+#endif
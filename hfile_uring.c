@@ -0,0 +1,420 @@
+/*  hfile_uring.c -- io_uring local file backend for low-level file streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <liburing.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+#include "hfile_layout.h"
+
+// Reads in flight are limited to this many, however many are asked for.
+#define MAX_DEPTH 4096
+
+// Each block is one read request, kept in flight until the reader gets to it.
+typedef struct {
+    char *data;
+    off_t offset;       // File offset of data[0]
+    size_t length;      // Bytes read so far
+    size_t wanted;      // Bytes requested (0 if beyond EOF)
+    int inflight, error;
+} uring_block;
+
+typedef struct {
+    hFILE base;
+    struct io_uring ring;
+    uring_block *blocks;
+    char *buffers;
+    unsigned nblocks, head, inflight;
+    size_t blksize;
+    hfile_layout layout;
+    off_t pos, next, size;
+    int fd, fixed_buffers, fixed_file, writing;
+} hFILE_uring;
+
+static int submit_block(hFILE_uring *fp, unsigned i)
+{
+    uring_block *b = &fp->blocks[i];
+    size_t start = b->length;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&fp->ring);
+    if (sqe == NULL) {
+        int ret = io_uring_submit(&fp->ring);
+        if (ret < 0) { errno = -ret; return -1; }
+        sqe = io_uring_get_sqe(&fp->ring);
+        if (sqe == NULL) { errno = EAGAIN; return -1; }
+    }
+
+    int fd = fp->fixed_file? 0 : fp->fd;
+    if (fp->fixed_buffers)
+        io_uring_prep_read_fixed(sqe, fd, b->data + start, b->wanted - start,
+                                 b->offset + start, i);
+    else
+        io_uring_prep_read(sqe, fd, b->data + start, b->wanted - start,
+                           b->offset + start);
+
+    if (fp->fixed_file) io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    io_uring_sqe_set_data(sqe, b);
+    b->inflight = 1;
+    fp->inflight++;
+    return 0;
+}
+
+// Queue block i to read the next part of the file beyond those already queued.
+static int issue_block(hFILE_uring *fp, unsigned i)
+{
+    uring_block *b = &fp->blocks[i];
+
+    b->offset = fp->next;
+    b->length = 0;
+    b->error = 0;
+    b->wanted = (fp->next < fp->size)? fp->size - fp->next : 0;
+    if (b->wanted > fp->blksize) b->wanted = fp->blksize;
+    fp->next += b->wanted;
+
+    return (b->wanted > 0)? submit_block(fp, i) : 0;
+}
+
+// Waits for one completion and records its result in the relevant block.
+static int reap_one(hFILE_uring *fp)
+{
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(&fp->ring, &cqe);
+    if (ret < 0) { errno = -ret; return -1; }
+
+    uring_block *b = (uring_block *) io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&fp->ring, cqe);
+
+    // Completions for cancellation requests carry no block.
+    if (b == NULL) return 0;
+
+    b->inflight = 0;
+    fp->inflight--;
+
+    if (res < 0) {
+        if (res != -ECANCELED) b->error = -res;
+    }
+    else if (res == 0) {
+        // The file has been truncated since it was opened.
+        b->wanted = b->length;
+    }
+    else {
+        b->length += res;
+        if (b->length < b->wanted) {
+            // Short read: queue the remainder of the block.
+            if (submit_block(fp, b - fp->blocks) < 0) return -1;
+            ret = io_uring_submit(&fp->ring);
+            if (ret < 0) { errno = -ret; return -1; }
+        }
+    }
+
+    return 0;
+}
+
+// Cancels all outstanding reads and waits for them to finish.
+static int drain(hFILE_uring *fp)
+{
+    unsigned i;
+    int ret;
+
+    for (i = 0; i < fp->nblocks; i++)
+        if (fp->blocks[i].inflight) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&fp->ring);
+            if (sqe == NULL) break;  // Just wait for the rest to finish
+            io_uring_prep_cancel(sqe, &fp->blocks[i], 0);
+            io_uring_sqe_set_data(sqe, NULL);
+        }
+
+    ret = io_uring_submit(&fp->ring);
+    if (ret < 0) { errno = -ret; return -1; }
+
+    while (fp->inflight > 0)
+        if (reap_one(fp) < 0) return -1;
+
+    return 0;
+}
+
+// Discards all blocks and starts reading ahead afresh from fp->pos.
+static int restart(hFILE_uring *fp)
+{
+    unsigned i;
+    int ret;
+
+    if (drain(fp) < 0) return -1;
+
+    fp->head = 0;
+    fp->next = fp->pos - fp->pos % fp->blksize;
+    for (i = 0; i < fp->nblocks; i++)
+        if (issue_block(fp, i) < 0) return -1;
+
+    ret = io_uring_submit(&fp->ring);
+    if (ret < 0) { errno = -ret; return -1; }
+    return 0;
+}
+
+static ssize_t uring_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    uring_block *b = &fp->blocks[fp->head];
+    int ret;
+
+    if (fp->writing) return read(fp->fd, buffer, nbytes);
+    if (fp->pos >= fp->size) return 0;
+
+    if (fp->pos < b->offset || fp->pos >= b->offset + (off_t) b->wanted) {
+        if (restart(fp) < 0) return -1;
+        b = &fp->blocks[fp->head];
+    }
+
+    while (b->inflight)
+        if (reap_one(fp) < 0) return -1;
+
+    if (b->error) {
+        errno = b->error;
+        b->wanted = b->length = 0;  // Retry via restart() on the next read
+        return -1;
+    }
+
+    size_t skip = fp->pos - b->offset;
+    size_t avail = b->length - skip;
+    if (nbytes > avail) nbytes = avail;
+    memcpy(buffer, b->data + skip, nbytes);
+    fp->pos += nbytes;
+
+    if (fp->pos >= b->offset + (off_t) b->wanted) {
+        // This block is finished with, so reuse it to read further ahead.
+        if (issue_block(fp, fp->head) < 0) return -1;
+        ret = io_uring_submit(&fp->ring);
+        if (ret < 0) { errno = -ret; return -1; }
+        fp->head = (fp->head + 1) % fp->nblocks;
+    }
+
+    return nbytes;
+}
+
+static ssize_t uring_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    // Output is already gathered into large writes by hFILE's buffering,
+    // so there is little to gain by routing it through the ring.
+    return write(fp->fd, buffer, nbytes);
+}
+
+static off_t uring_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    off_t origin;
+
+    if (fp->writing) return lseek(fp->fd, offset, whence);
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->size; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > fp->size - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = origin + offset;
+
+    // Retire blocks before the new position, if it is within the read-ahead
+    // window; otherwise uring_read() will restart the read-ahead afresh.
+    if (fp->pos >= fp->blocks[fp->head].offset && fp->pos < fp->next) {
+        uring_block *b = &fp->blocks[fp->head];
+        while (fp->pos >= b->offset + (off_t) b->wanted) {
+            while (b->inflight)
+                if (reap_one(fp) < 0) return -1;
+            if (issue_block(fp, fp->head) < 0) return -1;
+            fp->head = (fp->head + 1) % fp->nblocks;
+            b = &fp->blocks[fp->head];
+        }
+
+        int ret = io_uring_submit(&fp->ring);
+        if (ret < 0) { errno = -ret; return -1; }
+    }
+
+    return fp->pos;
+}
+
+static int uring_close(hFILE *fpv)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    int ret = 0;
+
+    if (! fp->writing) {
+        if (drain(fp) < 0) ret = -1;
+        io_uring_queue_exit(&fp->ring);
+        free(fp->blocks);
+        free(fp->buffers);
+    }
+
+    if (close(fp->fd) < 0) ret = -1;
+    return ret;
+}
+
+static const struct hFILE_backend uring_backend =
+{
+    uring_read, uring_write, uring_seek, NULL, uring_close
+};
+
+// Sets up the ring and buffers, as configured by OPTIONS or the environment.
+static int init_ring(hFILE_uring *fp, const char *options)
+{
+    struct iovec *iov = NULL;
+    unsigned i;
+    int ret;
+
+    // For striped files, blocks are whole stripes and there are enough in
+    // flight to keep every server busy.
+    long depth = fp->layout.stripe_count;
+    if (depth < 8) depth = 8;
+    else if (depth > 64) depth = 64;
+
+    depth = hfile_option_int(options, "depth", "HTS_URING_DEPTH", depth,
+                             1, LONG_MAX);
+    fp->nblocks = (depth < MAX_DEPTH)? depth : MAX_DEPTH;
+    fp->blksize = hfile_option_size(options, "block_size",
+                                    "HTS_URING_BLOCK_SIZE", 1048576);
+    if (fp->blksize < 4096) fp->blksize = 4096;
+    fp->blksize = hfile_layout_align(&fp->layout, fp->blksize);
+    fp->blksize -= fp->blksize % 4096;
+
+    ret = io_uring_queue_init(fp->nblocks, &fp->ring, 0);
+    if (ret < 0) { errno = -ret; return -1; }
+
+    fp->blocks = calloc(fp->nblocks, sizeof (uring_block));
+    iov = malloc(fp->nblocks * sizeof (struct iovec));
+    if (posix_memalign((void **) &fp->buffers, 4096,
+                       fp->nblocks * fp->blksize) != 0) fp->buffers = NULL;
+    if (fp->blocks == NULL || iov == NULL || fp->buffers == NULL) {
+        io_uring_queue_exit(&fp->ring);
+        free(fp->blocks);
+        free(fp->buffers);
+        free(iov);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < fp->nblocks; i++) {
+        fp->blocks[i].data = fp->buffers + i * fp->blksize;
+        iov[i].iov_base = fp->blocks[i].data;
+        iov[i].iov_len = fp->blksize;
+    }
+
+    // Registration saves per-request page pinning and file lookups, but may
+    // be refused (e.g., due to RLIMIT_MEMLOCK); plain requests work anyway.
+    ret = io_uring_register_buffers(&fp->ring, iov, fp->nblocks);
+    fp->fixed_buffers = (ret == 0);
+    if (ret < 0 && hts_verbose >= 4)
+        fprintf(stderr, "[W::hfile_uring] can't register buffers: %s\n",
+                strerror(-ret));
+    free(iov);
+
+    ret = io_uring_register_files(&fp->ring, &fp->fd, 1);
+    fp->fixed_file = (ret == 0);
+    if (ret < 0 && hts_verbose >= 4)
+        fprintf(stderr, "[W::hfile_uring] can't register file: %s\n",
+                strerror(-ret));
+
+    // Start with all blocks idle at the beginning, so the first read
+    // (or any seek) kicks off the read-ahead.
+    fp->head = 0;
+    fp->next = 0;
+    fp->inflight = 0;
+    return 0;
+}
+
+static hFILE *hopen_uring(const char *url, const char *modestr)
+{
+    static const char *const option_names[] =
+        { "block_size", "depth", NULL };
+    int mode = hfile_oflags(modestr);
+    struct stat st;
+    int fd = -1;
+    hFILE_uring *fp = NULL;
+    hfile_layout layout;
+    const char *options;
+    char *filename = NULL;
+    int save;
+
+    if (strncmp(url, "uring://localhost/", 18) == 0) url += 17;
+    else if (strncmp(url, "uring:///", 9) == 0) url += 8;
+    else if (strncmp(url, "uring:", 6) == 0) url += 6;
+
+    options = url + hfile_options_start(url, option_names);
+    filename = strndup(url, options - url);
+    if (filename == NULL) goto error;
+
+    fd = open(filename, mode, 0666);
+    if (fd < 0) goto error;
+    if (fstat(fd, &st) < 0) goto error;
+
+    hfile_layout_get(fd, filename, &layout);
+    fp = (hFILE_uring *) hfile_init(sizeof (hFILE_uring), modestr,
+                                    layout.stripe_size? layout.stripe_size
+                                                      : st.st_blksize);
+    if (fp == NULL) goto error;
+
+    fp->fd = fd;
+    fp->layout = layout;
+    fp->pos = 0;
+    fp->size = st.st_size;
+    fp->writing = ((mode & O_ACCMODE) != O_RDONLY);
+    if (! fp->writing && init_ring(fp, options) < 0) goto error;
+
+    free(filename);
+    fp->base.backend = &uring_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    free(filename);
+    if (fp) hfile_destroy((hFILE *) fp);
+    if (fd >= 0) (void) close(fd);
+    errno = save;
+    return NULL;
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_uring, hfile_always_local, "uring", 10 };
+
+    self->name = "uring";
+    hfile_add_scheme_handler("uring", &handler);
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*  hfile_view.c -- Read-only views of byte ranges of other streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hfile_internal.h"
+#include "hfile_view.h"
+
+typedef struct {
+    hFILE base;
+    off_t offset, length, pos;
+
+    // Either a mapping of the range of a local file...
+    char *map;
+    size_t maplength;
+    const char *data;
+
+    // ...or the inner stream, and its current position.
+    hFILE *rawfp;
+    off_t rawpos;
+} hFILE_view;
+
+const char *hfile_view_local_path(const char *url)
+{
+    const char *s;
+
+    if (strncmp(url, "file://localhost/", 17) == 0) return url + 16;
+    else if (strncmp(url, "file:///", 8) == 0) return url + 7;
+    else if (strncmp(url, "file:", 5) == 0) return url + 5;
+
+    // As in HTSlib, a scheme is at least two characters (so that Windows
+    // drive letters are not mistaken for schemes) followed by a colon.
+    for (s = url; isalnum((unsigned char) *s) || *s == '+' || *s == '-' || *s == '.'; s++)
+        ;
+    return (*s == ':' && s - url >= 2)? NULL : url;
+}
+
+static ssize_t view_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_view *fp = (hFILE_view *) fpv;
+    off_t avail = fp->length - fp->pos;
+    ssize_t n;
+
+    if ((off_t) nbytes > avail) nbytes = avail;
+    if (nbytes == 0) return 0;
+
+    if (fp->data) {
+        memcpy(buffer, fp->data + fp->pos, nbytes);
+        n = nbytes;
+    }
+    else {
+        if (fp->rawpos != fp->offset + fp->pos) {
+            if (hseek(fp->rawfp, fp->offset + fp->pos, SEEK_SET) < 0)
+                return -1;
+            fp->rawpos = fp->offset + fp->pos;
+        }
+
+        n = hread(fp->rawfp, buffer, nbytes);
+        if (n < 0) return -1;
+        fp->rawpos += n;
+    }
+
+    fp->pos += n;
+    return n;
+}
+
+static off_t view_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_view *fp = (hFILE_view *) fpv;
+    off_t origin;
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->length; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    // Positions outwith the view are clamped to its start or end.
+    if (offset < -origin) offset = -origin;
+    else if (offset > fp->length - origin) offset = fp->length - origin;
+
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static int view_close(hFILE *fpv)
+{
+    hFILE_view *fp = (hFILE_view *) fpv;
+    int ret = 0;
+
+    if (fp->map && munmap(fp->map, fp->maplength) < 0) ret = -1;
+    if (fp->rawfp && hclose(fp->rawfp) < 0) ret = -1;
+    return ret;
+}
+
+static const struct hFILE_backend view_backend =
+{
+    view_read, NULL, view_seek, NULL, view_close
+};
+
+static void clamp(hFILE_view *fp, off_t size)
+{
+    if (fp->offset > size) fp->offset = size;
+    if (fp->length < 0 || fp->length > size - fp->offset)
+        fp->length = size - fp->offset;
+}
+
+// Maps the view's range of the local file PATH.  Returns 0 on success, or -1
+// if it could not be mapped (in which case it can still be read via hopen).
+static int map_local(hFILE_view *fp, const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    if (fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode)) goto error;
+    clamp(fp, st.st_size);
+    if (fp->length == 0) {
+        fp->data = "";
+        close(fd);
+        return 0;
+    }
+
+    // The mapping must start on a page boundary.
+    off_t start = fp->offset - fp->offset % sysconf(_SC_PAGESIZE);
+    fp->maplength = fp->offset + fp->length - start;
+    fp->map = mmap(NULL, fp->maplength, PROT_READ, MAP_SHARED, fd, start);
+    if (fp->map == MAP_FAILED) { fp->map = NULL; goto error; }
+
+    fp->data = fp->map + (fp->offset - start);
+    close(fd);
+    return 0;
+
+error:
+    close(fd);
+    return -1;
+}
+
+hFILE *hfile_view_open(const char *url, off_t offset, off_t length,
+                       const char *mode)
+{
+    hFILE_view *fp;
+    const char *path;
+    int save;
+
+    if (strchr(mode, 'r') == NULL || strpbrk(mode, "wa+") || offset < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fp = (hFILE_view *) hfile_init(sizeof (hFILE_view), mode, 0);
+    if (fp == NULL) return NULL;
+
+    fp->offset = offset;
+    fp->length = length;
+    fp->pos = 0;
+    fp->map = NULL;
+    fp->maplength = 0;
+    fp->data = NULL;
+    fp->rawfp = NULL;
+    fp->rawpos = -1;
+
+    path = hfile_view_local_path(url);
+    if (path == NULL || map_local(fp, path) < 0) {
+        off_t size;
+
+        fp->rawfp = hopen(url, mode);
+        if (fp->rawfp == NULL) goto error;
+
+        size = hseek(fp->rawfp, 0, SEEK_END);
+        if (size < 0) goto error;
+        clamp(fp, size);
+    }
+
+    fp->base.backend = &view_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    if (fp->rawfp) hclose_abruptly(fp->rawfp);
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
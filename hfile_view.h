@@ -0,0 +1,49 @@
+/*  hfile_view.h -- Read-only views of byte ranges of other streams.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+
+#ifndef HFILE_VIEW_H
+#define HFILE_VIEW_H
+
+#include <sys/types.h>
+
+#include "htslib/hfile.h"
+
+/* hfile_view.o is linked into each plugin that uses it, so its symbols
+   are hidden to avoid clashes between plugins loaded with RTLD_GLOBAL.  */
+#if defined __GNUC__ && !defined _WIN32 && !defined __CYGWIN__
+#define HFILE_VIEW_HIDDEN __attribute__ ((visibility ("hidden")))
+#else
+#define HFILE_VIEW_HIDDEN
+#endif
+
+/* Opens a read-only stream presenting bytes OFFSET to OFFSET+LENGTH of URL
+   as a standalone seekable file, or to the end of URL if LENGTH is negative.
+   The range is clamped to the size of URL.  Local files are memory-mapped;
+   other URLs are opened with hopen() and must be seekable.  */
+hFILE *hfile_view_open(const char *url, off_t offset, off_t length,
+                       const char *mode) HFILE_VIEW_HIDDEN;
+
+/* Returns the filename if URL refers to a local file, or NULL otherwise.  */
+const char *hfile_view_local_path(const char *url) HFILE_VIEW_HIDDEN;
+
+#endif
@@ -0,0 +1,767 @@
+/*  hfile_zstd.c -- Seekable zstd compressed stream backend.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zstd.h>
+#include <zstd_errors.h>
+
+#include "htslib/hts.h"  // for hts_verbose
+#include "hfile_internal.h"
+#include "hfile_env.h"
+
+/* Files are written in the zstd seekable format: a series of independent
+   zstd frames followed by a skippable frame containing the seek table,
+
+     Magic 0x184D2A5E, Frame_Size (both 32-bit little-endian)
+     Compressed_Size, Decompressed_Size[, Checksum]  for each frame
+     Number_Of_Frames, Descriptor (8-bit), Seekable_Magic 0x8F92EAB1
+
+   which allows frames to be located, and so decompressed in parallel, and
+   seeks to be made by decompressing only the frame containing the target.
+   Other zstd files can be read sequentially but are not seekable.  */
+
+#define SKIPPABLE_MAGIC 0x184D2A5E
+#define SEEKABLE_MAGIC  0x8F92EAB1
+#define FOOTER_SIZE     9
+#define CHECKSUM_FLAG   0x80
+
+// Upper limit on $HTS_ZSTD_THREADS; each thread has two frame slots.
+#define MAX_THREADS 256
+
+enum slot_state { EMPTY, QUEUED, BUSY, DONE, FAILED };
+
+// When reading, slots[k % nslots] holds frame k; when writing, it holds the
+// uncompressed and compressed data of the k-th frame written.
+typedef struct {
+    int64_t frame;
+    enum slot_state state;
+    char *data, *cdata;
+    size_t length, clength, capacity, ccapacity;
+    int error;
+} zstd_slot;
+
+typedef struct {
+    hFILE base;
+    hFILE *rawfp;
+    int writing;
+    size_t frame_size;
+    int level;
+
+    // Seek table: frame k occupies coffset[k] to coffset[k+1] in the inner
+    // stream and doffset[k] to doffset[k+1] in the decompressed stream.
+    int64_t nframes, maxframes;
+    off_t *coffset, *doffset;
+    off_t pos;
+
+    // Used instead when reading a zstd file without a seek table.
+    ZSTD_DStream *dstream;
+    ZSTD_inBuffer in;
+    char *inbuf;
+    size_t inbufsize;
+    int at_end;
+
+    // The following are shared with the worker threads and protected by
+    // lock; the inner stream is accessed only by the thread holding io.
+    pthread_t *workers;
+    unsigned nworkers, nslots;
+    zstd_slot *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int64_t current, next, nextout, filling;
+    int draining, stop, error;
+} hFILE_zstd;
+
+static inline uint32_t le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void put_le32(unsigned char *p, uint32_t x)
+{
+    p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+static int zstd_errno(size_t ret, const char *function)
+{
+    if (hts_verbose >= 4)
+        fprintf(stderr, "[E::hfile_zstd] %s() failed: %s\n",
+                function, ZSTD_getErrorName(ret));
+    return (ZSTD_getErrorCode(ret) == ZSTD_error_memory_allocation)? ENOMEM
+                                                                    : EIO;
+}
+
+static int ensure_capacity(char **buffer, size_t *capacity, size_t needed)
+{
+    if (*capacity < needed) {
+        char *newbuffer = realloc(*buffer, needed);
+        if (newbuffer == NULL) return -1;
+        *buffer = newbuffer;
+        *capacity = needed;
+    }
+    return 0;
+}
+
+static ssize_t read_fully(hFILE *fp, void *buffer, size_t nbytes)
+{
+    size_t total = 0;
+    while (total < nbytes) {
+        ssize_t n = hread(fp, (char *) buffer + total, nbytes - total);
+        if (n < 0) return -1;
+        else if (n == 0) break;
+        total += n;
+    }
+    return total;
+}
+
+// Decompresses the frame assigned to slot S.  Called without fp->lock held.
+static int decompress_frame(hFILE_zstd *fp, zstd_slot *s, ZSTD_DCtx *dctx)
+{
+    int64_t k = s->frame;
+    size_t clen = fp->coffset[k+1] - fp->coffset[k];
+    size_t dlen = fp->doffset[k+1] - fp->doffset[k];
+    size_t ret;
+    ssize_t n;
+
+    if (ensure_capacity(&s->cdata, &s->ccapacity, clen) < 0 ||
+        ensure_capacity(&s->data, &s->capacity, dlen) < 0) return ENOMEM;
+
+    // Frames are read from the inner stream one at a time, but decompressed
+    // concurrently.  The draining flag serves as the I/O lock.
+    pthread_mutex_lock(&fp->lock);
+    while (fp->draining) pthread_cond_wait(&fp->cond, &fp->lock);
+    fp->draining = 1;
+    pthread_mutex_unlock(&fp->lock);
+
+    n = -1;
+    if (hseek(fp->rawfp, fp->coffset[k], SEEK_SET) >= 0)
+        n = read_fully(fp->rawfp, s->cdata, clen);
+    int err = errno;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->draining = 0;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+
+    if (n < 0) return err;
+    else if ((size_t) n < clen) return EIO;
+
+    ret = ZSTD_decompressDCtx(dctx, s->data, dlen, s->cdata, clen);
+    if (ZSTD_isError(ret)) return zstd_errno(ret, "ZSTD_decompressDCtx");
+    else if (ret != dlen) return EIO;
+
+    s->length = dlen;
+    return 0;
+}
+
+// Writes out completed frames in order.  Called with fp->lock held.
+static void drain(hFILE_zstd *fp)
+{
+    while (! fp->draining) {
+        zstd_slot *s = &fp->slots[fp->nextout % fp->nslots];
+        if (s->frame != fp->nextout || (s->state != DONE && s->state != FAILED))
+            break;
+
+        fp->draining = 1;
+        pthread_mutex_unlock(&fp->lock);
+
+        int err = s->error;
+        if (! err && fp->error == 0 &&
+            hwrite(fp->rawfp, s->cdata, s->clength) != (ssize_t) s->clength)
+            err = errno;
+
+        pthread_mutex_lock(&fp->lock);
+        if (err && fp->error == 0) fp->error = err;
+        if (fp->error == 0) {
+            int64_t k = fp->nframes++;
+            fp->coffset[k+1] = fp->coffset[k] + s->clength;
+            fp->doffset[k+1] = fp->doffset[k] + s->length;
+        }
+        s->state = EMPTY;
+        s->frame = -1;
+        fp->nextout++;
+        fp->draining = 0;
+        pthread_cond_broadcast(&fp->cond);
+    }
+}
+
+static void *worker(void *fpv)
+{
+    hFILE_zstd *fp = (hFILE_zstd *) fpv;
+    ZSTD_CCtx *cctx = NULL;
+    ZSTD_DCtx *dctx = NULL;
+
+    if (fp->writing) cctx = ZSTD_createCCtx();
+    else dctx = ZSTD_createDCtx();
+
+    pthread_mutex_lock(&fp->lock);
+    while (! fp->stop) {
+        zstd_slot *s;
+
+        if (fp->writing) {
+            s = &fp->slots[fp->next % fp->nslots];
+            if (s->frame != fp->next || s->state != QUEUED) {
+                pthread_cond_wait(&fp->cond, &fp->lock);
+                continue;
+            }
+        }
+        else {
+            if (fp->next < fp->current) fp->next = fp->current;
+            s = &fp->slots[fp->next % fp->nslots];
+            if (fp->next >= fp->nframes ||
+                fp->next >= fp->current + fp->nslots || s->state == BUSY) {
+                pthread_cond_wait(&fp->cond, &fp->lock);
+                continue;
+            }
+            s->frame = fp->next;
+        }
+
+        fp->next++;
+        s->state = BUSY;
+        pthread_mutex_unlock(&fp->lock);
+
+        int err = 0;
+        if (fp->writing) {
+            size_t bound = ZSTD_compressBound(s->length), ret;
+            if (cctx == NULL ||
+                ensure_capacity(&s->cdata, &s->ccapacity, bound) < 0)
+                err = ENOMEM;
+            else {
+                ret = ZSTD_compressCCtx(cctx, s->cdata, s->ccapacity,
+                                        s->data, s->length, fp->level);
+                if (ZSTD_isError(ret)) err = zstd_errno(ret, "ZSTD_compressCCtx");
+                else s->clength = ret;
+            }
+        }
+        else err = dctx? decompress_frame(fp, s, dctx) : ENOMEM;
+
+        pthread_mutex_lock(&fp->lock);
+        s->error = err;
+        s->state = err? FAILED : DONE;
+        pthread_cond_broadcast(&fp->cond);
+        if (fp->writing) drain(fp);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+static int64_t find_frame(hFILE_zstd *fp, off_t pos)
+{
+    int64_t lo = 0, hi = fp->nframes;
+    while (hi - lo > 1) {
+        int64_t mid = (lo + hi) / 2;
+        if (fp->doffset[mid] <= pos) lo = mid; else hi = mid;
+    }
+    return lo;
+}
+
+// Discards all read-ahead and restarts it from frame K.  Called with
+// fp->lock held.
+static void restart(hFILE_zstd *fp, int64_t k)
+{
+    unsigned i, busy;
+
+    do {
+        for (busy = i = 0; i < fp->nslots; i++)
+            if (fp->slots[i].state == BUSY) busy = 1;
+        if (busy) pthread_cond_wait(&fp->cond, &fp->lock);
+    } while (busy);
+
+    for (i = 0; i < fp->nslots; i++) {
+        fp->slots[i].frame = -1;
+        fp->slots[i].state = EMPTY;
+    }
+    fp->current = fp->next = k;
+    pthread_cond_broadcast(&fp->cond);
+}
+
+static ssize_t stream_read(hFILE_zstd *fp, void *buffer, size_t nbytes)
+{
+    ZSTD_outBuffer out = { buffer, nbytes, 0 };
+
+    while (out.pos == 0 && ! fp->at_end) {
+        if (fp->in.pos == fp->in.size) {
+            ssize_t n = hread(fp->rawfp, fp->inbuf, fp->inbufsize);
+            if (n < 0) return -1;
+            else if (n == 0) { fp->at_end = 1; break; }
+            fp->in.src = fp->inbuf;
+            fp->in.size = n;
+            fp->in.pos = 0;
+        }
+
+        size_t ret = ZSTD_decompressStream(fp->dstream, &out, &fp->in);
+        if (ZSTD_isError(ret)) {
+            errno = zstd_errno(ret, "ZSTD_decompressStream");
+            return -1;
+        }
+    }
+
+    fp->pos += out.pos;
+    return out.pos;
+}
+
+static ssize_t zstd_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_zstd *fp = (hFILE_zstd *) fpv;
+    int64_t k;
+    zstd_slot *s;
+
+    if (fp->dstream) return stream_read(fp, buffer, nbytes);
+    if (fp->pos >= fp->doffset[fp->nframes]) return 0;
+
+    k = find_frame(fp, fp->pos);
+    s = &fp->slots[k % fp->nslots];
+
+    pthread_mutex_lock(&fp->lock);
+    for (;;) {
+        if (s->frame == k && s->state == DONE) break;
+        else if (s->frame == k && s->state == FAILED) {
+            errno = s->error;
+            s->frame = -1;  // Retry on the next read
+            s->state = EMPTY;
+            pthread_mutex_unlock(&fp->lock);
+            return -1;
+        }
+        else if (s->frame != k && ! (k >= fp->next && k < fp->next + fp->nslots))
+            restart(fp, k);
+
+        if (fp->current != k) {
+            fp->current = k;
+            pthread_cond_broadcast(&fp->cond);
+        }
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+
+    if (fp->current != k) {
+        fp->current = k;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    // Workers do not reuse this slot while it holds the current frame.
+    size_t skip = fp->pos - fp->doffset[k];
+    if (nbytes > s->length - skip) nbytes = s->length - skip;
+    memcpy(buffer, s->data + skip, nbytes);
+    fp->pos += nbytes;
+    return nbytes;
+}
+
+// Waits for slot number fp->filling to be free for accumulating a new
+// frame.  Called with fp->lock held.
+static zstd_slot *filling_slot(hFILE_zstd *fp)
+{
+    zstd_slot *s = &fp->slots[fp->filling % fp->nslots];
+    while (s->state != EMPTY) pthread_cond_wait(&fp->cond, &fp->lock);
+
+    if (s->frame != fp->filling) {
+        s->frame = fp->filling;
+        s->length = 0;
+        s->error = 0;
+    }
+    return s;
+}
+
+// Queues the partially or completely filled frame for compression.
+// Called with fp->lock held.
+static int queue_frame(hFILE_zstd *fp)
+{
+    zstd_slot *s = filling_slot(fp);
+    if (s->length == 0) return 0;
+
+    // Ensure the seek table can accommodate all frames in flight.
+    if (fp->filling + 2 > fp->maxframes) {
+        int64_t n = fp->maxframes * 2;
+        off_t *coffset = realloc(fp->coffset, n * sizeof (off_t));
+        if (coffset) fp->coffset = coffset;
+        off_t *doffset = realloc(fp->doffset, n * sizeof (off_t));
+        if (doffset) fp->doffset = doffset;
+        if (coffset == NULL || doffset == NULL) { errno = ENOMEM; return -1; }
+        fp->maxframes = n;
+    }
+
+    s->state = QUEUED;
+    fp->filling++;
+    pthread_cond_broadcast(&fp->cond);
+    return 0;
+}
+
+static ssize_t zstd_write(hFILE *fpv, const void *bufferv, size_t nbytes)
+{
+    hFILE_zstd *fp = (hFILE_zstd *) fpv;
+    const char *buffer = (const char *) bufferv;
+    size_t total = 0;
+
+    pthread_mutex_lock(&fp->lock);
+    while (total < nbytes) {
+        if (fp->error) { errno = fp->error; total = 0; break; }
+
+        zstd_slot *s = filling_slot(fp);
+        size_t n = fp->frame_size - s->length;
+        if (n > nbytes - total) n = nbytes - total;
+
+        pthread_mutex_unlock(&fp->lock);
+        memcpy(&s->data[s->length], &buffer[total], n);
+        s->length += n;
+        total += n;
+        pthread_mutex_lock(&fp->lock);
+
+        if (s->length == fp->frame_size && queue_frame(fp) < 0) {
+            total = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fp->lock);
+
+    return (total > 0 || nbytes == 0)? (ssize_t) total : -1;
+}
+
+// Writes out all data written so far.  Called with fp->lock held.
+static int finish_frames(hFILE_zstd *fp)
+{
+    if (queue_frame(fp) < 0) return -1;
+    while (fp->nextout < fp->filling && fp->error == 0)
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    if (fp->error) { errno = fp->error; return -1; }
+    return 0;
+}
+
+static int zstd_flush(hFILE *fpv)
+{
+    hFILE_zstd *fp = (hFILE_zstd *) fpv;
+    int ret;
+
+    if (! fp->writing) return 0;
+
+    pthread_mutex_lock(&fp->lock);
+    ret = finish_frames(fp);
+    pthread_mutex_unlock(&fp->lock);
+
+    if (ret == 0 && hflush(fp->rawfp) < 0) ret = -1;
+    return ret;
+}
+
+static off_t zstd_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_zstd *fp = (hFILE_zstd *) fpv;
+    off_t origin;
+
+    if (fp->writing || fp->dstream) { errno = ESPIPE; return -1; }
+
+    switch (whence) {
+    case SEEK_SET: origin = 0; break;
+    case SEEK_CUR: origin = fp->pos; break;
+    case SEEK_END: origin = fp->doffset[fp->nframes]; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    if (offset < -origin || offset > fp->doffset[fp->nframes] - origin) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // zstd_read() will use already decompressed frames or restart.
+    fp->pos = origin + offset;
+    return fp->pos;
+}
+
+static int write_seek_table(hFILE_zstd *fp)
+{
+    size_t size = 8 + 8 * fp->nframes + FOOTER_SIZE;
+    unsigned char *table = malloc(size), *p = table;
+    int64_t k;
+    int ret = 0;
+
+    if (table == NULL) return -1;
+
+    put_le32(p, SKIPPABLE_MAGIC); p += 4;
+    put_le32(p, size - 8); p += 4;
+    for (k = 0; k < fp->nframes; k++) {
+        put_le32(p, fp->coffset[k+1] - fp->coffset[k]); p += 4;
+        put_le32(p, fp->doffset[k+1] - fp->doffset[k]); p += 4;
+    }
+    put_le32(p, fp->nframes); p += 4;
+    *p++ = 0;  // No checksums
+    put_le32(p, SEEKABLE_MAGIC);
+
+    if (hwrite(fp->rawfp, table, size) != (ssize_t) size) ret = -1;
+    free(table);
+    return ret;
+}
+
+static void stop_workers(hFILE_zstd *fp)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&fp->lock);
+    fp->stop = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    for (i = 0; i < fp->nworkers; i++) pthread_join(fp->workers[i], NULL);
+    fp->nworkers = 0;
+}
+
+static void destroy(hFILE_zstd *fp)
+{
+    unsigned i;
+
+    if (fp->slots) {
+        for (i = 0; i < fp->nslots; i++) {
+            free(fp->slots[i].data);
+            free(fp->slots[i].cdata);
+        }
+        free(fp->slots);
+    }
+    free(fp->workers);
+    free(fp->coffset);
+    free(fp->doffset);
+    free(fp->inbuf);
+    ZSTD_freeDStream(fp->dstream);
+}
+
+static int zstd_close(hFILE *fpv)
+{
+    hFILE_zstd *fp = (hFILE_zstd *) fpv;
+    int err = 0;
+
+    if (fp->writing) {
+        pthread_mutex_lock(&fp->lock);
+        if (finish_frames(fp) < 0) err = errno;
+        pthread_mutex_unlock(&fp->lock);
+    }
+
+    stop_workers(fp);
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+
+    if (fp->writing && ! err && write_seek_table(fp) < 0) err = errno;
+    destroy(fp);
+
+    if (hclose(fp->rawfp) < 0 && ! err) err = errno;
+
+    if (err) { errno = err; return -1; }
+    else return 0;
+}
+
+static const struct hFILE_backend zstd_backend =
+{
+    zstd_read, zstd_write, zstd_seek, zstd_flush, zstd_close
+};
+
+// Reads the seek table, if any, from the end of the inner stream.
+// Returns 1 if found, 0 if not, or -1 on error.
+static int read_seek_table(hFILE_zstd *fp)
+{
+    unsigned char footer[FOOTER_SIZE], *table = NULL, *p;
+    off_t size, start;
+    size_t entry_size, table_size;
+    int64_t k;
+
+    size = hseek(fp->rawfp, 0, SEEK_END);
+    if (size < 0) { hclearerr(fp->rawfp); return 0; }
+    if (size < 8 + FOOTER_SIZE) goto not_seekable;
+
+    if (hseek(fp->rawfp, size - FOOTER_SIZE, SEEK_SET) < 0 ||
+        read_fully(fp->rawfp, footer, FOOTER_SIZE) != FOOTER_SIZE) return -1;
+    if (le32(&footer[5]) != SEEKABLE_MAGIC) goto not_seekable;
+
+    fp->nframes = le32(footer);
+    entry_size = (footer[4] & CHECKSUM_FLAG)? 12 : 8;
+    table_size = 8 + fp->nframes * entry_size + FOOTER_SIZE;
+    if ((off_t) table_size > size) goto invalid;
+    start = size - table_size;
+
+    table = malloc(table_size);
+    if (table == NULL) return -1;
+    if (hseek(fp->rawfp, start, SEEK_SET) < 0 ||
+        read_fully(fp->rawfp, table, table_size) != (ssize_t) table_size)
+        goto error;
+    if (le32(table) != SKIPPABLE_MAGIC || le32(&table[4]) != table_size - 8)
+        goto invalid;
+
+    fp->maxframes = fp->nframes + 1;
+    fp->coffset = malloc(fp->maxframes * sizeof (off_t));
+    fp->doffset = malloc(fp->maxframes * sizeof (off_t));
+    if (fp->coffset == NULL || fp->doffset == NULL) goto error;
+
+    fp->coffset[0] = fp->doffset[0] = 0;
+    for (k = 0, p = &table[8]; k < fp->nframes; k++, p += entry_size) {
+        fp->coffset[k+1] = fp->coffset[k] + le32(p);
+        fp->doffset[k+1] = fp->doffset[k] + le32(&p[4]);
+    }
+    if (fp->coffset[fp->nframes] != start) goto invalid;
+
+    free(table);
+    return 1;
+
+invalid:
+    if (hts_verbose >= 2)
+        fprintf(stderr, "[E::hfile_zstd] invalid seek table\n");
+    free(table);
+    errno = EINVAL;
+    return -1;
+
+error:
+    free(table);
+    return -1;
+
+not_seekable:
+    if (hseek(fp->rawfp, 0, SEEK_SET) < 0) return -1;
+    return 0;
+}
+
+static const char *strip_zstd_scheme(const char *filename)
+{
+    if (strncmp(filename, "zstd:", 5) == 0) filename += 5;
+    return filename;
+}
+
+static hFILE *hopen_zstd(const char *filename, const char *mode)
+{
+    hFILE_zstd *fp = NULL;
+    int flags = hfile_oflags(mode), save, ret;
+    unsigned i;
+
+    if ((flags & O_ACCMODE) == O_RDWR || (flags & O_APPEND)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fp = (hFILE_zstd *) hfile_init(sizeof (hFILE_zstd), mode, 0);
+    if (fp == NULL) return NULL;
+
+    fp->writing = ((flags & O_ACCMODE) == O_WRONLY);
+    fp->nframes = fp->maxframes = 0;
+    fp->coffset = fp->doffset = NULL;
+    fp->pos = 0;
+    fp->dstream = NULL;
+    fp->inbuf = NULL;
+    fp->at_end = 0;
+    fp->workers = NULL;
+    fp->nworkers = 0;
+    fp->slots = NULL;
+    fp->current = fp->next = fp->nextout = fp->filling = 0;
+    fp->draining = fp->stop = fp->error = 0;
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+
+    fp->rawfp = hopen(strip_zstd_scheme(filename), mode);
+    if (fp->rawfp == NULL) goto error;
+
+    fp->frame_size = hfile_env_size("HTS_ZSTD_FRAME_SIZE", 1048576);
+    if (fp->frame_size < 4096) fp->frame_size = 4096;
+    if (fp->frame_size > 1 << 30) fp->frame_size = 1 << 30;
+    fp->level = hfile_env_int("HTS_ZSTD_LEVEL", 3,
+                              ZSTD_minCLevel(), ZSTD_maxCLevel());
+    unsigned nthreads = hfile_env_int("HTS_ZSTD_THREADS", 4, 1, MAX_THREADS);
+
+    if (fp->writing) {
+        fp->maxframes = 64;
+        fp->coffset = malloc(fp->maxframes * sizeof (off_t));
+        fp->doffset = malloc(fp->maxframes * sizeof (off_t));
+        if (fp->coffset == NULL || fp->doffset == NULL) goto error;
+        fp->coffset[0] = fp->doffset[0] = 0;
+    }
+    else {
+        ret = read_seek_table(fp);
+        if (ret < 0) goto error;
+        else if (ret == 0) {
+            // Without a seek table, decompress sequentially in this thread.
+            fp->inbufsize = ZSTD_DStreamInSize();
+            fp->inbuf = malloc(fp->inbufsize);
+            fp->dstream = ZSTD_createDStream();
+            if (fp->inbuf == NULL || fp->dstream == NULL) {
+                errno = ENOMEM;
+                goto error;
+            }
+            size_t zret = ZSTD_initDStream(fp->dstream);
+            if (ZSTD_isError(zret)) {
+                errno = zstd_errno(zret, "ZSTD_initDStream");
+                goto error;
+            }
+            fp->in.src = fp->inbuf;
+            fp->in.size = fp->in.pos = 0;
+
+            fp->base.backend = &zstd_backend;
+            return &fp->base;
+        }
+    }
+
+    fp->nslots = 2 * nthreads;
+    fp->slots = calloc(fp->nslots, sizeof (zstd_slot));
+    fp->workers = malloc(nthreads * sizeof (pthread_t));
+    if (fp->slots == NULL || fp->workers == NULL) goto error;
+    for (i = 0; i < fp->nslots; i++) {
+        zstd_slot *s = &fp->slots[i];
+        s->frame = -1;
+        s->state = EMPTY;
+        if (fp->writing) {
+            s->data = malloc(fp->frame_size);
+            if (s->data == NULL) goto error;
+            s->capacity = fp->frame_size;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        ret = pthread_create(&fp->workers[i], NULL, worker, fp);
+        if (ret != 0) break;
+        fp->nworkers++;
+    }
+    if (fp->nworkers == 0) { errno = ret; goto error; }
+
+    fp->base.backend = &zstd_backend;
+    return &fp->base;
+
+error:
+    save = errno;
+    stop_workers(fp);
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    destroy(fp);
+    if (fp->rawfp) hclose_abruptly(fp->rawfp);
+    hfile_destroy((hFILE *) fp);
+    errno = save;
+    return NULL;
+}
+
+static int zstd_isremote(const char *filename)
+{
+    return hisremote(strip_zstd_scheme(filename));
+}
+
+int hfile_plugin_init(struct hFILE_plugin *self)
+{
+    static const struct hFILE_scheme_handler handler =
+        { hopen_zstd, zstd_isremote, "zstd", 50 };
+
+    self->name = "zstd";
+    hfile_add_scheme_handler("zstd", &handler);
+    return 0;
+}